@@ -53,6 +53,7 @@ class MicroBitBLEChar
     
     bool setChrValue(       microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
     bool notifyChrValue(    microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
+    int  notifyChrValueStatus( microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
     bool indicateChrValue(  microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
     bool writeChrValue(     microbit_gaphandle_t connection, const uint8_t *data, uint16_t length);
 
@@ -94,6 +94,11 @@ class MicroBitBLEService
       * Set  params->data and params->length to update the value
       */
     virtual void onConfirmation( const microbit_ble_evt_hvc_t *params);
+
+    /**
+      * Callback. Invoked when queued notifications have been transmitted, freeing space in the SoftDevice's queue.
+      */
+    virtual void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
     
     public:
     
@@ -107,6 +112,11 @@ class MicroBitBLEService
     bool notifyChrValue( int idx, const uint8_t *data, uint16_t length)
     { return characteristicPtr( idx)->notifyChrValue( getConnectionHandle(), data, length); }
 
+    // As notifyChrValue, but returns DEVICE_OK if sent, DEVICE_BUSY if the SoftDevice's transmit queue is full,
+    // or DEVICE_INVALID_STATE if the notification can't be sent, for example because the client hasn't enabled it.
+    int notifyChrValueStatus( int idx, const uint8_t *data, uint16_t length)
+    { return characteristicPtr( idx)->notifyChrValueStatus( getConnectionHandle(), data, length); }
+
     bool indicateChrValue( int idx, const uint8_t *data, uint16_t len)
     { return characteristicPtr( idx)->indicateChrValue( getConnectionHandle(), data, len); }
                                              
@@ -135,6 +145,7 @@ class MicroBitBLEService
     virtual void onAuthorizeRead(       const microbit_ble_evt_t *p_ble_evt);
     virtual void onAuthorizeWrite(      const microbit_ble_evt_t *p_ble_evt);
     virtual void onHVC(                 const microbit_ble_evt_t *p_ble_evt);
+    virtual void onHVNTxComplete(       const microbit_ble_evt_t *p_ble_evt);
 
     protected:
 
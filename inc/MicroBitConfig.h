@@ -79,6 +79,20 @@
     #define MICROBIT_STORAGE_SCRATCH_PAGE   ( MICROBIT_DEFAULT_SCRATCH_PAGE)
 #endif
 
+//
+// Maximum number of FLASH operations that can be queued by MicroBitFlash at any one time.
+//
+#ifndef MICROBIT_FLASH_QUEUE_SIZE
+    #define MICROBIT_FLASH_QUEUE_SIZE       4
+#endif
+
+//
+// Time in milliseconds to wait before retrying a FLASH operation that the SoftDevice is too busy to accept.
+//
+#ifndef MICROBIT_FLASH_RETRY_PERIOD
+    #define MICROBIT_FLASH_RETRY_PERIOD     10
+#endif
+
 #ifndef MICROBIT_SOFTDEVICE_EXISTS
     #define MICROBIT_SOFTDEVICE_EXISTS      ( (*(uint32_t *) 0x3004) == ((uint32_t) 0x51B1E5DB) )
 #endif
@@ -133,12 +147,49 @@
 #endif
 
 //
-// FileSystem writeback cache size, in bytes. Defines how many bytes will be stored
-// in RAM before being written back to FLASH. Set to zero to disable this feature.
-// Should be <= MBFS_BLOCK_SIZE.
+// FileSystem write cache size, in blocks. Files opened with MB_CACHE gather small writes in a
+// block sized buffer drawn from a pool of this many blocks, shared between all open files, and
+// each block is written to FLASH once it is complete. Set to zero to disable this feature.
+// Must be no greater than 32.
 //
-#ifndef MBFS_CACHE_SIZE
-    #define MBFS_CACHE_SIZE        0
+#ifndef MBFS_CACHE_BLOCKS
+    #define MBFS_CACHE_BLOCKS      2
+#endif
+
+// MBFS_CACHE_SIZE, the size of the write cache previously held by every open file, is no longer used.
+#if defined(MBFS_CACHE_SIZE)
+    #warning "MBFS_CACHE_SIZE is no longer supported. Use MBFS_CACHE_BLOCKS to size the shared write cache, and open files with MB_CACHE to use it."
+#endif
+
+//
+// Number of directories whose entries are indexed in RAM, to avoid a linear search of FLASH
+// on every open(). Indexes are built on first use, and discarded when the directory changes.
+// Set to zero to disable this feature.
+//
+#ifndef MBFS_DIRECTORY_INDEX_CACHE
+    #define MBFS_DIRECTORY_INDEX_CACHE   4
+#endif
+
+//
+// Number of blocks per open file that can be overwritten out-of-place before the file table is updated.
+// Rather than erasing and rewriting a whole physical page to overwrite data already held in FLASH,
+// an updated copy of the block is written to a free block, and the file table is relinked in a single
+// update when the file is flushed. Superseded blocks are reclaimed when the file table is next recycled.
+// Note that the relink is not atomic: a file table page that needs bits set is erased and rewritten from a
+// scratch page, and the file system is not recovered if power is lost between the two.
+// Set to zero to always update blocks in place.
+//
+#ifndef MBFS_LOG_STRUCTURED
+    #define MBFS_LOG_STRUCTURED    0
+#endif
+
+//
+// Reserve space at the end of the file table for a count of the number of times each page of the file system has been erased.
+// The counts are used to allocate the least worn pages first. Only applies to file systems formatted with this setting.
+// Set to zero to disable this feature.
+//
+#ifndef MBFS_WEAR_LEVELLING
+    #define MBFS_WEAR_LEVELLING    1
 #endif
 
 // Address of the end of the current program in FLASH memory.
@@ -286,6 +337,103 @@
     #define MICROBIT_BLE_NORDIC_STYLE_UART 0
 #endif
 
+// Allow the BLE UART service to transmit using notifications, as well as indications.
+// Notifications are not individually acknowledged, so several packets can be sent in each connection event.
+// The mode is chosen by the connected device, when it subscribes to the TX characteristic.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_UART_NOTIFY
+    #define MICROBIT_BLE_UART_NOTIFY 0
+#endif
+
+// Add a batched stream characteristic to the BLE accelerometer and magnetometer services.
+// Timestamped samples are buffered and packed into MTU sized notifications, so every sample
+// can be delivered at high sample rates. Adds two characteristics and a sample buffer to each service.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_SENSOR_STREAM
+    #define MICROBIT_BLE_SENSOR_STREAM 0
+#endif
+
+// The number of samples each BLE sensor stream can buffer while waiting for the connection to catch up.
+#ifndef MICROBIT_BLE_SENSOR_STREAM_SAMPLES
+    #define MICROBIT_BLE_SENSOR_STREAM_SAMPLES 32
+#endif
+
+// The number of message bus events the BLE event service can buffer while waiting for the connection to catch up.
+#ifndef MICROBIT_BLE_EVENT_QUEUE_SIZE
+    #define MICROBIT_BLE_EVENT_QUEUE_SIZE 32
+#endif
+
+// Allow the BLE event service to pack several events into each notification, up to the negotiated ATT MTU.
+// Clients must then read every 4 byte event in each notification, not just the first.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_EVENT_BATCH
+    #define MICROBIT_BLE_EVENT_BATCH 0
+#endif
+
+// Adapt the BLE connection parameters to the traffic on the connection.
+// Bursts of traffic request a short connection interval and the 2M PHY. Idle connections request
+// a long connection interval with slave latency, to save power.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_CONNECTION_GOVERNOR
+    #define MICROBIT_BLE_CONNECTION_GOVERNOR 0
+#endif
+
+// Packets per second (sent and received) that count as a burst of traffic.
+#ifndef MICROBIT_BLE_GOVERNOR_BURST_RATE
+    #define MICROBIT_BLE_GOVERNOR_BURST_RATE 40
+#endif
+
+// Time in milliseconds to keep the fast connection parameters after a burst of traffic ends.
+#ifndef MICROBIT_BLE_GOVERNOR_BURST_HOLD
+    #define MICROBIT_BLE_GOVERNOR_BURST_HOLD 2000
+#endif
+
+// Time in milliseconds without traffic before a connection is treated as idle.
+#ifndef MICROBIT_BLE_GOVERNOR_IDLE_TIMEOUT
+    #define MICROBIT_BLE_GOVERNOR_IDLE_TIMEOUT 5000
+#endif
+
+// Connection interval range (in 1.25ms units) requested during bursts of traffic.
+#ifndef MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MIN
+    #define MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MIN 6
+#endif
+
+#ifndef MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MAX
+    #define MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MAX 12
+#endif
+
+// Connection interval range (in 1.25ms units) and slave latency requested when a connection is idle.
+#ifndef MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MIN
+    #define MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MIN 40
+#endif
+
+#ifndef MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MAX
+    #define MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MAX 80
+#endif
+
+#ifndef MICROBIT_BLE_GOVERNOR_IDLE_LATENCY
+    #define MICROBIT_BLE_GOVERNOR_IDLE_LATENCY 4
+#endif
+
+// Have the BLE event service discard an event if an identical one (same source and value) is still waiting to be sent.
+// Suits applications that mirror device state, rather than count events.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_EVENT_COALESCE
+    #define MICROBIT_BLE_EVENT_COALESCE 0
+#endif
+
+// Have the BLE IO pin service detect changes on digital inputs with pin edge events, rather than
+// reading every input on each idle tick. Changes are packed into one notification per connection event.
+// Set to '1' to enable
+#ifndef MICROBIT_BLE_IO_PIN_EVENTS
+    #define MICROBIT_BLE_IO_PIN_EVENTS 0
+#endif
+
+// Time in milliseconds between reads of the analog inputs monitored by the BLE IO pin service, when MICROBIT_BLE_IO_PIN_EVENTS is enabled.
+#ifndef MICROBIT_BLE_IO_PIN_ANALOG_PERIOD
+    #define MICROBIT_BLE_IO_PIN_ANALOG_PERIOD 20
+#endif
+
 // Configure the radio maximum packet size
 // TODO: Update the range here once issue codal-microbit-v2#383 has been resolved
 // https://github.com/lancaster-university/codal-microbit-v2/issues/383
@@ -293,6 +441,74 @@
     #define MICROBIT_RADIO_MAX_PACKET_SIZE          250
 #endif
 
+// Period, in milliseconds, over which events forwarded by MicroBitRadioEvent are coalesced into a single frame,
+// and the maximum number of events carried in each frame.
+// Batched frames are only understood by receivers with the same support, so older receivers see just the first event.
+// Set MICROBIT_RADIO_EVENT_BATCH_PERIOD to a non-zero value (e.g. 10) to enable. '0' sends every event in its own frame.
+#ifndef MICROBIT_RADIO_EVENT_BATCH_PERIOD
+    #define MICROBIT_RADIO_EVENT_BATCH_PERIOD       0
+#endif
+
+#ifndef MICROBIT_RADIO_EVENT_BATCH_SIZE
+    #define MICROBIT_RADIO_EVENT_BATCH_SIZE         32
+#endif
+
+// Reliable radio stream (MicroBitRadioStream) configuration.
+// MICROBIT_RADIO_STREAM_MAX_FRAGMENTS limits the size of a message, each fragment carrying up to MICROBIT_RADIO_STREAM_FRAGMENT_SIZE bytes.
+// MICROBIT_RADIO_STREAM_WINDOW is the number of unacknowledged fragments a sender may have in flight.
+// MICROBIT_RADIO_STREAM_ACK_EVERY is the number of in order fragments a receiver takes before acknowledging them.
+// MICROBIT_RADIO_STREAM_RX_SLOTS messages may be reassembled at once, and MICROBIT_RADIO_STREAM_RX_QUEUE complete messages held awaiting recv().
+// Retransmission timeouts are in milliseconds, and adapt to the measured round trip time between these limits.
+// A send fails after MICROBIT_RADIO_STREAM_MAX_RETRIES consecutive timeouts without progress.
+#ifndef MICROBIT_RADIO_STREAM_MAX_FRAGMENTS
+    #define MICROBIT_RADIO_STREAM_MAX_FRAGMENTS     64
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_WINDOW
+    #define MICROBIT_RADIO_STREAM_WINDOW            8
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_ACK_EVERY
+    #define MICROBIT_RADIO_STREAM_ACK_EVERY         2
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_INITIAL_RTO
+    #define MICROBIT_RADIO_STREAM_INITIAL_RTO       50
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_MIN_RTO
+    #define MICROBIT_RADIO_STREAM_MIN_RTO           5
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_MAX_RTO
+    #define MICROBIT_RADIO_STREAM_MAX_RTO           1000
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_MAX_RETRIES
+    #define MICROBIT_RADIO_STREAM_MAX_RETRIES       8
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_RX_SLOTS
+    #define MICROBIT_RADIO_STREAM_RX_SLOTS          2
+#endif
+
+#ifndef MICROBIT_RADIO_STREAM_RX_QUEUE
+    #define MICROBIT_RADIO_STREAM_RX_QUEUE          4
+#endif
+
+// Number of senders whose frame counters are remembered, to drop replayed frames on groups with an encryption key.
+// Each takes 16 bytes of RAM, allocated when the first key is set. Replays from senders beyond this are not detected.
+#ifndef MICROBIT_RADIO_CCM_REPLAY_ENTRIES
+    #define MICROBIT_RADIO_CCM_REPLAY_ENTRIES       8
+#endif
+
+// Use a software AES implementation for radio encryption instead of the nRF52 ECB peripheral.
+// Intended for host builds of MicroBitRadioCCM.
+// Set to '1' to enable
+#ifndef MICROBIT_RADIO_CCM_SOFTWARE_AES
+    #define MICROBIT_RADIO_CCM_SOFTWARE_AES         0
+#endif
+
 // Enable/Disable partial flashing over radio
 // BLE must be disabled if radio flashing is enabled
 #ifndef MICROBIT_RADIO_REFLASH_ENABLED
@@ -122,6 +122,20 @@ class MicroBitFile
       */
     ManagedString read(int size);
 
+    /**
+      * Maps the next part of the file, without copying it into RAM.
+      *
+      * @param buffer updated to point to the data, held in FLASH memory.
+      *
+      * @param size the maximum number of bytes to map.
+      *
+      * @return the number of bytes available at buffer, zero at the end of the file, or
+      *         MICROBIT_INVALID_PARAMETER if buffer is invalid, or the size given is less than 0.
+      *
+      * @note The data is only valid until the file system is next modified.
+      */
+    int map(const uint8_t **buffer, int size);
+
     /**
       * Removes this MicroBitFile from the MicroBitFileSystem.
       *
@@ -35,6 +35,7 @@ DEALINGS IN THE SOFTWARE.
 #define MB_WRITE    0x02
 #define MB_CREAT    0x04
 #define MB_APPEND   0x08
+#define MB_CACHE    0x10
 
 // seek() flags.
 #define MB_SEEK_SET 0x01
@@ -85,6 +86,28 @@ struct Directory
     DirectoryEntry entry[0];
 };
 
+//
+// An in RAM index of the valid entries in a directory, used to find files by name without a linear search.
+// Entries are held in an open addressed hash table, keyed on a hash of the file name.
+//
+struct DirectoryIndex
+{
+    // First block of the indexed directory.
+    uint16_t first_block;
+
+    // Number of slots in the table, always a power of two.
+    uint16_t size;
+
+    // Hash of the file name held in each slot.
+    uint16_t *hash;
+
+    // The DirectoryEntry held in each slot, or NULL if the slot is empty.
+    DirectoryEntry **entry;
+
+    // We maintain a chain of indexes, most recently used first. Reference to the next DirectoryIndex in the chain.
+    DirectoryIndex *next;
+};
+
 //
 // A FileDescriptor holds contextual information needed for each OPEN file.
 //
@@ -99,6 +122,12 @@ struct FileDescriptor
     // current file position, in bytes.
     uint32_t seek;
 
+    // Cached location of the seek position in the file's block chain, so sequential access need not walk the file table from
+    // the first block. cursorBlock is the block holding the byte at seek (or the block ending at seek, on a block boundary),
+    // and cursorPosition is the file position of the start of that block.
+    uint16_t cursorBlock;
+    uint32_t cursorPosition;
+
     // the current file size. n.b. this may be different to that stored in the DirectoryEntry.
     uint32_t length;
 
@@ -111,9 +140,39 @@ struct FileDescriptor
     // We maintain a chain of open file descriptors. Reference to the next FileDescriptor in the chain.
     FileDescriptor *next;
 
-    // Optional writeback cache, to minimise FLASH write operations at the expense of RAM.
-    uint16_t cacheLength;
-    uint8_t cache[MBFS_CACHE_SIZE];
+    // Optional write cache, to minimise FLASH write operations at the expense of RAM. Files opened with MB_CACHE borrow a
+    // block sized buffer from a pool shared by all open files while they hold unwritten data. cachePosition is the file
+    // position of the start of the cached block, and cacheStart/cacheEnd the range of bytes within it yet to be written.
+    uint8_t *cache;
+    uint32_t cachePosition;
+    uint16_t cacheStart;
+    uint16_t cacheEnd;
+
+#if MBFS_LOG_STRUCTURED > 0
+    // Blocks of this file that have been overwritten out-of-place, and the blocks now holding their data.
+    // The file table is relinked to the new blocks when the file is flushed.
+    uint16_t relocatedCount;
+    uint16_t relocatedFrom[MBFS_LOG_STRUCTURED];
+    uint16_t relocatedTo[MBFS_LOG_STRUCTURED];
+#endif
+};
+
+//
+// Statistics describing the wear on the physical pages of the file system, as returned by getStatistics().
+//
+struct FileSystemStatistics
+{
+    // The lowest, highest and mean number of times a page of the file system has been erased.
+    uint16_t minimumEraseCount;
+    uint16_t maximumEraseCount;
+    uint16_t meanEraseCount;
+
+    // Number of bytes written to files, and the number of bytes programmed into FLASH as a result, since the file system was loaded.
+    uint32_t bytesWritten;
+    uint32_t bytesProgrammed;
+
+    // Ratio of bytesProgrammed to bytesWritten, in hundredths.
+    uint32_t writeAmplification;
 };
 
 /**
@@ -157,6 +216,31 @@ class MicroBitFileSystem
     // Chain of open files.
     FileDescriptor *openFiles;
 
+    // In RAM summary of the file table, so blocks and pages can be allocated without scanning FLASH.
+    // One bit per block in each map, set if the block is MBFS_UNUSED or MBFS_DELETED respectively.
+    uint32_t *unusedMap;
+    uint32_t *deletedMap;
+
+    // Number of blocks in use (neither unused nor deleted), and number of deleted blocks, in each physical page.
+    uint8_t *pageUsed;
+    uint8_t *pageDeleted;
+
+    // Total number of deleted blocks in the file system.
+    uint16_t deletedBlocks;
+
+    // Number of times each physical page has been erased. Stored at the end of the file table whenever it is rewritten.
+    uint16_t *pageErases;
+
+    // Number of bytes written to files since the file system was loaded.
+    uint32_t bytesWritten;
+
+    // Chain of directory indexes, most recently used first.
+    DirectoryIndex *directoryIndexes;
+
+    // Pool of MBFS_CACHE_BLOCKS block sized write caches, and a bitmap of those currently lent to open files.
+    uint8_t *cachePool;
+    uint32_t cachePoolUsed;
+
     /**
       * Initialize the flash storage system
       *
@@ -185,6 +269,30 @@ class MicroBitFileSystem
       */
     uint16_t getFreeBlock();
 
+    /**
+      * Allocate a free, erased logical block whose block number only has bits set that are also set in the given mask.
+      * Such a block can replace the mask block in a file table entry or directory entry without a FLASH erase.
+      *
+      * @param mask The block number that is being replaced.
+      * @return a valid, unused and erased block on success, or zero if no such block is available.
+      */
+    uint16_t getFreeBlockWithin(uint16_t mask);
+
+    /**
+      * Determine if the given block is fully erased, and can therefore be written without an erase.
+      *
+      * @param block A valid block number.
+      * @return true if every byte of the block is erased, false otherwise.
+      */
+    bool isErased(uint16_t block);
+
+    /**
+      * Erase the given page, if it is not already erased.
+      *
+      * @param page The address of the page.
+      */
+    void cleanPage(uint32_t *page);
+
     /**
     * Allocates a free physical block.
     * A round robin algorithm is used to even out the wear on the physical device.
@@ -192,6 +300,28 @@ class MicroBitFileSystem
     */
     uint32_t* getFreePage();
 
+    /**
+    * Build the in RAM summary of the file table used for block and page allocation.
+    * Called once the file system is loaded, and whenever the file table is recycled.
+    *
+    * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if there is insufficient memory for the summary.
+    */
+    int buildAllocationMap();
+
+    /**
+    * Release the in RAM summary of the file table.
+    */
+    void freeAllocationMap();
+
+    /**
+    * Update the in RAM summary of the file table to reflect a change of state of the given block.
+    *
+    * @param block The block being updated.
+    * @param oldValue The previous file table entry of the block.
+    * @param newValue The new file table entry of the block.
+    */
+    void updateAllocationMap(uint16_t block, uint16_t oldValue, uint16_t newValue);
+
     /**
     * Retrieve the DirectoryEntry assoiated with the given file's DIRECTORY (not the file itself).
     *
@@ -209,6 +339,21 @@ class MicroBitFileSystem
     */
     DirectoryEntry* getDirectoryEntry(char const * filename, const DirectoryEntry *directory = NULL);
     
+    /**
+    * Retrieve the index of the given directory, building it if necessary.
+    *
+    * @param directory The directory to index.
+    * @return The DirectoryIndex of the directory, or NULL if there is insufficient memory to build one.
+    */
+    DirectoryIndex* getDirectoryIndex(const DirectoryEntry *directory);
+
+    /**
+    * Discard the index of the given directory, if one exists. Must be called whenever entries in the directory change.
+    *
+    * @param directory The directory which has changed.
+    */
+    void invalidateDirectoryIndex(const DirectoryEntry *directory);
+
     /**
     * Create a new DirectoryEntry with the given filename and flags.
     *
@@ -274,6 +419,17 @@ class MicroBitFileSystem
     */
     uint16_t getNextFileBlock(uint16_t block);
 
+    /**
+      * Determine the block currently holding the data of the given block of an open file.
+      * This differs from the given block only if the block has been relocated, but the file not yet flushed.
+      *
+      * @param file The open file holding the block.
+      * @param block A valid block number, as recorded in the file table or directory entry.
+      *
+      * @return The block number holding the data of the given block.
+      */
+    uint16_t getRelocatedBlock(FileDescriptor *file, uint16_t block);
+
     /**
     * Determine the logical block that contains the given address.
     *
@@ -290,6 +446,22 @@ class MicroBitFileSystem
     */
     uint16_t calculateFileTableSize();
 
+    /**
+    * Determine the location of the erase counters held at the end of the file table.
+    *
+    * @return A pointer to the erase counter of the first page, or NULL if the file table has no space for erase counters.
+    */
+    uint16_t *getEraseCounters();
+
+    /**
+    * Determine the value to write to a file table entry when the page holding it is rewritten.
+    * Erase counters are refreshed from RAM. All other entries are unchanged.
+    *
+    * @param entry The index of the entry in the file table.
+    * @return The value of the entry.
+    */
+    uint16_t getTableEntry(int entry);
+
     /*
     * Update a file table entry to a given value.
     *
@@ -316,7 +488,34 @@ class MicroBitFileSystem
     int format();
 
     /**
-      * Flush a given file's cache back to FLASH memory.
+      * Determine the block holding the current seek position of the given file, moving its cursor forward
+      * through the block chain as necessary. The file table is only walked from the first block of the file
+      * if the seek position has moved behind the cursor.
+      *
+      * @param file File descriptor to locate.
+      * @return The block number containing the seek position. The position of the start of this block is held in file->cursorPosition.
+      */
+    uint16_t getSeekBlock(FileDescriptor *file);
+
+    /**
+      * Determine the length of the given file, including any data held in its write cache.
+      *
+      * @param file File descriptor of the file.
+      * @return The length of the file, in bytes.
+      */
+    uint32_t getLength(FileDescriptor *file);
+
+    /**
+      * Lend a block sized buffer from the shared pool to the given file, to cache writes to the block at the given position.
+      *
+      * @param file File descriptor of the file.
+      * @param position The file position of the start of the block to be cached.
+      * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if no buffer is available.
+      */
+    int allocateCache(FileDescriptor *file, uint32_t position);
+
+    /**
+      * Flush a given file's cache back to FLASH memory, and return its buffer to the shared pool.
       *
       * @param file File descriptor to flush.
       * @return The number of bytes written.
@@ -334,6 +533,31 @@ class MicroBitFileSystem
       */
     int writeBuffer(FileDescriptor *file, uint8_t* buffer, int length);
 
+#if MBFS_LOG_STRUCTURED > 0
+    /**
+      * Write data over part of an existing block of a file, without erasing FLASH memory.
+      * A copy of the block with the given data applied is written to a free block, which replaces
+      * the original in the file when the file is next flushed.
+      *
+      * @param file FileDescriptor of the file to write
+      * @param block The block of the file being written to.
+      * @param offset The offset into the block to write to.
+      * @param buffer The start of the buffer to write
+      * @param length The number of bytes to write. Must not extend beyond the end of the block.
+      * @return The block now holding the data, or zero if the block could not be relocated.
+      */
+    uint16_t relocateBlock(FileDescriptor *file, uint16_t block, uint32_t offset, uint8_t* buffer, int length);
+
+    /**
+      * Relink the file table and directory entry of a file to any blocks that have been relocated,
+      * and mark the blocks they replace for deletion.
+      *
+      * @param file FileDescriptor of the file to update.
+      * @return MICROBIT_OK on success.
+      */
+    int commitRelocations(FileDescriptor *file);
+#endif
+
 
     /**
      * Determines if the given filename is a valid filename for use in MicroBitFileSystem. 
@@ -360,12 +584,13 @@ class MicroBitFileSystem
       *  - MB_READ : read from the file.
       *  - MB_WRITE : write to the file.
       *  - MB_CREAT : create a new file, if it doesn't already exist.
+      *  - MB_CACHE : gather small writes in RAM, and write them to FLASH a block at a time.
       *
       * If a file is opened that doesn't exist, and MB_CREAT isn't passed,
       * an error is returned, otherwise the file is created.
       *
       * @param filename name of the file to open, must contain only printable characters.
-      * @param flags One or more of MB_READ, MB_WRITE or MB_CREAT. 
+      * @param flags One or more of MB_READ, MB_WRITE, MB_CREAT or MB_CACHE. 
       * @return return the file handle,MICROBIT_NOT_SUPPORTED if the file system has
       *         not been initialised MICROBIT_INVALID_PARAMETER if the filename is
       *         too large, MICROBIT_NO_RESOURCES if the file system is full.
@@ -492,6 +717,35 @@ class MicroBitFileSystem
       */
     int read(int fd, uint8_t* buffer, int size);
 
+    /**
+      * Map data from the file, without copying it.
+      *
+      * Files are held in FLASH memory, which is directly addressable. Rather than copying data into a buffer
+      * as read() does, map() provides a pointer to the data at the current seek position of the file, held in FLASH.
+      * The data is returned as a series of extents, each covering as many of the following bytes of the file
+      * as are stored contiguously in FLASH. On each invocation the seek position of the file handle is incremented
+      * by the length of the extent returned, so calling map() repeatedly iterates over the extents of the file.
+      *
+      * @param fd File handle, obtained with open()
+      * @param buffer Updated to point to the start of the extent.
+      * @param size maximum number of bytes to map
+      * @return length of the extent in bytes on success, zero at the end of the file, MICROBIT_NOT_SUPPORTED if the file
+      *         system is not initialised, MICROBIT_INVALID_PARAMETER if the given file handle is invalid.
+      *
+      * @note The data is only valid until the file system is next modified, as data may then be moved or erased.
+      *
+      * @code
+      * MicroBitFileSystem f;
+      * const uint8_t *data;
+      * int fd = f.open("sound.raw", MB_READ);
+      * int length;
+      *
+      * while ((length = f.map(fd, &data, 1024)) > 0)
+      *    play(data, length);
+      * @endcode
+      */
+    int map(int fd, const uint8_t** buffer, int size);
+
     /**
       * Remove a file from the system, and free allocated assets
       * (including assigned blocks which are returned for use by other files).
@@ -517,6 +771,15 @@ class MicroBitFileSystem
     * @return MICROBIT_OK on success, MICROBIT_INVALID_PARAMETER if the path is invalid, or MICROBT_NO_RESOURCES if the FileSystem is full.
     */
     int createDirectory(char const *name);
+
+    /**
+    * Report the wear on the physical pages of the file system.
+    *
+    * @param stats The statistics to populate.
+    * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not been initialised,
+    *         or MICROBIT_INVALID_PARAMETER if stats is NULL.
+    */
+    int getStatistics(FileSystemStatistics *stats);
 };
 
 } // namespace codal
@@ -24,12 +24,19 @@ DEALINGS IN THE SOFTWARE.
 
 #include "nrf.h"
 
+// Event ID raised on completion of a queued FLASH operation. The event value is the handle of the operation.
+#define MICROBIT_ID_FLASH                   3040
+
 namespace codal
 {
 
 class MicroBitFlash
 {
-    private:
+    public:
+    /**
+      * Default constructor.
+      */
+    MicroBitFlash();
 
     /**
       * Check if an erase is required to write to a region in flash memory.
@@ -43,12 +50,6 @@ class MicroBitFlash
       * @return non-zero if erase required, zero otherwise.
       */
     int need_erase(uint8_t* source, uint8_t* flash_addr, int len);
- 
-    public:
-    /**
-      * Default constructor.
-      */
-    MicroBitFlash();
 
     /**
       * Writes the given number of bytes to the address in flash specified.
@@ -71,7 +72,7 @@ class MicroBitFlash
                     void* scratch_addr = NULL);
 
     /**
-      * Erase an entire page.
+      * Erase an entire page. Blocks without yielding to other fibers.
       * @param page_address address of first word of page.
       */
     void erase_page(uint32_t* page_address);
@@ -84,9 +85,96 @@ class MicroBitFlash
       * 	Must be word aligned.
       * @param buffer address to write from, must be word-aligned.
       * @param len number of uint32_t words to write.
+      *
+      * Blocks without yielding to other fibers, so the buffer may be on the caller's stack.
       */
     void flash_burn(uint32_t* page_address, uint32_t* buffer, int len);
 
+    /**
+      * Schedule an erase of an entire page, without waiting for it to complete.
+      * An event with an ID of MICROBIT_ID_FLASH and a value of the returned handle is raised on completion.
+      *
+      * @param page_address address of first word of page.
+      * @return A handle for the operation, that may be passed to wait() or isComplete().
+      */
+    int erase_page_async(uint32_t* page_address);
+
+    /**
+      * Schedule a write to flash memory, without waiting for it to complete. The region written
+      * must not require an erase (using need_erase), and the buffer must remain valid until the operation completes.
+      * An event with an ID of MICROBIT_ID_FLASH and a value of the returned handle is raised on completion.
+      *
+      * @param page_address address of memory to write to. Must be word aligned.
+      * @param buffer address to write from, must be word-aligned.
+      * @param len number of uint32_t words to write.
+      * @return A handle for the operation, that may be passed to wait() or isComplete().
+      */
+    int flash_burn_async(uint32_t* page_address, uint32_t* buffer, int len);
+
+    /**
+      * Determine if the given FLASH operation has completed.
+      *
+      * @param handle A handle returned by erase_page_async() or flash_burn_async().
+      * @return true if the operation has completed, false otherwise.
+      */
+    bool isComplete(int handle);
+
+    /**
+      * Wait for the given FLASH operation to complete. When called from a fiber, other fibers are
+      * scheduled whilst the operation takes place. Otherwise, this spins until the operation completes.
+      *
+      * @param handle A handle returned by erase_page_async() or flash_burn_async().
+      * @return MICROBIT_OK.
+      */
+    int wait(int handle);
+
+    /**
+      * Maintain a count of the number of times each page in the given region of FLASH is erased by this instance.
+      *
+      * @param start address of the first page of the region.
+      * @param pages number of pages in the region.
+      * @param counts one counter per page, incremented as each page is erased, or NULL to stop counting.
+      */
+    void setEraseCounters(uint32_t *start, int pages, uint16_t *counts);
+
+    /**
+      * Determine the number of words written to FLASH by this instance.
+      *
+      * @return The number of words written.
+      */
+    uint32_t getWordsWritten();
+
+    private:
+
+    // Optional erase counters, one per page of the region of FLASH starting at eraseCountStart.
+    uint32_t *eraseCountStart;
+    int eraseCountPages;
+    uint16_t *eraseCounts;
+
+    // Number of words written to FLASH by this instance.
+    uint32_t wordsWritten;
+
+    /**
+      * Add an operation to the queue of FLASH operations, and start processing the queue.
+      * If the queue is full, this waits for space to become available.
+      *
+      * @param address The address to erase or write to.
+      * @param buffer The data to write, or NULL to erase the page at the given address.
+      * @param length The number of words to write.
+      * @param notify true to raise an event when the operation completes. Events are also raised for any operation a fiber is waiting on.
+      * @return A handle for the operation.
+      */
+    int queue(uint32_t *address, uint32_t *buffer, int length, bool notify);
+
+    /**
+      * Wait for the given FLASH operation to complete.
+      *
+      * @param handle A handle returned by queue().
+      * @param yield true to schedule other fibers whilst the operation takes place, false to spin.
+      * @return MICROBIT_OK.
+      */
+    int waitFor(int handle, bool yield);
+
 };
 
 } // namespace codal
@@ -38,6 +38,8 @@ namespace codal
 #include "MicroBitConfig.h"
 #include "MicroBitRadioDatagram.h"
 #include "MicroBitRadioEvent.h"
+#include "MicroBitRadioStream.h"
+#include "MicroBitRadioCCM.h"
 
 /**
  * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
@@ -57,8 +59,9 @@ namespace codal
  * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
  * creation of wireless BLE bridges.
  *
- * NOTE: This API does not contain any form of encryption, authentication or authorization. It's purpose is solely for use as a
+ * NOTE: By default this API does not perform any form of encryption, authentication or authorization. It's purpose is solely for use as a
  * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
+ * Frames on a group may optionally be encrypted and authenticated with AES-CCM, see setEncryptionKey().
  * For serious applications, BLE should be considered a substantially more secure alternative.
  */
 
@@ -86,9 +89,11 @@ namespace codal
 // Known Protocol Numbers
 #define MICROBIT_RADIO_PROTOCOL_DATAGRAM        1       // A simple, single frame datagram. a little like UDP but with smaller packets. :-)
 #define MICROBIT_RADIO_PROTOCOL_EVENTBUS        2       // Transparent propogation of events from one micro:bit to another.
+#define MICROBIT_RADIO_PROTOCOL_STREAM          3       // Reliable, fragmented delivery of messages of any length between two micro:bits.
 
 // Events
 #define MICROBIT_RADIO_EVT_DATAGRAM             1       // Event to signal that a new datagram has been received.
+#define MICROBIT_RADIO_EVT_STREAM               3       // Event to signal that a complete stream message has been received.
 
 namespace codal
 {
@@ -118,6 +123,8 @@ namespace codal
         public:
         MicroBitRadioDatagram   datagram;   // A simple datagram service.
         MicroBitRadioEvent      event;      // A simple event handling service.
+        MicroBitRadioStream     stream;     // A reliable, fragmented message service.
+        MicroBitRadioCCM        ccm;        // Optional per group authenticated encryption.
         static MicroBitRadio    *instance;  // A singleton reference, used purely by the interrupt service routine.
 
         /**
@@ -208,6 +215,20 @@ namespace codal
          */
         int setGroup(uint8_t group);
 
+        /**
+         * Sets or clears the AES-128 key used to encrypt and authenticate frames on the given group.
+         * Once a key is set, frames sent on that group are encrypted, and received frames that are not
+         * encrypted with the same key, or that are replays of earlier frames, are silently dropped.
+         * Replays are only detected from the last MICROBIT_RADIO_CCM_REPLAY_ENTRIES senders heard, and only
+         * for frames first received since this micro:bit was last reset.
+         *
+         * @param group The radio group the key applies to.
+         * @param key A pointer to a 16 byte key, or NULL to return the group to plain text operation.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if too many groups have keys or there is insufficient memory.
+         */
+        int setEncryptionKey(uint8_t group, const uint8_t *key);
+
         /**
          * A background, low priority callback that is triggered whenever the processor is idle.
          * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
@@ -0,0 +1,209 @@
+/*
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_CCM_H
+#define MICROBIT_RADIO_CCM_H
+
+#include "CodalConfig.h"
+#include "MicroBitConfig.h"
+
+namespace codal
+{
+    struct FrameBuffer;
+}
+
+// Sizes of the fields added to each encrypted frame
+#define MICROBIT_RADIO_CCM_KEY_SIZE             16
+#define MICROBIT_RADIO_CCM_BLOCK_SIZE           16
+#define MICROBIT_RADIO_CCM_NONCE_SIZE           13
+#define MICROBIT_RADIO_CCM_MIC_SIZE             4
+#define MICROBIT_RADIO_CCM_HEADER_SIZE          12      // 32 bit source ID, 32 bit session ID and 32 bit frame counter
+#define MICROBIT_RADIO_CCM_OVERHEAD             (MICROBIT_RADIO_CCM_HEADER_SIZE + MICROBIT_RADIO_CCM_MIC_SIZE)
+
+// Number of radio groups which may hold a key
+#define MICROBIT_RADIO_CCM_MAX_KEYS             4
+
+// Flag set in the version field of a frame carrying an encrypted payload
+#define MICROBIT_RADIO_VERSION_ENCRYPTED        0x80
+
+namespace codal
+{
+    /**
+     * Provides optional link layer authenticated encryption for MicroBitRadio frames, using AES-CCM
+     * with a 4 byte MIC, as specified in RFC 3610.
+     *
+     * Each radio group may be given its own 128 bit key. Frames sent on a group with a key are encrypted and
+     * authenticated, and received frames on that group which fail authentication, are not encrypted, or
+     * repeat a frame counter already seen from the same sender are dropped.
+     *
+     * Replay protection is limited: the highest frame counter is held in RAM for only the
+     * MICROBIT_RADIO_CCM_REPLAY_ENTRIES most recently heard senders. A replayed frame is accepted if its sender
+     * has since been displaced by others, or if the receiver has been reset since the frame was first received.
+     * The key and replay tables are allocated when the first key is set.
+     *
+     * The AES block cipher runs on the nRF52 ECB peripheral, or in software if MICROBIT_RADIO_CCM_SOFTWARE_AES is set,
+     * which also allows this class to be built and tested on a host.
+     *
+     * Encrypted payload layout:
+     * +-------------------------------------------------------------------------------------+
+     * | Source ID (4) | Session ID (4) | Frame counter (4) | Ciphertext (n) | MIC (4)        |
+     * +-------------------------------------------------------------------------------------+
+     *
+     * The frame counter restarts from zero on each boot, so the session ID is chosen at random to keep
+     * the nonce, formed from these three fields and the radio group, unique for a given key.
+     */
+    class MicroBitRadioCCM
+    {
+        struct GroupKey
+        {
+            uint8_t     group;                                  // The radio group this key belongs to.
+            bool        valid;                                  // Set if this entry holds a key.
+            uint8_t     key[MICROBIT_RADIO_CCM_KEY_SIZE];       // The AES-128 key.
+        };
+
+        struct ReplayEntry
+        {
+            uint32_t    source;                                 // Source ID of a sender.
+            uint32_t    session;                                // Session ID of a sender.
+            uint32_t    counter;                                // Highest frame counter accepted from that sender.
+            uint32_t    lastUsed;                               // Value of useCount when this entry was last used, for LRU replacement.
+        };
+
+        GroupKey        *keys;                                  // MICROBIT_RADIO_CCM_MAX_KEYS keys, or NULL if no key has been set.
+        ReplayEntry     *replay;                                // MICROBIT_RADIO_CCM_REPLAY_ENTRIES senders, allocated with keys.
+        uint32_t        source;                                 // Source ID of this device.
+        uint32_t        session;                                // Session ID of this device, random per boot.
+        uint32_t        txCounter;                              // Counter of frames sent by this device.
+        uint32_t        useCount;                               // Counter of replay table lookups.
+
+        public:
+
+        uint32_t        framesEncrypted;                        // Number of frames encrypted.
+        uint32_t        framesDecrypted;                        // Number of frames successfully authenticated and decrypted.
+        uint32_t        framesRejected;                         // Number of frames dropped through failed authentication or replay.
+        uint32_t        cryptoTime;                             // Total time spent encrypting and decrypting frames, in microseconds.
+
+        /**
+         * Constructor.
+         *
+         * Creates an instance of MicroBitRadioCCM with no keys set.
+         *
+         * @param source The 32 bit source ID to use for frames sent by this device.
+         * @param session The 32 bit session ID to use for frames sent by this device.
+         */
+        MicroBitRadioCCM(uint32_t source = 0, uint32_t session = 0);
+
+        /**
+         * Sets or clears the key used for the given radio group.
+         *
+         * @param group The radio group.
+         * @param key A pointer to a 16 byte AES-128 key, or NULL to clear the key and return the group to plain text.
+         *
+         * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if all key slots are in use or there is insufficient memory.
+         */
+        int setKey(uint8_t group, const uint8_t *key);
+
+        /**
+         * Sets the source and session IDs used for frames sent by this device, and restarts the frame counter.
+         *
+         * @param source The 32 bit source ID.
+         * @param session The 32 bit session ID. This must be chosen at random on each boot, as the frame counter restarts from zero.
+         */
+        void setSource(uint32_t source, uint32_t session);
+
+        /**
+         * Determines if a key has been set for the given radio group.
+         *
+         * @param group The radio group.
+         *
+         * @return true if frames on this group are encrypted, false otherwise.
+         */
+        bool hasKey(uint8_t group);
+
+        /**
+         * Encrypts and authenticates a frame.
+         *
+         * @param out The frame to write the encrypted result into.
+         * @param in The plain text frame to encrypt.
+         * @param group The radio group the frame will be sent on.
+         *
+         * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the encrypted frame would exceed MICROBIT_RADIO_MAX_PACKET_SIZE,
+         *         or DEVICE_NOT_SUPPORTED if no key is set for the group.
+         */
+        int encrypt(FrameBuffer *out, FrameBuffer *in, uint8_t group);
+
+        /**
+         * Authenticates and decrypts a received frame in place, removing the fields added by encrypt().
+         *
+         * @param buffer The received frame.
+         * @param group The radio group the frame was received on.
+         *
+         * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if no key is set for the group,
+         *         or DEVICE_INVALID_PARAMETER if the frame is not encrypted, fails authentication, or is a replay.
+         */
+        int decrypt(FrameBuffer *buffer, uint8_t group);
+
+        /**
+         * Runs AES-CCM over a buffer in place, as defined in RFC 3610 with a 2 byte length field.
+         *
+         * @param key The 16 byte AES key.
+         * @param nonce The 13 byte nonce.
+         * @param aad Additional data which is authenticated but not encrypted.
+         * @param aadLength The length of aad, less than 0xFF00 bytes.
+         * @param data The data to encrypt or decrypt, in place.
+         * @param length The length of data.
+         * @param mic Buffer of micLength bytes, receives the MIC when encrypting, holds the received MIC when decrypting.
+         * @param micLength The MIC length, an even number in the range 4..16.
+         * @param encrypt true to encrypt, false to decrypt.
+         *
+         * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if decrypting and the MIC does not match.
+         */
+        static int ccm(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, int aadLength, uint8_t *data, int length, uint8_t *mic, int micLength, bool encrypt);
+
+        /**
+         * Encrypts a single 16 byte block with AES-128.
+         *
+         * @param key The 16 byte key.
+         * @param in The 16 byte plain text block.
+         * @param out The 16 byte buffer to receive the cipher text, may be the same as in.
+         */
+        static void aesEncrypt(const uint8_t *key, const uint8_t *in, uint8_t *out);
+
+        private:
+
+        /**
+         * Looks up the key for the given group.
+         *
+         * @return A pointer to the key, or NULL if the group has no key.
+         */
+        const uint8_t *getKey(uint8_t group);
+
+        /**
+         * Checks a frame counter against the highest counter seen from its sender, and records it.
+         *
+         * @return true if the counter is new, false if the frame is a replay.
+         */
+        bool acceptCounter(uint32_t source, uint32_t session, uint32_t counter);
+    };
+}
+
+#endif
@@ -29,8 +29,27 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitRadio.h"
 #include "codal-core/inc/types/Event.h"
 
+// Frame versions used by the event protocol
+#define MICROBIT_RADIO_EVENT_VERSION_SINGLE     1       // A single Event structure.
+#define MICROBIT_RADIO_EVENT_VERSION_BATCH      2       // A sequence of RadioEventRecord, in the order the events occurred.
+
+// Private event used to transmit a batch of events once its coalescing period has elapsed.
+// It has its own ID, so it never reaches applications listening to DEVICE_ID_RADIO.
+#define MICROBIT_ID_RADIO_EVENT_FLUSH           3041
+#define MICROBIT_RADIO_EVT_EVENT_FLUSH          1
+
 namespace codal
 {
+    /**
+     * The compact form of an event carried in a batched radio frame.
+     * The timestamp is not sent, events are stamped on arrival at the receiver.
+     */
+    struct RadioEventRecord
+    {
+        uint16_t        source;
+        uint16_t        value;
+    };
+
     /**
      * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
      *
@@ -49,8 +68,19 @@ namespace codal
         bool            suppressForwarding;     // A private flag used to prevent event forwarding loops.
         MicroBitRadio   &radio;                 // A reference to the underlying radio module to use.
 
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+        bool                flushRegistered;                            // Set once we are listening for the MICROBIT_RADIO_EVT_EVENT_FLUSH event.
+        uint8_t             batchLength;                                // The number of events waiting to be sent.
+        RadioEventRecord    batch[MICROBIT_RADIO_EVENT_BATCH_SIZE];     // Events waiting to be sent, oldest first.
+#endif
+
         public:
 
+        uint32_t        eventsSent;             // Number of events transmitted.
+        uint32_t        eventsCoalesced;        // Number of events dropped because an identical event was already waiting to be sent.
+        uint32_t        eventsReceived;         // Number of events received and fired.
+        uint32_t        framesSent;             // Number of radio frames used to transmit eventsSent.
+
         /**
          * Constructor.
          *
@@ -134,10 +164,28 @@ namespace codal
 
         /**
          * Event handler callback. This is called whenever an event is received matching one of those registered through
-         * the registerEvent() method described above. Upon receiving such an event, it is wrapped into
-         * a radio packet and transmitted to any other micro:bits in the same group.
+         * the registerEvent() method described above. Upon receiving such an event, it is added to the current batch,
+         * which is transmitted to any other micro:bits in the same group once MICROBIT_RADIO_EVENT_BATCH_PERIOD has elapsed
+         * or the batch is full. Events identical to one already in the batch are dropped.
          */
         void eventReceived(Event e);
+
+        /**
+         * Transmits any events waiting in the current batch as a single radio frame.
+         * Does nothing if batching is disabled, as events are then sent as they occur.
+         *
+         * @return MICROBIT_OK on success, or MICROBIT_NOT_SUPPORTED if the BLE stack is running.
+         */
+        int flush();
+
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+        private:
+
+        /**
+         * Event handler for MICROBIT_RADIO_EVT_EVENT_FLUSH, raised when the coalescing period of a batch ends.
+         */
+        void onFlush(Event e);
+#endif
     };
 }
 #endif
@@ -27,6 +27,11 @@ DEALINGS IN THE SOFTWARE.
 #define R_HEADER_SIZE 16
 #define R_FLASH_PAGE_SIZE 4096
 
+/**
+ * Number of pages the sender keeps in flight before waiting for the NAK rounds to fall silent
+ */
+#define R_WINDOW_PAGES 2
+
 /**
  * Note: These addresses define the start and end of the FLASH_USER region, not the start and end of the code placed there
  * They must be the same as the addresses of this region in the linker script nrf52833-softdevice.ld
@@ -38,12 +43,44 @@ DEALINGS IN THE SOFTWARE.
 
 /**
  * Time used to stagger NAK sending and turn based listening behaviour
- * Note: With current calibrated values, this performs well with up to 27 receivers, however packet collisions occur
- * as the range of the randomised backoff is to small
- * To improve the protocol performance this value should scale with the number of receivers
+ * Note: With current calibrated values, this performs well with up to 27 receivers, beyond that the window
+ * is scaled by R_NAK_WINDOW_SCALED according to the number of distinct receivers seen
  */
 #define R_NAK_WINDOW 3*R_SLEEP_TIME
 
+/**
+ * Number of receivers a single R_NAK_WINDOW can serve before the randomised backoff range is widened,
+ * and the upper limit on how many times R_NAK_WINDOW the backoff may grow to
+ */
+#define R_NAK_RECEIVERS_PER_WINDOW 27
+#define R_NAK_WINDOW_MAX_SCALE 8
+
+/**
+ * NAK window adapted to the number of distinct receivers heard (n), grows linearly with n and is capped
+ */
+#define R_NAK_WINDOW_SCALED(n) ((R_NAK_WINDOW) * ((1 + (n) / R_NAK_RECEIVERS_PER_WINDOW) < R_NAK_WINDOW_MAX_SCALE ? (1 + (n) / R_NAK_RECEIVERS_PER_WINDOW) : R_NAK_WINDOW_MAX_SCALE))
+
+/**
+ * NAKs are sent as a bitmap of missing sequence numbers for the current page, appended after the header
+ */
+#define R_NAK_BITMAP_SIZE (((R_FLASH_PAGE_SIZE / R_PAYLOAD_SIZE) + 7) / 8)
+
+/**
+ * Delta transfer: before the data of each page the sender broadcasts a manifest holding a 32 bit hash of every packet,
+ * receivers take packets which already match from their own FLASH_USER region and only NAK the ones which differ
+ * Set R_DELTA_TRANSFER to 0 to always send every packet
+ */
+#ifndef R_DELTA_TRANSFER
+#define R_DELTA_TRANSFER 1
+#endif
+#define R_MANIFEST_SIZE ((R_FLASH_PAGE_SIZE / R_PAYLOAD_SIZE) * 4)
+
+/**
+ * Optional 16 byte AES-128 key shared by sender and receivers, given as a brace enclosed initialiser list
+ * When defined, all radio flashing traffic is encrypted and authenticated with AES-CCM, and forged or replayed packets are dropped
+ * e.g. #define R_CCM_KEY {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f}
+ */
+
 /**
  * Linker symbols for the start and end of code placed in the flash_user section
  */
@@ -24,7 +24,9 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitRadio.h"
 #include "MicroBit.h"
 #include "MicroBitRadioFlashConfig.h"
+#include "MicroBitFlash.h"
 #include <map>
+#include <set>
 
 
 namespace codal
@@ -53,7 +55,7 @@ class MicroBitRadioFlashReceiver
     private:
     MicroBit &uBit; //reference to the microbit device
 
-    uint8_t pageBuffer[R_FLASH_PAGE_SIZE]; //buffer of one page of program data (protocol supports multipage programs so each page is buffered at a time)
+    MicroBitFlash flash; //interface used to erase pages and burn packets straight into FLASH_USER
 
     uint32_t recID; //unique ID used for performance data collection
     uint32_t time; //counter since boot, incremented every R_SLEEP_TIME/2, used as unique ID
@@ -63,10 +65,15 @@ class MicroBitRadioFlashReceiver
     uint32_t totalPackets; //total number of packets in this transfer, determined by field in header of received packet
     uint32_t totalPages; //total number of pages in this transfer, determined by field in header of received packet
     uint32_t packetsPerPage; //number of packets in each page R_FLASH_PAGE_SIZE / R_PAYLOAD_SIZE
-    uint32_t packetsThisPage; //packets in current page being written, usually = packetsPerPage but recalculated on last page to ensure correct size is written to memory
-
-    std::map<uint16_t, bool> packetMap; //data structure used to keep track of which packets have been correctly received, initialised as {sequence number, false} for all sequence numbers, set to {seq, true} when received correctly
-    std::map<uint16_t, bool> receivedNAKs; //data structure used to track which packets this device has received a NAK for (from another receiver), used to supress NAKs and avoid duplicates (NAK implosion)
+    uint16_t lastPageSent; //last page of the window the sender has sent, carried in end of page packets
+
+    std::map<uint16_t, std::map<uint16_t, bool>> packetMap; //data structure used to keep track of which packets of each page in the window have been correctly received, initialised as {sequence number, false} for all sequence numbers, set to {seq, true} when received correctly
+    std::map<uint16_t, std::map<uint16_t, bool>> receivedNAKs; //data structure used to track which packets of each page this device has received a NAK for (from another receiver), used to supress NAKs and avoid duplicates (NAK implosion)
+    std::set<uint16_t> pagesWritten; //pages in the window which have been written to flash ahead of currentPage
+    std::set<uint16_t> pagesErased; //pages in the window which have been erased and are being written packet by packet
+    std::set<uint16_t> receiversHeard; //IDs of other receivers whose NAKs have been overheard, used to scale the NAK backoff window
+    uint16_t receiverID; //short ID of this receiver carried in its NAKs, taken from the device serial number
+    uint16_t advertisedReceivers; //number of distinct receivers the sender has heard from, carried in end of page packets
     
     //state of this receiver
     typedef enum PageState
@@ -77,7 +84,7 @@ class MicroBitRadioFlashReceiver
     volatile PageState pageState;
 
     volatile bool transferComplete; //flag for completion of transfer
-    uint16_t currentPage; //current page number
+    uint16_t currentPage; //first page of the window which has not yet been written to flash
     uint16_t lastSeqN; //sequence number of last data packet correctly received
     uint32_t lastRxTime; //last time a packet was received
     bool readyToNAK; //flag used to enter NAK round, used so priority is given to receiving packets over sending NAKs
@@ -90,7 +97,8 @@ class MicroBitRadioFlashReceiver
     
 
     /**
-     * Write one data packet into the page buffer, writes page buffer into flash if page is complete
+     * Write one data packet straight into flash, erasing its page first if this is the first packet written to it.
+     * Erased flash can be programmed a word at a time in any order, so out of order packets need no buffering
      * 
      * @param packet The received data packet
      * @param uBit reference to the microbit device
@@ -98,7 +106,35 @@ class MicroBitRadioFlashReceiver
     void handleSenderPacket(PacketBuffer packet, MicroBit &uBit);
 
     /**
-     * Extract received NAK sequence number, set receivedNAKs to true for that seq number
+     * Compare the packet hashes in a manifest from the sender against the current contents of FLASH_USER,
+     * every packet which already matches is kept and marked as received, so only changed packets are NAKed.
+     * If any packet differs the page is erased, with matching packets restored through the scratch page
+     *
+     * @param packet The received manifest packet
+     * @param uBit reference to the microbit device
+     */
+    void handleManifestPacket(PacketBuffer packet, MicroBit &uBit);
+
+    /**
+     * Record the size of the transfer from the header of the first packet received from the sender
+     *
+     * @param packet A received sender, manifest or end of page packet
+     * @param uBit reference to the microbit device
+     */
+    void startTransfer(PacketBuffer packet, MicroBit &uBit);
+
+    /**
+     * Record a completely written page and slide the window past it,
+     * reports statistics and resets the device once the final page is written
+     *
+     * @param page the page number
+     * @param uBit reference to the microbit device
+     */
+    void completePage(uint16_t page, MicroBit &uBit);
+
+    /**
+     * Extract the received NAK bitmap, set receivedNAKs to true for every sequence number it contains
+     * and record the ID of the receiver that sent it
      * If still in RECEIVING state, enter RECOVERY
      * 
      * @param packet The received NAK packet
@@ -128,30 +164,81 @@ class MicroBitRadioFlashReceiver
     void updateLoadingScreen(MicroBit &uBit);
 
     /**
-     * Check if all sequence numbers in packetMap are true (all packets written to page buffer)
+     * Check if all sequence numbers in packetMap are true for the given page (all packets written to flash)
+     * @param page the page number to check
      * @return true if all packets written, false otherwise
      */
-    bool isBufferWritten();
+    bool isPageWritten(uint16_t page);
 
     /**
-     * Write one buffered page to the given address in flash
-     * @param flash_addr the address in flash to write to
-     * @param pageBuffer the page buffer to write
+     * Check if every page in the window, up to the last page known to have been sent, has been received
+     * @return true if no packets are missing, false otherwise
      */
-    void flashUserPage(uint32_t flash_addr, uint8_t *pageBuffer);
+    bool isWindowWritten();
 
     /**
-     * Erases all pages in the FLASH_USER memory region
+     * Calculates the last page of the window which the sender is known to have started sending,
+     * either from the end of page packet or from data packets already received
+     * @return the page number
      */
-    void eraseAllUserPages();
+    uint16_t lastPageInWindow();
 
     /**
-     * Send NAKs for packets which haven't been received and for which no NAK
-     * has been detected from another receiver
+     * Calculates the number of packets in the given page, the last page may be shorter than packetsPerPage
+     * @param page the page number
+     * @return number of packets in the page
+     */
+    uint16_t packetsInPage(uint16_t page);
+
+    /**
+     * Populate packetMap with {sequence number, false} for every packet of the given page, if not already done
+     * @param page the page number
+     */
+    void initialisePage(uint16_t page);
+
+    /**
+     * Calculates the address in FLASH_USER of a packet
+     * @param page the page number
+     * @param seq the sequence number within the page
+     * @return pointer to the first word of the packet in flash
+     */
+    uint32_t *packetAddress(uint16_t page, uint16_t seq);
+
+    /**
+     * Erase a page of FLASH_USER the first time it is written to in this transfer
+     * @param page the page number
+     */
+    void erasePage(uint16_t page);
+
+    /**
+     * Calculates a 32 bit FNV-1a hash of one packet payload worth of data, used to compare the sender's image
+     * against the current contents of FLASH_USER
+     * @param data pointer to R_PAYLOAD_SIZE bytes
+     * @return the hash
+     */
+    uint32_t packetHash(const uint8_t *data);
+
+    /**
+     * Calculates the NAK backoff window, scaled by the larger of the number of receivers this device
+     * has overheard and the number advertised by the sender
+     * @return the NAK window in ms
+     */
+    uint32_t nakWindow();
+
+    /**
+     * Send NAKs for every page in the window with packets which haven't been received
      * @param uBit reference to the microbit device 
      */
     void sendNAKs(MicroBit &uBit);
 
+    /**
+     * Send a single bitmap NAK for the packets of one page which haven't been received and for which no NAK
+     * has been detected from another receiver, nothing is sent if every missing packet has already been NAKed
+     * @param page the page number to NAK
+     * @param uBit reference to the microbit device
+     */
+    void sendPageNAK(uint16_t page, MicroBit &uBit);
+
     /**
      * Diagnostic for debugging which prints packetMap and receivedNAKs over serial,
      * caution, serial is relatively slow, so depending on the value of R_SLEEP_TIME
@@ -69,9 +69,13 @@ namespace codal
         uint32_t totalPages; //total number of pages
 
         uint32_t NAKTimeout; //time last NAK was received
+
+        uint32_t windowBase; //first page of the window currently in flight
+        uint32_t nextPage; //page after the last page of the window which has been sent
         
-        std::set<uint16_t> receivedNAKs; //data structure for tracking NAKs from receivers
-        std::map<uint16_t, uint32_t> sendTimes; //data structure for times packets were sent, used for RTT stats calculation in evaluation
+        std::set<std::pair<uint16_t,uint16_t>> receivedNAKs; //data structure for tracking NAKs from receivers, <page number, sequence number>
+        std::set<uint16_t> receiversHeard; //IDs of receivers a NAK has been heard from, used to scale the NAK window
+        std::map<std::pair<uint16_t,uint16_t>, uint32_t> sendTimes; //data structure for times packets were sent, used for RTT stats calculation in evaluation, <<sequence number, page number>, time>
         std::map<std::pair<uint16_t,uint16_t>, uint32_t> rtts; // data structure for rtts, <<sequence number, page number>, rtt>
 
         //loading screen animation
@@ -112,6 +116,32 @@ namespace codal
          */
         void sendSinglePacket(uint16_t seq, uint32_t currentPage, MicroBit &uBit);
 
+        /**
+         * Sends the manifest for a page of FLASH_USER, a 32 bit hash of each packet in the page,
+         * receivers take packets whose hash matches their own flash and NAK the rest
+         * 
+         * Manifest Packet Structure:
+         * 0    1   2   3    4   5       6       7        8        9          10      11  .... 15
+         * +---------------------------------------------------------------------------------------+
+         * | ID | Padding | Page # | Total packets | Header Checksum | Hash Checksum | Padding |
+         * +---------------------------------------------------------------------------------------+
+         * |                                       Hashes                                          |
+         * +---------------------------------------------------------------------------------------+
+         * 
+         * @param currentPage the number of the page
+         * @param uBit reference to the microbit device
+         */
+        void sendManifest(uint32_t currentPage, MicroBit &uBit);
+
+        /**
+         * Calculates a 32 bit FNV-1a hash of one packet payload, bytes beyond len are hashed as zero padding
+         * 
+         * @param data pointer to the packet data
+         * @param len number of valid bytes, at most R_PAYLOAD_SIZE
+         * @return the hash
+         */
+        uint32_t packetHash(const uint8_t *data, uint32_t len);
+
         /**
          * Sends a page of flash by calling sendSinglePacket(), for 0 to npackets
          * 
@@ -122,25 +152,34 @@ namespace codal
         void sendPage(uint16_t npackets, uint32_t currentPage, MicroBit &uBit);
 
         /**
-         * Send packet signalling end of page transmission
+         * Calculates the number of packets in the given page, the last page sends the remainder of the packets
+         * instead of packetsPerPage
+         * @param page the page number
+         * @return number of packets in the page
+         */
+        uint16_t packetsInPage(uint32_t page);
+
+        /**
+         * Send packet signalling end of transmission of the pages in the window, carrying the last page sent,
+         * the total number of packets and the number of distinct receivers heard so that receivers can scale their NAK backoff window
          * @param uBit reference to the microbit device
          */
         void sendEndOfPagePacket(MicroBit &uBit);
 
         /**
-         * Parses a NAK from a receiver Microbit and adds its sequence number to a list of NAKs used for retransmission
+         * Parses a bitmap NAK from a receiver Microbit and adds every sequence number it contains to a list of NAKs used for retransmission,
+         * NAKs are accepted for any page in the window which has been sent
          * 
-         * NAK Packet Structure (same length as sender packet header, but ignoring certain fields)
-         * 0    1              2               3    4   5  .....  7    8     9 .....  15  
-         * +---------------------------------------------------------------------------+
-         * | ID | Seq of packet for retransmit | Page # | Padding | Checksum | Padding |
-         * +---------------------------------------------------------------------------+
+         * NAK Packet Structure (sender packet header followed by a bitmap of missing packets, bit 0 = sequence number 1)
+         * 0    1         2    3    4   5        6      7        8        9       10      11 .... 15   16 ......
+         * +----------------------------------------------------------------------------------------+-----------+
+         * | ID | Missing count | Page # | Receiver ID | Header Checksum | Bitmap Checksum | Padding | Bitmap    |
+         * +----------------------------------------------------------------------------------------+-----------+
          * 
          * @param p the NAK packet received
-         * @param currentPage the number of the page that was last sent, used to check if the NAK is for the current page
          * @param uBit reference to the microbit device
          */
-        void handleNAK(PacketBuffer p, uint32_t currentPage, MicroBit &uBit);
+        void handleNAK(PacketBuffer p, MicroBit &uBit);
 
     };
 
@@ -0,0 +1,219 @@
+/*
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_RADIO_STREAM_H
+#define MICROBIT_RADIO_STREAM_H
+
+#include "CodalConfig.h"
+#include "MicroBitRadio.h"
+#include "ManagedString.h"
+
+// Frame types
+#define MICROBIT_RADIO_STREAM_TYPE_DATA         1
+#define MICROBIT_RADIO_STREAM_TYPE_ACK          2
+
+// Size of the header carried in every stream frame, and the payload carried by each data fragment.
+// Room for the encryption fields is deliberately reserved even on groups without a key. Receivers place each fragment
+// at index * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE, so the size must be the same on every micro:bit, whatever its key state.
+#define MICROBIT_RADIO_STREAM_HEADER_SIZE       8
+#define MICROBIT_RADIO_STREAM_FRAGMENT_SIZE     (MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_RADIO_CCM_OVERHEAD - MICROBIT_RADIO_STREAM_HEADER_SIZE)
+#define MICROBIT_RADIO_STREAM_BITMAP_SIZE       ((MICROBIT_RADIO_STREAM_MAX_FRAGMENTS + 7) / 8)
+
+namespace codal
+{
+    /**
+     * A message being reassembled from its fragments.
+     */
+    struct RadioStreamReassembly
+    {
+        uint16_t        source;                                             // Address of the sender, or 0 if this slot is free.
+        uint8_t         messageId;                                          // Sender's identifier for this message.
+        uint8_t         count;                                              // Number of fragments in the message.
+        uint16_t        length;                                             // Length of the message, known once the last fragment arrives.
+        uint8_t         received[MICROBIT_RADIO_STREAM_BITMAP_SIZE];        // Bitmap of fragments received.
+        uint8_t         *data;                                              // Reassembly buffer, count * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE bytes.
+        CODAL_TIMESTAMP lastActivity;                                       // Time the last fragment arrived, used to reclaim abandoned slots.
+    };
+
+    /**
+     * Provides reliable delivery of messages of arbitrary length between two micro:bits.
+     *
+     * Messages are split into fragments which are sent under a sliding window. The receiver acknowledges with a bitmap
+     * of every fragment it holds, so only the fragments actually lost are retransmitted. The retransmission timeout follows
+     * the measured round trip time, in the manner of RFC 6298.
+     *
+     * Each micro:bit is addressed by the low 16 bits of its serial number.
+     *
+     * Frame layout, following the radio header:
+     * +-------------------------------------------------------------------------------------------------+
+     * | Type (1) | Message ID (1) | Source (2) | Destination (2) | Index (1) | Count (1) | Payload       |
+     * +-------------------------------------------------------------------------------------------------+
+     *
+     * In a data frame, Index is the fragment carried. In an acknowledgement, Index is the fragment which caused it to be sent,
+     * and the payload is the bitmap of fragments received, bit 0 of the first byte being fragment 0.
+     */
+    class MicroBitRadioStream
+    {
+        MicroBitRadio           &radio;                                     // The underlying radio module used to send and receive data.
+        uint16_t                address;                                    // Our own address, assigned when the radio is first used.
+
+        // Transmit state, valid while a send is in progress.
+        bool                    sending;                                    // Set while a send is in progress.
+        uint16_t                txDestination;                              // Address the current message is being sent to.
+        uint8_t                 txMessageId;                                // Identifier of the current message.
+        bool                    txSeeded;                                   // Set once txMessageId has been given a random starting value.
+        uint8_t                 txCount;                                    // Number of fragments in the current message.
+        uint8_t                 txAcked[MICROBIT_RADIO_STREAM_BITMAP_SIZE]; // Bitmap of fragments acknowledged.
+        uint8_t                 *txTransmissions;                           // Number of times each fragment has been sent.
+        CODAL_TIMESTAMP         *txSendTime;                                // Time each fragment was last sent.
+        bool                    txProgress;                                 // Set when an acknowledgement covers a new fragment.
+
+        // Round trip estimation, in milliseconds. The smoothed RTT is scaled by 8 and its variance by 4.
+        uint32_t                srtt;
+        uint32_t                rttvar;
+        uint32_t                rto;
+
+        // Receive state.
+        RadioStreamReassembly   slots[MICROBIT_RADIO_STREAM_RX_SLOTS];
+        PacketBuffer            rxQueue[MICROBIT_RADIO_STREAM_RX_QUEUE]; // Completed messages, awaiting collection.
+        uint16_t                rxSource[MICROBIT_RADIO_STREAM_RX_QUEUE];
+        uint8_t                 rxQueueLength;
+        uint16_t                lastSource;                                 // Sender and identifier of the last completed message,
+        uint8_t                 lastMessageId;                              // so that retransmissions of it can still be acknowledged.
+        uint8_t                 lastCount;
+
+        public:
+
+        uint32_t                bytesSent;                                  // Number of message bytes delivered and acknowledged.
+        uint32_t                fragmentsSent;                              // Number of data frames transmitted, including retransmissions.
+        uint32_t                retransmissions;                            // Number of data frames retransmitted.
+        uint32_t                timeSending;                                // Total time spent in send(), in milliseconds.
+
+        /**
+         * Constructor.
+         *
+         * Creates an instance of a MicroBitRadioStream which offers reliable delivery of
+         * messages of arbitrary length to other micro:bits in the vicinity.
+         *
+         * @param r The underlying radio module used to send and receive data.
+         */
+        MicroBitRadioStream(MicroBitRadio &r);
+
+        /**
+         * Retrieves the address other micro:bits use to send messages to this one.
+         *
+         * @return The 16 bit address of this micro:bit.
+         */
+        uint16_t getAddress();
+
+        /**
+         * Sends the given message to another micro:bit, and waits until it has been acknowledged.
+         *
+         * This is a blocking call, which must be made from a fiber.
+         *
+         * @param destination The address of the receiving micro:bit.
+         *
+         * @param buffer The message to send.
+         *
+         * @param len The length of the message, up to MICROBIT_RADIO_STREAM_MAX_FRAGMENTS * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE bytes.
+         *
+         * @return MICROBIT_OK once the whole message is acknowledged, MICROBIT_INVALID_PARAMETER if the parameters are invalid,
+         *         MICROBIT_BUSY if another send is in progress, MICROBIT_NO_RESOURCES if memory could not be allocated,
+         *         or MICROBIT_CANCELLED if the receiver stopped responding.
+         */
+        int send(uint16_t destination, uint8_t *buffer, int len);
+
+        /**
+         * Sends the given message to another micro:bit, and waits until it has been acknowledged.
+         *
+         * @param destination The address of the receiving micro:bit.
+         *
+         * @param data The message to send.
+         *
+         * @return MICROBIT_OK once the whole message is acknowledged, or an error as described for send(uint16_t, uint8_t *, int).
+         */
+        int send(uint16_t destination, PacketBuffer data);
+
+        /**
+         * Sends the given string to another micro:bit, and waits until it has been acknowledged.
+         *
+         * @param destination The address of the receiving micro:bit.
+         *
+         * @param data The message to send.
+         *
+         * @return MICROBIT_OK once the whole message is acknowledged, or an error as described for send(uint16_t, uint8_t *, int).
+         */
+        int send(uint16_t destination, ManagedString data);
+
+        /**
+         * Retrieves the next complete message received.
+         *
+         * @param source If not NULL, receives the address of the sender.
+         *
+         * @return The message, or an empty PacketBuffer if no message is available.
+         */
+        PacketBuffer recv(uint16_t *source = NULL);
+
+        /**
+         * Retrieves the current retransmission timeout.
+         *
+         * @return The retransmission timeout in milliseconds.
+         */
+        int getRetransmissionTimeout();
+
+        /**
+         * Protocol handler callback. This is called when the radio receives a packet marked as a stream frame.
+         *
+         * Data fragments addressed to us are reassembled and acknowledged, and acknowledgements update the message being sent.
+         */
+        void packetReceived();
+
+        private:
+
+        /**
+         * Transmits a single stream frame.
+         */
+        int sendFrame(uint8_t type, uint8_t messageId, uint16_t destination, uint8_t index, uint8_t count, const uint8_t *payload, int len);
+
+        /**
+         * Processes an acknowledgement for the message being sent.
+         */
+        void ackReceived(FrameBuffer *p);
+
+        /**
+         * Stores a received data fragment, and acknowledges it when required.
+         */
+        void dataReceived(FrameBuffer *p);
+
+        /**
+         * Acknowledges a message to its sender, with the bitmap of fragments received.
+         */
+        void sendAck(uint16_t destination, uint8_t messageId, uint8_t index, uint8_t count, const uint8_t *received);
+
+        /**
+         * Updates the round trip estimate and retransmission timeout with a new measurement.
+         */
+        void rttSample(uint32_t rtt);
+    };
+}
+
+#endif
@@ -42,6 +42,16 @@ DEALINGS IN THE SOFTWARE.
 #define NRF52_LEDMATRIX_STATUS_RESET            0x01
 #define NRF52_LEDMATRIX_STATUS_LIGHTREADY       0x02
 
+// Raised once a presented frame has been completely displayed. This shares the display's component ID with the
+// codal-core display events (DISPLAY_EVT_ANIMATION_COMPLETE 1, DISPLAY_EVT_FREE 2, DISPLAY_EVT_LIGHT_SENSE 4), so is kept well clear of them.
+#define NRF52_LEDMATRIX_EVT_FRAME_COMPLETE      256
+
+#if (defined(DISPLAY_EVT_ANIMATION_COMPLETE) && DISPLAY_EVT_ANIMATION_COMPLETE == NRF52_LEDMATRIX_EVT_FRAME_COMPLETE) || \
+    (defined(DISPLAY_EVT_FREE) && DISPLAY_EVT_FREE == NRF52_LEDMATRIX_EVT_FRAME_COMPLETE) || \
+    (defined(DISPLAY_EVT_LIGHT_SENSE) && DISPLAY_EVT_LIGHT_SENSE == NRF52_LEDMATRIX_EVT_FRAME_COMPLETE)
+    #error "NRF52_LEDMATRIX_EVT_FRAME_COMPLETE collides with a display event"
+#endif
+
 namespace codal
 {
     /**
@@ -59,11 +69,35 @@ namespace codal
         NRFLowLevelTimer    &timer;             // The timer module used to drive this LEDMatrix.
         uint32_t            timerPeriod;        // The period of the hardware timer.
         uint32_t            quantum;            // The length of time allotted to each brightness level.
+        uint32_t            clipLevel;          // The timer value used for every lit pixel in black and white modes, or zero in greyscale modes.
         uint32_t            lightLevel;         // Record of the last light level sampled.
         
         int8_t              gpiote[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];            // GPIOTE channels used by output columns.
         int8_t              ppi[NRF52_LED_MATRIX_MAXIMUM_COLUMNS];               // PPI channels used by output columns.
 
+        uint8_t             *frontBuffer;       // The frame being displayed. Only accessed by render(). NULL if the buffers could not be allocated.
+        uint8_t             *backBuffer;        // The most recently presented frame, waiting to be displayed. NULL if the buffers could not be allocated.
+        volatile bool       framePending;       // Whether backBuffer holds a frame that has not yet been displayed.
+        volatile bool       frameShowing;       // Whether frontBuffer holds a presented frame that has not yet completed.
+        bool                autoPresent;        // Whether the contents of image are presented at the start of every frame.
+        uint16_t            *strobeTable;       // Frame buffer index of the pixel driven by each column, for each row strobe. NULL if it could not be allocated.
+
+        /**
+         * Determine the index of the pixel in the frame buffer driven by the given column of the given row strobe, for the current rotation.
+         */
+        uint16_t getStrobeIndex(int row, int column);
+
+        /**
+         * Recalculate the strobe table for the current rotation.
+         * This records, for each column of each row strobe, the index of the pixel in the frame buffer that drives it.
+         */
+        void updateStrobeTable();
+
+        /**
+         * Recalculate the timer values used for each brightness level, following a change of mode or brightness.
+         */
+        void updateLevels();
+
         public:
         /**
          * Configure the next frame to be drawn.
@@ -147,6 +181,30 @@ namespace codal
          */
         void clear();
 
+        /**
+         * Presents the current contents of the display image.
+         *
+         * The image is copied, and displayed from the start of the next frame, so it can be
+         * redrawn straight away without affecting what is shown. A NRF52_LEDMATRIX_EVT_FRAME_COMPLETE
+         * event is raised once the frame has been completely displayed.
+         * If there was insufficient memory for the frame buffers, the image is instead displayed as it is drawn.
+         *
+         * @code
+         * display.setAutoPresent(false);
+         * display.image.setPixelValue(2, 2, 255);
+         * display.present();
+         * @endcode
+         */
+        void present();
+
+        /**
+         * Determines whether the display image is presented automatically at the start of every frame (the default).
+         * Disable this to draw into the image over time, and only show the result when present() is called.
+         *
+         * @param autoPresent true to present the image at the start of every frame, false to only update the display on present().
+         */
+        void setAutoPresent(bool autoPresent);
+
         /**
          * Configures the brightness of the display.
          *
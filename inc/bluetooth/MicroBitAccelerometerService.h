@@ -32,6 +32,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
+#include "MicroBitBLESensorStream.h"
 #include "MicroBitAccelerometer.h"
 #include "EventModel.h"
 
@@ -65,6 +66,11 @@ class MicroBitAccelerometerService : public MicroBitBLEService
       */
     void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
 
+    /**
+      * Invoked when notifications have been sent, and there is space to queue more.
+      */
+    void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
+
     /**
       * Callback. Invoked when any of our attributes are written via BLE.
       */
@@ -96,6 +102,10 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     {
         mbbs_cIdxDATA,
         mbbs_cIdxPERIOD,
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+        mbbs_cIdxSTREAM,
+        mbbs_cIdxSTREAMCONFIG,
+#endif
         mbbs_cIdxCOUNT
     } mbbs_cIdx;
     
@@ -106,6 +116,11 @@ class MicroBitAccelerometerService : public MicroBitBLEService
     // Data for each characteristic when they are held by Soft Device.
     MicroBitBLEChar      chars[ mbbs_cIdxCOUNT];
 
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    // Batched stream of samples, sent to the stream characteristic.
+    MicroBitBLESensorStream stream;
+#endif
+
     public:
     
     int              characteristicCount()          { return mbbs_cIdxCOUNT; };
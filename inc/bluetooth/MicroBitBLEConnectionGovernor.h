@@ -0,0 +1,229 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BLE_CONNECTION_GOVERNOR_H
+#define MICROBIT_BLE_CONNECTION_GOVERNOR_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include <stdint.h>
+
+// Connection modes chosen by a MicroBitBLEConnectionPolicy.
+#define MICROBIT_BLE_CONNECTION_MODE_DEFAULT    0       // The connection parameters set up by MicroBitBLEManager::init.
+#define MICROBIT_BLE_CONNECTION_MODE_FAST       1       // Short connection interval and 2M PHY, for bulk transfers.
+#define MICROBIT_BLE_CONNECTION_MODE_IDLE       2       // Long connection interval with slave latency, to save power.
+
+// The period over which traffic is measured, in milliseconds.
+#define MICROBIT_BLE_GOVERNOR_SAMPLE_PERIOD     250
+
+namespace codal
+{
+
+/**
+  * Traffic measured over one sample period.
+  */
+struct MicroBitBLETrafficSample
+{
+    uint32_t    period;         // Length of the sample period, in milliseconds.
+    uint16_t    txPackets;      // Notifications and indications sent.
+    uint16_t    rxPackets;      // Writes received.
+    uint32_t    rxBytes;        // Bytes written by the client.
+    uint16_t    txBlocked;      // Times a notification could not be queued because the SoftDevice's queue was full.
+};
+
+/**
+  * Interface for a policy that chooses the connection mode from the traffic on the connection.
+  */
+class MicroBitBLEConnectionPolicy
+{
+    public:
+
+    /**
+      * Choose the connection mode.
+      *
+      * @param sample The traffic measured over the most recent sample period.
+      * @param mode The current connection mode.
+      * @param now The current system time, in milliseconds.
+      *
+      * @return The connection mode to use, one of MICROBIT_BLE_CONNECTION_MODE_DEFAULT, _FAST or _IDLE.
+      */
+    virtual int decide( const MicroBitBLETrafficSample &sample, int mode, uint32_t now) = 0;
+
+    /**
+      * Restart the policy, for a new connection.
+      *
+      * @param now The current system time, in milliseconds.
+      */
+    virtual void reset( uint32_t now) {}
+
+    virtual ~MicroBitBLEConnectionPolicy() {}
+};
+
+/**
+  * The default connection policy.
+  *
+  * Switches to MICROBIT_BLE_CONNECTION_MODE_FAST when the SoftDevice's transmit queue fills,
+  * or the packet rate reaches MICROBIT_BLE_GOVERNOR_BURST_RATE, and stays there for at least MICROBIT_BLE_GOVERNOR_BURST_HOLD.
+  * Switches to MICROBIT_BLE_CONNECTION_MODE_IDLE when there has been no traffic for MICROBIT_BLE_GOVERNOR_IDLE_TIMEOUT,
+  * and back to MICROBIT_BLE_CONNECTION_MODE_DEFAULT as soon as there is.
+  */
+class MicroBitBLEBurstPolicy : public MicroBitBLEConnectionPolicy
+{
+    uint32_t    lastActive;     // When traffic was last seen.
+    uint32_t    lastBurst;      // When a burst was last seen.
+
+    public:
+
+    MicroBitBLEBurstPolicy();
+
+    virtual int decide( const MicroBitBLETrafficSample &sample, int mode, uint32_t now) override;
+
+    virtual void reset( uint32_t now) override;
+};
+
+/**
+  * Class definition for MicroBitBLEConnectionGovernor.
+  *
+  * Measures the traffic on a connection, and uses a MicroBitBLEConnectionPolicy to decide when the
+  * connection parameters should change. It has no dependency on the SoftDevice: MicroBitBLEManager
+  * reports traffic and connection parameter changes to it, and applies its decisions.
+  */
+class MicroBitBLEConnectionGovernor
+{
+    MicroBitBLEBurstPolicy          defaultPolicy;
+    MicroBitBLEConnectionPolicy     *policy;
+
+    // Traffic counters for the current sample period. Updated from the BLE event handler.
+    volatile uint16_t   txPackets;
+    volatile uint16_t   rxPackets;
+    volatile uint32_t   rxBytes;
+    volatile uint16_t   txBlocked;
+
+    uint32_t    sampleTime;     // When the current sample period started.
+    MicroBitBLETrafficSample sample;
+
+    int         mode;
+    uint16_t    interval;       // Current connection interval, in 1.25ms units.
+    uint16_t    latency;        // Current slave latency, in connection events.
+    uint8_t     phy;            // Current PHY, in Mbps.
+    uint16_t    payload;        // Largest notification payload, in bytes.
+
+    public:
+
+    /**
+      * Constructor.
+      */
+    MicroBitBLEConnectionGovernor();
+
+    /**
+      * Replace the policy used to choose the connection mode.
+      *
+      * @param policy The policy to use, or NULL to restore the default MicroBitBLEBurstPolicy.
+      */
+    void setPolicy( MicroBitBLEConnectionPolicy *policy);
+
+    /**
+      * Start measuring a new connection.
+      *
+      * @param now The current system time, in milliseconds.
+      * @param interval The connection interval, in 1.25ms units.
+      * @param latency The slave latency.
+      */
+    void reset( uint32_t now, uint16_t interval, uint16_t latency);
+
+    /**
+      * Record notifications or indications that have been sent.
+      */
+    void onTransmit( int count) { txPackets += count; }
+
+    /**
+      * Record a write from the client.
+      */
+    void onReceive( int length) { rxPackets++; rxBytes += length; }
+
+    /**
+      * Record that a notification could not be queued, because the SoftDevice's transmit queue was full.
+      */
+    void onTransmitBlocked() { txBlocked++; }
+
+    /**
+      * Record the connection parameters negotiated with the client.
+      */
+    void setConnectionParameters( uint16_t interval, uint16_t latency);
+
+    /**
+      * Record the PHY in use.
+      *
+      * @param mbps 1 or 2.
+      */
+    void setPhy( int mbps) { phy = mbps; }
+
+    /**
+      * Record the largest notification payload, following ATT MTU negotiation.
+      */
+    void setPayload( int bytes) { payload = bytes; }
+
+    /**
+      * Close the current sample period if it has ended, and consult the policy.
+      *
+      * @param now The current system time, in milliseconds.
+      *
+      * @return true if the connection mode has changed.
+      */
+    bool update( uint32_t now);
+
+    /**
+      * @return The current connection mode.
+      */
+    int getMode() { return mode; }
+
+    /**
+      * @return The traffic measured over the most recent sample period.
+      */
+    const MicroBitBLETrafficSample &getSample() { return sample; }
+
+    /**
+      * Estimate the throughput over the most recent sample period.
+      * Notification sizes are not reported by the SoftDevice, so each is counted as a full payload.
+      *
+      * @return The bytes per second sent and received.
+      */
+    uint32_t getThroughput();
+
+    /**
+      * Estimate the fraction of time the radio was active over the most recent sample period,
+      * from the connection interval, slave latency, PHY and packet counts.
+      *
+      * @return The estimated duty cycle, in parts per thousand.
+      */
+    int getDutyCycle();
+};
+
+} // namespace codal
+
+#endif // CONFIG_ENABLED(DEVICE_BLE)
+#endif // MICROBIT_BLE_CONNECTION_GOVERNOR_H
@@ -39,6 +39,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitDisplay.h"
 #include "ExternalEvents.h"
 #include "MicroBitButton.h"
+#include "MicroBitBLEConnectionGovernor.h"
 
 #define MICROBIT_BLE_PAIR_REQUEST 0x01
 #define MICROBIT_BLE_PAIR_COMPLETE 0x02
@@ -185,7 +186,8 @@ class MicroBitBLEManager : public CodalComponent
 
     /**
      * Periodic callback in thread context.
-     * We use this here purely to safely issue a disconnect operation after a pairing operation is complete.
+     * We use this here to safely issue a disconnect operation after a pairing operation is complete,
+     * and to apply changes of connection parameters chosen by the connection governor.
 	 */
     void idleCallback();
 
@@ -205,6 +207,26 @@ class MicroBitBLEManager : public CodalComponent
      */
     bool getConnected();
 
+    /**
+     * Determine the largest attribute value that can be sent in a single notification or indication,
+     * based on the ATT MTU negotiated with the connected device.
+     * @return The number of bytes, or 20 (the BLE default) if there is no connection.
+     */
+    static int getMaximumPayload();
+
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+    /**
+     * Access the governor that adapts the connection parameters to the traffic on the connection.
+     * This can be used to install a different MicroBitBLEConnectionPolicy, or to read the measured
+     * throughput and estimated radio duty cycle.
+     * @return The connection governor.
+     */
+    MicroBitBLEConnectionGovernor *getConnectionGovernor() { return &governor; }
+
+    // Measures the traffic on the connection. Updated from the BLE event handlers.
+    MicroBitBLEConnectionGovernor governor;
+#endif
+
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL)
     /**
       * Set the content of Eddystone URL frames
@@ -309,6 +331,13 @@ class MicroBitBLEManager : public CodalComponent
     */
     void showManagementModeAnimation(MicroBitDisplay &display);
 
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+    /**
+     * Request the connection parameters and PHY for the governor's current connection mode.
+     */
+    void updateConnectionParameters();
+#endif
+
     int pairingStatus;
     ManagedString passKey;
     ManagedString gapName;
@@ -0,0 +1,139 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MICROBIT_BLE_SENSOR_STREAM_H
+#define MICROBIT_BLE_SENSOR_STREAM_H
+
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEService.h"
+#include "nrf_sdh_ble.h"
+
+// Largest notification a sensor stream can send, limited by the ATT MTU the SoftDevice supports.
+#define MICROBIT_BLE_SENSOR_STREAM_PACKET_SIZE      (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
+namespace codal
+{
+
+/**
+  * A single sample, as sent in a sensor stream notification.
+  */
+struct MicroBitBLESensorSample
+{
+    uint16_t    time;           // The low 16 bits of the system time (in milliseconds) when the sample was taken.
+    int16_t     x;
+    int16_t     y;
+    int16_t     z;
+};
+
+/**
+  * Configuration of a sensor stream, as held by its control characteristic.
+  */
+struct MicroBitBLESensorStreamConfig
+{
+    uint16_t    decimation;     // Only every nth sample is streamed. Zero or one streams every sample.
+    uint16_t    dropped;        // Number of samples dropped because the connection could not keep up.
+};
+
+/**
+  * Class definition for MicroBitBLESensorStream.
+  *
+  * Buffers timestamped x/y/z samples from a sensor, and streams them over a notify characteristic,
+  * packing as many samples as the negotiated ATT MTU allows into each notification.
+  *
+  * Each notification holds the 16 bit sequence number of its first sample, followed by consecutive
+  * MicroBitBLESensorSample records. Gaps in the sequence numbers mark samples that were dropped.
+  */
+class MicroBitBLESensorStream
+{
+    // The service and characteristic index used to send notifications.
+    MicroBitBLEService      &service;
+    int                     characteristic;
+
+    // Ring buffer of samples waiting to be sent, with the sequence number of each.
+    MicroBitBLESensorSample *samples;
+    uint16_t                *sequences;
+    volatile uint16_t       head;
+    volatile uint16_t       tail;
+
+    // The sequence number of the next sample to be taken.
+    uint16_t                sequence;
+
+    // Number of samples left to skip before the next one is streamed.
+    uint16_t                skip;
+
+    // Set while notifications are being queued, so that they are only queued from one context at a time.
+    volatile bool           sending;
+
+    public:
+
+    // Value of the stream characteristic. This is the content of the most recent notification.
+    uint8_t                         packet[MICROBIT_BLE_SENSOR_STREAM_PACKET_SIZE];
+
+    // Value of the control characteristic.
+    MicroBitBLESensorStreamConfig   config;
+
+    /**
+      * Constructor.
+      *
+      * @param service The service that owns the stream characteristic.
+      * @param characteristic The index of the stream characteristic within the service.
+      */
+    MicroBitBLESensorStream( MicroBitBLEService &service, int characteristic);
+
+    /**
+      * Add a sample to the stream, and send any buffered samples that the connection can accept.
+      * If the buffer is full, the sample is dropped.
+      *
+      * @param x, y, z The value of the sample.
+      */
+    void add( int x, int y, int z);
+
+    /**
+      * Send as many buffered samples as the connection can accept.
+      * Should be called when queued notifications have been sent.
+      */
+    void flush();
+
+    /**
+      * Update the configuration of the stream, following a write to its control characteristic.
+      *
+      * @param data The data written.
+      * @param len The number of bytes written.
+      */
+    void configure( const uint8_t *data, int len);
+
+    /**
+      * Discard all buffered samples, for example when the connection is lost.
+      */
+    void reset();
+};
+
+} // namespace codal
+
+#endif // CONFIG_ENABLED(DEVICE_BLE)
+#endif // MICROBIT_BLE_SENSOR_STREAM_H
@@ -34,6 +34,14 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEService.h"
 #include "MicroBitEvent.h"
 #include "EventModel.h"
+#include "nrf_sdh_ble.h"
+
+// The number of events that can be sent in a single notification.
+#if CONFIG_ENABLED(MICROBIT_BLE_EVENT_BATCH)
+#define MICROBIT_EVENT_SERVICE_PACKET_EVENTS    ((NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3) / 4)
+#else
+#define MICROBIT_EVENT_SERVICE_PACKET_EVENTS    1
+#endif
 
 namespace codal
 {
@@ -87,17 +95,36 @@ class MicroBitEventService : public MicroBitBLEService, MicroBitComponent
 
     private:
 
+    /**
+      * Invoked when notifications have been sent, and there is space to queue more.
+      */
+    void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
+
+    /**
+      * Send as many queued events as the connection can accept.
+      */
+    void sendEvents();
+
     // messageBus we're using.
 	EventModel	        &messageBus;
 
     // memory for our event characteristics.
     EventServiceEvent   clientEventBuffer;
-    EventServiceEvent   microBitEventBuffer;
+    EventServiceEvent   microBitEventBuffer[ MICROBIT_EVENT_SERVICE_PACKET_EVENTS];
     EventServiceEvent   microBitRequirementsBuffer;
     EventServiceEvent   clientRequirementsBuffer;
 
     // Message bus offset last sent to the client...
     uint16_t messageBusListenerOffset;
+
+    // Ring buffer of events waiting to be sent to the client.
+    EventServiceEvent   eventQueue[ MICROBIT_BLE_EVENT_QUEUE_SIZE + 1];
+    volatile uint16_t   eventQueueHead;
+    volatile uint16_t   eventQueueTail;
+
+    // Set while events are being sent, and when another attempt is needed once that completes.
+    volatile bool       sending;
+    volatile bool       sendRequested;
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -33,6 +33,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitBLEManager.h"
 #include "MicroBitBLEService.h"
 #include "MicroBitIO.h"
+#include "EventModel.h"
 
 #define MICROBIT_IO_PIN_SERVICE_PINCOUNT       19
 #define MICROBIT_IO_PIN_SERVICE_DATA_SIZE      10
@@ -99,6 +100,28 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
      */
     void onDataRead( microbit_onDataRead_t *params);
 
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+    /**
+      * Invoked when BLE disconnects.
+      */
+    void onDisconnect( const microbit_ble_evt_t *p_ble_evt);
+
+    /**
+      * Invoked when notifications have been sent, and there is space to queue more.
+      */
+    void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
+
+    /**
+      * Enable edge events on the pins configured as digital inputs, and disable them on any other pins.
+      */
+    void configureEvents();
+
+    /**
+      * Callback. Invoked when a digital input changes.
+      */
+    void pinEvent( MicroBitEvent e);
+#endif
+
     /**
       * Determines if the given pin was configured as a digital pin by the BLE ADPinConfigurationCharacterisitic.
       *
@@ -128,9 +151,10 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
      * For each pin that has changed value, update the BLE characteristic, and NOTIFY our client.
      * @param updateAll if true, a notification will be sent for all registered inputs. Otherwise, 
      * a notification will only be sent for inputs that have changed value.
+     * @param readAnalog if false, analog inputs are not read.
      * @return number of changed pins
      */
-    int updateBLEInputs(bool updateAll = false);
+    int updateBLEInputs(bool updateAll = false, bool readAnalog = true);
 
     /**
       * Edge connector pin
@@ -151,6 +175,13 @@ class MicroBitIOPinService : public MicroBitBLEService, MicroBitComponent
 
     // Historic information about our pin data data.
     uint8_t             ioPinServiceIOData[MICROBIT_IO_PIN_SERVICE_PINCOUNT];
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+    uint32_t            ioPinServiceEventPins;          // Digital inputs reporting changes with edge events.
+    volatile uint32_t   ioPinServiceChangedPins;        // Pins with events since they were last read, or that need to be reported again.
+    CODAL_TIMESTAMP     ioPinServiceAnalogTime;         // Time the analog inputs were last read.
+    volatile bool       ioPinServiceSending;            // A notification is waiting to be sent.
+#endif
     
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -39,13 +39,29 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitComponent.h"
 #include "MicroBitEvent.h"
 #include "EventModel.h"
+#include "nrf_sdh_ble.h"
 
-#define PARTIAL_FLASHING_VERSION 0x01
+#define PARTIAL_FLASHING_VERSION 0x02
 
 // BLE PF Control Codes
 #define REGION_INFO 0x00
 #define FLASH_DATA  0x01
 #define END_OF_TRANSMISSION 0x02
+#define FLASH_STREAM 0x03
+
+// Largest write to the control characteristic, filling a packet at the maximum ATT MTU.
+#define PARTIAL_FLASHING_ATTRSIZE       (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
+
+// FLASH_STREAM flow control
+#define PARTIAL_FLASHING_STREAM_WINDOW  32      // Number of packets the client may send beyond the last one acknowledged.
+#define PARTIAL_FLASHING_STREAM_ACK     8       // Acknowledge after this many packets, if nothing else prompts an acknowledgement sooner.
+#define PARTIAL_FLASHING_STREAM_PAGES   2       // Number of pages buffered, so one can be written to flash while the next arrives.
+
+// States of a FLASH_STREAM page buffer
+#define PARTIAL_FLASHING_PAGE_FREE      0
+#define PARTIAL_FLASHING_PAGE_FILLING   1
+#define PARTIAL_FLASHING_PAGE_READY     2       // Every packet for the page has been received.
+#define PARTIAL_FLASHING_PAGE_WRITING   3       // The page is being erased and written asynchronously.
 
 // BLE Utilities
 #define MICROBIT_STATUS 0xEE
@@ -54,6 +70,19 @@ DEALINGS IN THE SOFTWARE.
 namespace codal
 {
 
+/**
+  * A page of program data received by FLASH_STREAM.
+  */
+struct MicroBitPartialFlashingPage
+{
+    uint32_t            *data;          // Buffer of MICROBIT_CODEPAGESIZE bytes.
+    uint32_t            *address;       // Address of the page in flash.
+    uint16_t            low;            // Offset of the first byte received.
+    uint16_t            high;           // Offset after the last byte received.
+    volatile uint8_t    state;          // One of the PARTIAL_FLASHING_PAGE_ states.
+    int                 handle;         // Handle of the asynchronous write, while the page is being written.
+};
+
 /**
   * Class definition for the custom MicroBit Partial Flash Service.
   * Provides a BLE service to remotely read the memory map and flash the PXT program.
@@ -100,6 +129,40 @@ class MicroBitPartialFlashingService : public MicroBitBLEService
       */
     void flashData(uint8_t *data);
 
+    /**
+      * Process a FLASH_STREAM data packet
+      */
+    void flashStream(uint8_t *data, int len);
+
+    /**
+      * Find the FLASH_STREAM page buffer for the given page, claiming a free one if necessary.
+      * @param reserve - Leave at least one buffer free for data received in order.
+      * @return The page buffer, or NULL if none are free.
+      */
+    MicroBitPartialFlashingPage *streamPage(uint32_t *address, bool reserve);
+
+    /**
+      * Start asynchronous writes of any FLASH_STREAM pages that have been completely received.
+      */
+    void writeStreamPages();
+
+    /**
+      * Notify the client of the FLASH_STREAM packets received.
+      */
+    void sendStreamAck();
+
+    /**
+      * Invoked when a queued flash operation completes.
+      * Releases the buffers of FLASH_STREAM pages that have been written.
+      */
+    void flashCompleteEvent(MicroBitEvent e);
+
+    /**
+      * Record that flashing is under way, so that we boot into BLE mode if it fails,
+      * and erase the MicroPython file system.
+      */
+    void setFlashIncomplete();
+
     // Ensure packets are in order
     uint8_t packetCount = 0;
     uint8_t blockPacketCount = 0;
@@ -108,8 +171,18 @@ class MicroBitPartialFlashingService : public MicroBitBLEService
     uint32_t block[16];
     uint8_t  blockNum = 0;
     uint32_t offset   = 0;
+
+    // FLASH_STREAM state
+    MicroBitFlash flash;
+    MicroBitPartialFlashingPage pages[ PARTIAL_FLASHING_STREAM_PAGES];
+    bool     streaming = false;
+    uint8_t  ackBase = 0;                   // Sequence number of the first packet not yet received.
+    uint32_t ackBitmap = 0;                 // Bit n is set if packet ackBase + 1 + n has been received.
+    uint8_t  ackSent = 0;                   // Value of ackBase when an acknowledgement was last sent.
+    uint32_t streamEnd = 0;                 // Address after the data in every packet before ackBase.
+    uint32_t packetEnd[ PARTIAL_FLASHING_STREAM_WINDOW];   // Address after the data in each packet of the window.
     
-    uint8_t characteristicValue[ 20];
+    uint8_t characteristicValue[ PARTIAL_FLASHING_ATTRSIZE];
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -62,8 +62,8 @@ class MicroBitUARTService : public MicroBitBLEService
 
     uint32_t rxCharacteristicHandle;
 
-    //delimeters used for matching on receive.
-    ManagedString delimeters;
+    //delimeters used for matching on receive, as a set of 256 bits indexed by character.
+    uint32_t delimeters[8];
 
     //a variable used when a user calls the eventAfter() method.
     int rxBuffHeadMatch;
@@ -85,6 +85,11 @@ class MicroBitUARTService : public MicroBitBLEService
       * A callback function for whenever a Bluetooth device consumes our TX Buffer
       */
     void onConfirmation( const microbit_ble_evt_hvc_t *params);
+
+    /**
+      * A callback function for whenever queued notifications have been transmitted
+      */
+    void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
     
     
     /**
@@ -106,12 +111,41 @@ class MicroBitUARTService : public MicroBitBLEService
       */
     void circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition);
 
+    /**
+      * An internal method that copies values from a linear buffer into a circular buffer.
+      *
+      * @param circularBuff a pointer to the destination circular buffer
+      * @param circularBuffSize the size of the circular buffer
+      * @param headPosition the head position in the circular buffer you want to copy to
+      * @param linearBuff a pointer to the source linear buffer
+      * @param length the number of bytes to copy
+      *
+      * @return the new head position in the circular buffer
+      *
+      * @note this method assumes that the circular buffer has space for length bytes
+      */
+    int circularWrite(uint8_t *circularBuff, uint8_t circularBuffSize, uint16_t headPosition, const uint8_t *linearBuff, int length);
+
+    /**
+      * An internal method that builds the set of characters to match against from a string of delimeters.
+      *
+      * @param delimeters the characters to match against
+      * @param set the set of 256 bits to populate, indexed by character
+      */
+    static void buildDelimeterSet(ManagedString delimeters, uint32_t *set);
+
     /**
       * An internal method that sends the next block from the tx buffer.
       * @return true if a block is sent
       */
     bool sendNext();
 
+    /**
+      * Determine whether the connected device has subscribed to the TX characteristic.
+      * @return true if either notifications or indications are enabled.
+      */
+    bool txEnabled();
+
     public:
 
     /**
@@ -159,7 +193,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int putc(char c, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -181,7 +215,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(const uint8_t *buf, int length, MicroBitSerialMode mode = SYNC_SLEEP);
 
@@ -202,7 +236,7 @@ class MicroBitUARTService : public MicroBitBLEService
       *                         device.
       *
       * @return the number of characters written, or MICROBIT_NOT_SUPPORTED if there is
-      *         no connected device, or the connected device has not enabled indications.
+      *         no connected device, or the connected device has not enabled indications or notifications.
       */
     int send(ManagedString s, MicroBitSerialMode mode = SYNC_SLEEP);
 
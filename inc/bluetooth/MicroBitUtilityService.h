@@ -40,6 +40,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitEvent.h"
 #include "EventModel.h"
 #include "MicroBitLog.h"
+#include "MicroBitUtilityTypes.h"
 
 namespace codal
 {
@@ -111,13 +112,22 @@ class MicroBitUtilityService : public MicroBitBLEService
      */
     void onEvent(MicroBitEvent e);
 
+    /**
+     * Invoked when notifications have been sent, and there is space to queue more.
+     * Resume processing a request that was waiting to send its reply.
+     */
+    void onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params);
+
     private:
     // MessageBus we're using
     EventModel          &messageBus;
     MicroBitStorage     &storage;
     MicroBitLog         &log;
 
-    uint8_t characteristicValue[ 20];
+    uint8_t characteristicValue[ MICROBIT_UTILITY_REPLY_SIZE];
+
+    // Set when an event has been raised to process the current request, and it has not yet been handled.
+    volatile bool processPending;
 
     // Index for each charactersitic in arrays of handles and UUIDs
     typedef enum mbbs_cIdx
@@ -146,6 +156,16 @@ class MicroBitUtilityService : public MicroBitBLEService
      * @param yes true to listen, otherwise ignore
      */
     void listen( bool yes);
+
+    /**
+     * Raise an event to process the current request, unless one is already pending.
+     */
+    void scheduleProcess();
+
+    /**
+     * Discard any request from a previous connection.
+     */
+    void reset();
     
     /**
      * Send a reply packet
@@ -26,6 +26,11 @@ DEALINGS IN THE SOFTWARE.
 #define MICROBIT_UTILITY_TYPES_H
 
 #include <stdint.h>
+#include "nrf_sdh_ble.h"
+
+// The largest reply packet, filling a notification at the maximum ATT MTU.
+// Replies are limited to 20 bytes until a larger MTU has been negotiated.
+#define MICROBIT_UTILITY_REPLY_SIZE     (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
 
 /* Define types for the MicroBitUtilityService
  *
@@ -37,6 +42,7 @@ DEALINGS IN THE SOFTWARE.
  * reply_t    - Reply from service to client.
  *              job   (1 byte)          - see below
  *              data  (up to 19 bytes)  - depends on request type
+ *                                      - log data replies may be longer, up to the negotiated ATT MTU - 4 bytes
  *
  * job        - Synchronize requests and replies.
  *              Enables the client to ignore replies to a previous request, and detect missing reply packets.
@@ -57,6 +63,7 @@ DEALINGS IN THE SOFTWARE.
  *              batchlen  (4 bytes)         - unsigned size in bytes to return
  *              length    (4 bytes)         - length of whole file, from request type 1 (Log file length)
  * reply        data      (up to 19 bytes)  - 1 or more reply packets, to total batchlen bytes
+ *                                          - packets are longer (up to ATT MTU - 4 bytes) if a larger MTU has been negotiated
  *
  */
 namespace codal::MicroBitUtility
@@ -65,7 +72,7 @@ namespace codal::MicroBitUtility
     {
         requestTypeNone,
         requestTypeLogLength,           // reply data = 4 bytes log data length
-        requestTypeLogRead              // reply data = up to 19 bytes of log data
+        requestTypeLogRead              // reply data = up to 19 bytes of log data, or more with a larger ATT MTU
     } requestType_t;
 
     typedef struct request_t
@@ -79,7 +86,7 @@ namespace codal::MicroBitUtility
     {
         uint8_t  job;                   // Service cycles low nibble i.e client job + { 0x00, 0x01, 0x02, ..., 0x0E, 0x00, ... }
                                         // low nibble == 0x0F (jobLowERR) indicates error and data = 4 bytes signed integer error
-        uint8_t  data[19];
+        uint8_t  data[ MICROBIT_UTILITY_REPLY_SIZE - 1];
     } reply_t;
     
     typedef enum requestLogFormat
@@ -174,6 +174,29 @@ ManagedString MicroBitFile::read(int size)
     return ManagedString(buff,ret);
 }
 
+/**
+  * Maps the next part of the file, without copying it into RAM.
+  *
+  * @param buffer updated to point to the data, held in FLASH memory.
+  *
+  * @param size the maximum number of bytes to map.
+  *
+  * @return the number of bytes available at buffer, zero at the end of the file, or
+  *         MICROBIT_INVALID_PARAMETER if buffer is invalid, or the size given is less than 0.
+  *
+  * @note The data is only valid until the file system is next modified.
+  */
+int MicroBitFile::map(const uint8_t **buffer, int size)
+{
+    if(fileHandle < 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if(size < 0 || buffer == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    return MicroBitFileSystem::defaultFileSystem->map(fileHandle, buffer, size);
+}
+
 /**
   * Removes this MicroBitFile from the MicroBitFileSystem.
   *
@@ -32,97 +32,298 @@ static uint32_t *defaultScratchPage = (uint32_t *)MICROBIT_DEFAULT_SCRATCH_PAGE;
 
 MicroBitFileSystem* MicroBitFileSystem::defaultFileSystem = NULL;
 
+/**
+  * Hash a file name, for use in a DirectoryIndex.
+  * A 32 bit FNV-1a hash, folded to 16 bits.
+  */
+static uint16_t mbfs_hash(const char *name)
+{
+    uint32_t hash = 2166136261UL;
+
+    for (int i = 0; i < MBFS_FILENAME_LENGTH && name[i]; i++)
+    {
+        hash ^= (uint8_t) name[i];
+        hash *= 16777619UL;
+    }
+
+    return (hash >> 16) ^ (hash & 0xFFFF);
+}
+
+/**
+  * Build the in RAM summary of the file table used for block and page allocation.
+  * Called once the file system is loaded, and whenever the file table is recycled.
+  *
+  * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if there is insufficient memory for the summary.
+  */
+int MicroBitFileSystem::buildAllocationMap()
+{
+    int mapSize = (fileSystemSize + 31) / 32;
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+    if (unusedMap == NULL)
+    {
+        unusedMap = (uint32_t *) malloc(mapSize * sizeof(uint32_t));
+        deletedMap = (uint32_t *) malloc(mapSize * sizeof(uint32_t));
+        pageUsed = (uint8_t *) malloc(pages);
+        pageDeleted = (uint8_t *) malloc(pages);
+
+        if (unusedMap == NULL || deletedMap == NULL || pageUsed == NULL || pageDeleted == NULL)
+        {
+            freeAllocationMap();
+            return MICROBIT_NO_RESOURCES;
+        }
+    }
+
+    memset(unusedMap, 0, mapSize * sizeof(uint32_t));
+    memset(deletedMap, 0, mapSize * sizeof(uint32_t));
+    memset(pageUsed, 0, pages);
+    memset(pageDeleted, 0, pages);
+    deletedBlocks = 0;
+
+    // Treat every block as in use, then apply its actual state.
+    for (uint16_t block = 0; block < fileSystemSize; block++)
+    {
+        pageUsed[block / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)]++;
+        updateAllocationMap(block, MBFS_EOF, fileSystemTable[block]);
+    }
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Release the in RAM summary of the file table.
+  */
+void MicroBitFileSystem::freeAllocationMap()
+{
+    free(unusedMap);
+    free(deletedMap);
+    free(pageUsed);
+    free(pageDeleted);
+
+    unusedMap = NULL;
+    deletedMap = NULL;
+    pageUsed = NULL;
+    pageDeleted = NULL;
+}
+
+/**
+  * Update the in RAM summary of the file table to reflect a change of state of the given block.
+  *
+  * @param block The block being updated.
+  * @param oldValue The previous file table entry of the block.
+  * @param newValue The new file table entry of the block.
+  */
+void MicroBitFileSystem::updateAllocationMap(uint16_t block, uint16_t oldValue, uint16_t newValue)
+{
+    int page = block / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+    uint32_t bit = 1UL << (block % 32);
+
+    if (oldValue == MBFS_UNUSED)
+        unusedMap[block / 32] &= ~bit;
+    else if (oldValue == MBFS_DELETED)
+    {
+        deletedMap[block / 32] &= ~bit;
+        pageDeleted[page]--;
+        deletedBlocks--;
+    }
+    else
+        pageUsed[page]--;
+
+    if (newValue == MBFS_UNUSED)
+        unusedMap[block / 32] |= bit;
+    else if (newValue == MBFS_DELETED)
+    {
+        deletedMap[block / 32] |= bit;
+        pageDeleted[page]++;
+        deletedBlocks++;
+    }
+    else
+        pageUsed[page]++;
+}
+
 /**
   * Allocate a free logical block.
-  * This is chosen at random from the blocks available, to even out the wear on the physical device.
+  * This is chosen from the least worn pages, using a round robin algorithm, to even out the wear on the physical device.
   * @return a valid, unused block address on success, or zero if no space is available.
   */
 uint16_t MicroBitFileSystem::getFreeBlock()
 {
-    // Walk the File Table and allocate the first free block - starting immediately after the last block allocated,
-    // and wrapping around the filesystem space if we reach the end.
-    uint16_t block;
-    uint16_t deletedBlock = 0;
+    int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+    int pages = fileSystemSize / blocksPerPage;
+    uint16_t block = (lastBlockAllocated + 1) % fileSystemSize;
+    int page = block / blocksPerPage;
+
+    // Continue to fill the page holding the last block allocated, so that files remain contiguous in FLASH.
+    // Otherwise, move on to the least worn page that has unused blocks. Pages that are equally worn are used in a round robin fashion.
+    if (block % blocksPerPage == 0 || pageUsed[page] + pageDeleted[page] == blocksPerPage)
+    {
+        int start = (block + blocksPerPage - 1) / blocksPerPage;
 
-    for (block = (lastBlockAllocated + 1) % fileSystemSize; block != lastBlockAllocated; block++)
+        page = -1;
+        for (int i = 0; i < pages; i++)
+        {
+            int index = (start + i) % pages;
+
+            if (pageUsed[index] + pageDeleted[index] < blocksPerPage && (page < 0 || pageErases[index] < pageErases[page]))
+                page = index;
+        }
+    }
+
+    if (page >= 0)
     {
-        if (fileSystemTable[block] == MBFS_UNUSED)
+        // Free pages may have been used as scratch memory. If so, erase the page now, rather than
+        // erasing it (and another page as scratch) as each of its blocks is written.
+        if (pageUsed[page] == 0 && pageDeleted[page] == 0)
+            cleanPage(getBlock(page * blocksPerPage));
+
+        // Prefer an unused block that is already erased, so it can be written without a scratch page.
+        uint16_t candidate = 0;
+        for (block = page * blocksPerPage; block < (page + 1) * blocksPerPage; block++)
         {
-            lastBlockAllocated = block;
-            return block;
+            if (unusedMap[block / 32] & (1UL << (block % 32)))
+            {
+                if (candidate == 0)
+                    candidate = block;
+
+                if (isErased(block))
+                {
+                    candidate = block;
+                    break;
+                }
+            }
         }
 
-        if (fileSystemTable[block] == MBFS_DELETED)
-            deletedBlock = block;
+        lastBlockAllocated = candidate;
+        return candidate;
     }
 
+    // If no blocks are available - either UNUSED or marked as DELETED, then we're out of space and there's nothing we can do.
+    if (deletedBlocks == 0)
+        return 0;
+
     // if no UNUSED blocks are available, try to recycle one marked as DELETED.
-    block = deletedBlock;
+    for (block = 0; deletedMap[block / 32] == 0; block += 32);
+    block += __builtin_ctz(deletedMap[block / 32]);
 
-    // If no blocks are available - either UNUSED or marked as DELETED, then we're out of space and there's nothing we can do.
-    if (block)
+    // recycle the FileTable, such that we can mark all previously deleted blocks as re-usable.
+    // Better to do this in bulk, rather than on a block by block basis to improve efficiency.
+    recycleFileTable();
+
+    // Record the block we just allocated, so we can round-robin around blocks for load balancing.
+    lastBlockAllocated = block;
+
+    return block;
+}
+
+/**
+  * Allocate a free, erased logical block whose block number only has bits set that are also set in the given mask.
+  * Such a block can replace the mask block in a file table entry or directory entry without a FLASH erase.
+  *
+  * @param mask The block number that is being replaced.
+  * @return a valid, unused and erased block on success, or zero if no such block is available.
+  */
+uint16_t MicroBitFileSystem::getFreeBlockWithin(uint16_t mask)
+{
+    int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+    // Walk through each of the block numbers that can be formed by clearing bits of the mask.
+    for (uint16_t block = (mask - 1) & mask; block != 0; block = (block - 1) & mask)
     {
-        // recycle the FileTable, such that we can mark all previously deleted blocks as re-usable.
-        // Better to do this in bulk, rather than on a block by block basis to improve efficiency. 
-        recycleFileTable();
+        if (block < fileSystemSize && (unusedMap[block / 32] & (1UL << (block % 32))))
+        {
+            // Free pages may have been used as scratch memory. Erase the whole page before using it, so that the rest of the page can be used too.
+            if (pageUsed[block / blocksPerPage] == 0 && pageDeleted[block / blocksPerPage] == 0)
+                cleanPage(getPage(block));
 
-        // Record the block we just allocated, so we can round-robin around blocks for load balancing.
-        lastBlockAllocated = block;
+            if (isErased(block))
+                return block;
+        }
     }
 
-    return block;
+    return 0;
+}
+
+/**
+  * Determine if the given block is fully erased, and can therefore be written without an erase.
+  * n.b. UNUSED blocks are not necessarily erased, as free pages are also used as scratch memory.
+  *
+  * @param block A valid block number.
+  * @return true if every byte of the block is erased, false otherwise.
+  */
+bool MicroBitFileSystem::isErased(uint16_t block)
+{
+    uint32_t *address = getBlock(block);
+
+    for (int i = 0; i < MBFS_BLOCK_SIZE / 4; i++)
+        if (address[i] != 0xFFFFFFFF)
+            return false;
+
+    return true;
+}
+
+/**
+  * Erase the given page, if it is not already erased.
+  *
+  * @param page The address of the page.
+  */
+void MicroBitFileSystem::cleanPage(uint32_t *page)
+{
+    for (int i = 0; i < (int)(MICROBIT_CODEPAGESIZE / 4); i++)
+    {
+        if (page[i] != 0xFFFFFFFF)
+        {
+            flash.erase_page(page);
+            return;
+        }
+    }
 }
 
 /**
   * Allocates a free physical page of memory.
-  * This is chosen using a round robin algorithm, to even out the wear on the physical device.
+  * The least worn page is chosen, using a round robin algorithm amongst equally worn pages, to even out the wear on the physical device.
   * @return NULL on error, page address on success
   */
 uint32_t* MicroBitFileSystem::getFreePage()
 {
-    // Walk the file table, starting at the last allocated block, looking for an unused page.
+    // Walk the page summary, starting at the last allocated block, looking for the least worn unused page.
     int blocksPerPage = (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
 
     // get a handle on the next physical page.
     uint16_t currentPage = getBlockNumber(getPage(lastBlockAllocated));
     uint16_t page = (currentPage + blocksPerPage) % fileSystemSize;
+    uint16_t freePage = 0;
     uint16_t recyclablePage = 0;
 
     // Walk around the file table, looking for a free page.
     while (page != currentPage)
     {
-        bool empty = true;
-        bool deleted = false;
-        uint16_t next;
+        int index = page / blocksPerPage;
 
-        for (int i = 0; i < blocksPerPage; i++)
+        // See if we found one...
+        if (pageUsed[index] == 0)
         {
-            next = getNextFileBlock(page + i);
-            
-            if (next == MBFS_DELETED)
-                deleted = true;
-            
-            else if (next != MBFS_UNUSED)
+            if (pageDeleted[index] == 0)
             {
-                empty = false;
-                break;
+                if (!freePage || pageErases[index] < pageErases[freePage / blocksPerPage])
+                    freePage = page;
             }
-        }
 
-        // See if we found one...
-        if (empty)
-        {
-            lastBlockAllocated = page;
-            return getBlock(page);
+            // make note of the least worn unused but un-erased page we find (if any).
+            else if (!recyclablePage || pageErases[index] < pageErases[recyclablePage / blocksPerPage])
+            {
+                recyclablePage = page;
+            }
         }
 
-        // make note of the first unused but un-erased page we find (if any).
-        if (deleted && !recyclablePage)
-            recyclablePage = page;
-
         page = (page + blocksPerPage) % fileSystemSize;
     }
 
+    if (freePage)
+    {
+        lastBlockAllocated = freePage;
+        return getBlock(freePage);
+    }
+
     // No empty pages are available, but we may be able to recycle one.
     if (recyclablePage)
     {
@@ -180,6 +381,16 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
     lastBlockAllocated = 0;
     rootDirectory = NULL;
     openFiles = NULL;
+    directoryIndexes = NULL;
+    unusedMap = NULL;
+    deletedMap = NULL;
+    pageUsed = NULL;
+    pageDeleted = NULL;
+    deletedBlocks = 0;
+    pageErases = NULL;
+    bytesWritten = 0;
+    cachePool = NULL;
+    cachePoolUsed = 0;
 
     // If we have a zero length, then dynamically determine our geometry.
     if (flashStart == 0)
@@ -210,6 +421,27 @@ int MicroBitFileSystem::init(uint32_t flashStart, int flashPages)
         format();
     }
 
+    // Summarise the file table in RAM, to speed up allocation.
+    if (buildAllocationMap() != MICROBIT_OK)
+        return MICROBIT_NO_RESOURCES;
+
+    // Load the number of times each page has been erased, and keep this up to date as pages are erased.
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+    uint16_t *counters = getEraseCounters();
+
+    pageErases = (uint16_t *) malloc(pages * sizeof(uint16_t));
+
+    if (pageErases == NULL)
+    {
+        freeAllocationMap();
+        return MICROBIT_NO_RESOURCES;
+    }
+
+    for (int i = 0; i < pages; i++)
+        pageErases[i] = counters ? ~counters[i] : 0;
+
+    flash.setEraseCounters((uint32_t *)fileSystemTable, pages, pageErases);
+
     // indicate that we have a valid FileSystem
     status = MBFS_STATUS_INITIALISED;
     return MICROBIT_OK;
@@ -238,7 +470,7 @@ int MicroBitFileSystem::load()
 
     rootDirectory = root;
     fileSystemSize = root->length;
-    fileSystemTableSize = calculateFileTableSize();
+    fileSystemTableSize = rootOffset;
 
     return MICROBIT_OK;
 }
@@ -302,6 +534,27 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
     if (directory == NULL)
         directory = rootDirectory;
 
+#if MBFS_DIRECTORY_INDEX_CACHE > 0
+    // If we can, use an index of the directory rather than searching it.
+    DirectoryIndex *index = getDirectoryIndex(directory);
+
+    if (index)
+    {
+        uint16_t hash = mbfs_hash(file);
+        uint16_t slot = hash & (index->size - 1);
+
+        while (index->entry[slot])
+        {
+            if (index->hash[slot] == hash && strcmp(index->entry[slot]->file_name, file) == 0)
+                return index->entry[slot];
+
+            slot = (slot + 1) & (index->size - 1);
+        }
+
+        return NULL;
+    }
+#endif
+
     block = directory->first_block;
     dir = (Directory *) getBlock(block);
     dirent = &dir->entry[0];
@@ -330,6 +583,149 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
     return NULL;
 }
 
+/**
+  * Retrieve the index of the given directory, building it if necessary.
+  *
+  * @param directory The directory to index.
+  * @return The DirectoryIndex of the directory, or NULL if there is insufficient memory to build one.
+  */
+DirectoryIndex* MicroBitFileSystem::getDirectoryIndex(const DirectoryEntry *directory)
+{
+    DirectoryIndex *index = directoryIndexes;
+    DirectoryIndex *prev = NULL;
+    int cached = 0;
+
+    // Look for an existing index, moving it to the front of the chain if we find one.
+    while (index)
+    {
+        if (index->first_block == directory->first_block)
+        {
+            if (prev)
+            {
+                prev->next = index->next;
+                index->next = directoryIndexes;
+                directoryIndexes = index;
+            }
+
+            return index;
+        }
+
+        cached++;
+
+        // If the cache is full, discard the least recently used index.
+        if (index->next == NULL && cached >= MBFS_DIRECTORY_INDEX_CACHE)
+        {
+            if (prev)
+                prev->next = NULL;
+            else
+                directoryIndexes = NULL;
+
+            free(index->hash);
+            free(index->entry);
+            delete index;
+            break;
+        }
+
+        prev = index;
+        index = index->next;
+    }
+
+    // Count the valid entries in the directory, and size a table with at least twice as many slots.
+    // Unused entries are erased FLASH, which also carries the VALID flag, so are recognised by their name.
+    Directory *dir;
+    DirectoryEntry *dirent;
+    uint16_t block;
+    int entries = 0;
+    int size = 8;
+
+    for (block = directory->first_block; block != MBFS_EOF; block = getNextFileBlock(block))
+    {
+        dir = (Directory *) getBlock(block);
+
+        for (dirent = &dir->entry[0]; (uint32_t)(dirent + 1) <= (uint32_t)dir + MBFS_BLOCK_SIZE; dirent++)
+            if ((dirent->flags & MBFS_DIRECTORY_ENTRY_VALID) && dirent->file_name[0] != (char) 0xFF)
+                entries++;
+    }
+
+    while (size < entries * 2)
+        size <<= 1;
+
+    index = new DirectoryIndex;
+    if (index == NULL)
+        return NULL;
+
+    index->first_block = directory->first_block;
+    index->size = size;
+    index->hash = (uint16_t *) malloc(size * sizeof(uint16_t));
+    index->entry = (DirectoryEntry **) malloc(size * sizeof(DirectoryEntry *));
+
+    if (index->hash == NULL || index->entry == NULL)
+    {
+        free(index->hash);
+        free(index->entry);
+        delete index;
+        return NULL;
+    }
+
+    memset(index->entry, 0, size * sizeof(DirectoryEntry *));
+
+    // Populate the table. Where names collide, the first entry in the directory takes precedence, as with a linear search.
+    for (block = directory->first_block; block != MBFS_EOF; block = getNextFileBlock(block))
+    {
+        dir = (Directory *) getBlock(block);
+
+        for (dirent = &dir->entry[0]; (uint32_t)(dirent + 1) <= (uint32_t)dir + MBFS_BLOCK_SIZE; dirent++)
+        {
+            if ((dirent->flags & MBFS_DIRECTORY_ENTRY_VALID) && dirent->file_name[0] != (char) 0xFF)
+            {
+                uint16_t hash = mbfs_hash(dirent->file_name);
+                uint16_t slot = hash & (size - 1);
+
+                while (index->entry[slot])
+                    slot = (slot + 1) & (size - 1);
+
+                index->hash[slot] = hash;
+                index->entry[slot] = dirent;
+            }
+        }
+    }
+
+    index->next = directoryIndexes;
+    directoryIndexes = index;
+
+    return index;
+}
+
+/**
+  * Discard the index of the given directory, if one exists. Must be called whenever entries in the directory change.
+  *
+  * @param directory The directory which has changed.
+  */
+void MicroBitFileSystem::invalidateDirectoryIndex(const DirectoryEntry *directory)
+{
+    DirectoryIndex *index = directoryIndexes;
+    DirectoryIndex *prev = NULL;
+
+    while (index)
+    {
+        if (index->first_block == directory->first_block)
+        {
+            if (prev)
+                prev->next = index->next;
+            else
+                directoryIndexes = index->next;
+
+            free(index->hash);
+            free(index->entry);
+            delete index;
+            return;
+        }
+
+        prev = index;
+        index = index->next;
+    }
+}
+
 /**
   * Determine the number of logical blocks required to hold the file table.
   *
@@ -337,13 +733,54 @@ DirectoryEntry* MicroBitFileSystem::getDirectoryEntry(char const * filename, con
   */
 uint16_t MicroBitFileSystem::calculateFileTableSize()
 {
-    uint16_t size = (fileSystemSize * 2) / MBFS_BLOCK_SIZE;
-    if ((fileSystemSize * 2) % MBFS_BLOCK_SIZE)
+    int bytes = fileSystemSize * 2;
+
+    // Reserve space for the erase counter of each page.
+    if (MBFS_WEAR_LEVELLING)
+        bytes += (fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)) * 2;
+
+    uint16_t size = bytes / MBFS_BLOCK_SIZE;
+    if (bytes % MBFS_BLOCK_SIZE)
         size++;
 
     return size;
 }
 
+/**
+  * Determine the location of the erase counters held at the end of the file table.
+  *
+  * @return A pointer to the erase counter of the first page, or NULL if the file table has no space for erase counters.
+  */
+uint16_t *MicroBitFileSystem::getEraseCounters()
+{
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+
+    // File systems formatted without MBFS_WEAR_LEVELLING have no space reserved.
+    if (fileSystemTableSize * MBFS_BLOCK_SIZE < (fileSystemSize + pages) * 2)
+        return NULL;
+
+    return &fileSystemTable[fileSystemSize];
+}
+
+/**
+  * Determine the value to write to a file table entry when the page holding it is rewritten.
+  * Erase counters are refreshed from RAM. All other entries are unchanged.
+  * Counters are held inverted, so that an erased counter reads as zero.
+  *
+  * @param entry The index of the entry in the file table.
+  * @return The value of the entry.
+  */
+uint16_t MicroBitFileSystem::getTableEntry(int entry)
+{
+    int page = entry - fileSystemSize;
+
+    // Counts saturate, so that a counter is never written as MBFS_DELETED, which is discarded when the file table is recycled.
+    if (page >= 0 && page < fileSystemSize / (int)(MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE) && getEraseCounters())
+        return ~min(pageErases[page], 0xFFFE);
+
+    return fileSystemTable[entry];
+}
+
 /**
   * Retrieve a memory pointer for the start of the physical memory page containing the given block.
   *
@@ -381,6 +818,27 @@ uint16_t MicroBitFileSystem::getNextFileBlock(uint16_t block)
     return fileSystemTable[block];
 }
 
+/**
+  * Determine the block currently holding the data of the given block of an open file.
+  * This differs from the given block only if the block has been relocated, but the file not yet flushed.
+  * Without MBFS_LOG_STRUCTURED, blocks are never relocated, and this is always the given block.
+  *
+  * @param file The open file holding the block.
+  * @param block A valid block number, as recorded in the file table or directory entry.
+  *
+  * @return The block number holding the data of the given block.
+  */
+uint16_t MicroBitFileSystem::getRelocatedBlock(FileDescriptor *file, uint16_t block)
+{
+#if MBFS_LOG_STRUCTURED > 0
+    for (int i = 0; i < file->relocatedCount; i++)
+        if (file->relocatedFrom[i] == block)
+            return file->relocatedTo[i];
+#endif
+
+    return block;
+}
+
 /**
   * Determine the logical block that contains the given address.
   *
@@ -402,7 +860,11 @@ uint16_t MicroBitFileSystem::getBlockNumber(void *address)
   */
 int MicroBitFileSystem::fileTableWrite(uint16_t block, uint16_t value)
 {
+    uint16_t oldValue = fileSystemTable[block];
+
     flash.flash_write(&fileSystemTable[block], &value, 2);
+    updateAllocationMap(block, oldValue, value);
+
     return MICROBIT_OK;
 }
 
@@ -471,6 +933,9 @@ int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
     uint8_t *write = (uint8_t *)scratch;
     uint16_t b = getBlockNumber(page);
 
+    // Free pages may have been used as scratch memory by earlier writes.
+    cleanPage(scratch);
+
     for (int i = 0; i < (int)( MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE); i++)
     {
         // If we have an unused or deleted block, there's nothing to do - allow the block to be recycled.
@@ -502,8 +967,10 @@ int MicroBitFileSystem::recycleBlock(uint16_t block, int type)
             
             for (int entry = 0; entry < MBFS_BLOCK_SIZE / 2; entry++)
             {
-                if (*tableIn != MBFS_DELETED)
-                    flash.flash_write(tableOut, tableIn, 2);
+                uint16_t value = getTableEntry(tableIn - fileSystemTable);
+
+                if (value != MBFS_DELETED)
+                    flash.flash_write(tableOut, &value, 2);
 
                 tableIn++;
                 tableOut++;
@@ -543,7 +1010,8 @@ int MicroBitFileSystem::recycleFileTable()
         if (block % (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE) == 0)
             pageRecycled = false;
 
-        if (fileSystemTable[block] == MBFS_DELETED && !pageRecycled)
+        // Pages holding the FileTable are skipped here, as recycling them upcycles DELETED entries throughout the table.
+        if (fileSystemTable[block] == MBFS_DELETED && !pageRecycled && getPage(block) >= (uint32_t *)rootDirectory)
         {
             recycleBlock(block);
             pageRecycled = true;
@@ -554,7 +1022,8 @@ int MicroBitFileSystem::recycleFileTable()
     for (uint16_t block = 0; getPage(block) < (uint32_t *)rootDirectory; block += MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE)
         recycleBlock(block);
 
-    return MICROBIT_OK;
+    // All DELETED blocks are now UNUSED.
+    return buildAllocationMap();
 }
 
 
@@ -572,6 +1041,9 @@ DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directo
     DirectoryEntry *empty = NULL;
     DirectoryEntry *invalid = NULL;
 
+    // The caller is about to add an entry to this directory, so any index of it will be out of date.
+    invalidateDirectoryIndex(directory);
+
     // Try to find an unused entry in the directory.
     block = directory->first_block;
     dir = (Directory *)getBlock(block);
@@ -591,8 +1063,9 @@ DirectoryEntry* MicroBitFileSystem::createDirectoryEntry(DirectoryEntry *directo
             dirent = &dir->entry[0];
         }
 
-        // If we find an empty slot, use that.
-        if (dirent->flags & MBFS_DIRECTORY_ENTRY_FREE)
+        // If we find an empty slot, use that. n.b. files that have been created but not yet flushed also have the FREE flag set,
+        // but have been allocated a first block.
+        if ((dirent->flags & MBFS_DIRECTORY_ENTRY_FREE) && dirent->first_block == MBFS_UNUSED)
         {
             empty = dirent;
             break;
@@ -782,12 +1255,13 @@ int MicroBitFileSystem::createDirectory(char const *name)
   *  - MB_READ : read from the file.
   *  - MB_WRITE : write to the file.
   *  - MB_CREAT : create a new file, if it doesn't already exist.
+  *  - MB_CACHE : gather small writes in RAM, and write them to FLASH a block at a time.
   *
   * If a file is opened that doesn't exist, and MB_CREAT isn't passed,
   * an error is returned, otherwise the file is created.
   *
   * @param filename name of the file to open, must contain only printable characters.
-  * @param flags One or more of MB_READ, MB_WRITE or MB_CREAT. 
+  * @param flags One or more of MB_READ, MB_WRITE, MB_CREAT or MB_CACHE. 
   * @return return the file handle,MICROBIT_NOT_SUPPORTED if the file system has
   *         not been initialised MICROBIT_INVALID_PARAMETER if the filename is
   *         too large, MICROBIT_NO_RESOURCES if the file system is full.
@@ -866,7 +1340,12 @@ int MicroBitFileSystem::open(char const * filename, uint32_t flags)
     file->seek = (flags & MB_APPEND) ? file->length : 0;
     file->dirent = dirent;
     file->directory = directory;
-    file->cacheLength = 0;
+    file->cache = NULL;
+    file->cursorBlock = dirent->first_block;
+    file->cursorPosition = 0;
+#if MBFS_LOG_STRUCTURED > 0
+    file->relocatedCount = 0;
+#endif
 
     // Add the file descriptor to the chain of open files.
     file->next = openFiles;
@@ -907,8 +1386,11 @@ int MicroBitFileSystem::flush(int fd)
     if(file == NULL)
         return MICROBIT_INVALID_PARAMETER;
 
-    // Flush any data in the writeback cache.
+    // Flush any data in the writeback cache, and link any relocated blocks into the file.
     writeBack(file);
+#if MBFS_LOG_STRUCTURED > 0
+    commitRelocations(file);
+#endif
 
     // If the file has changed size, create an updated directory entry for the file, reflecting it's new length.
     if (file->dirent->length != file->length)
@@ -933,6 +1415,10 @@ int MicroBitFileSystem::flush(int fd)
             flash.flash_write(&file->dirent->flags, &value, 2);
             newDirent = createDirectoryEntry(file->directory);
             flash.flash_write(newDirent, &d, sizeof(DirectoryEntry));
+            invalidateDirectoryIndex(file->directory);
+
+            // Subsequent flushes must update the new directory entry, not the one we have just invalidated.
+            file->dirent = newDirent;
         }
     }
 
@@ -1014,9 +1500,6 @@ int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
 
     if (file == NULL)
         return MICROBIT_INVALID_PARAMETER;
-    
-    // Flush any data in the writeback cache.
-    writeBack(file);
 
     position = file->seek;
 
@@ -1024,12 +1507,12 @@ int MicroBitFileSystem::seek(int fd, int offset, uint8_t flags)
         position = offset;
     
     if(flags == MB_SEEK_END)
-        position = file->length + offset;
+        position = getLength(file) + offset;
     
     if (flags == MB_SEEK_CUR)
         position = file->seek + offset;
     
-    if (position < 0 || (uint32_t)position > file->length)
+    if (position < 0 || (uint32_t)position > getLength(file))
         return MICROBIT_INVALID_PARAMETER;
 
     file->seek = position;
@@ -1068,8 +1551,10 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
 
     uint32_t offset;
     uint32_t position = 0;
+    uint32_t start, end;
     int bytesCopied = 0;
     int segmentLength;
+    int flashLength;
 
     // Protect against accidental re-initialisation
     if ((status & MBFS_STATUS_INITIALISED) == 0)
@@ -1081,54 +1566,232 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
     if (file == NULL || buffer == NULL || size == 0)
         return MICROBIT_INVALID_PARAMETER;
 
-    // Flush any data in the writeback cache before we change the seek pointer.
+    // Validate the read length. Data held in the write cache may extend the file beyond that held in FLASH.
+    size = min(size, getLength(file) - file->seek);
+    flashLength = file->seek < file->length ? min(size, file->length - file->seek) : 0;
+
+    if (flashLength > 0)
+    {
+        // Find the read position.
+        block = getSeekBlock(file);
+        position = file->cursorPosition;
+
+        // Once we have the correct start block, handle the byte offset.
+        offset = file->seek - position;
+
+        // Now, start copying bytes into the requested buffer.
+        writePointer = buffer;
+        while (bytesCopied < flashLength)
+        {
+            // First, determine if we need to write a partial block.
+            readPointer = (uint8_t *)getBlock(block) + offset;
+            segmentLength = min(flashLength - bytesCopied, MBFS_BLOCK_SIZE - offset);
+
+            if(segmentLength > 0)
+                memcpy(writePointer, readPointer, segmentLength);
+
+            bytesCopied += segmentLength;
+            writePointer += segmentLength;
+            offset += segmentLength;
+
+            // Only step onto the next block if there is more to read, as the last block of the file has no successor.
+            if (offset == MBFS_BLOCK_SIZE && bytesCopied < flashLength)
+            {
+                block = getRelocatedBlock(file, getNextFileBlock(block));
+                position += MBFS_BLOCK_SIZE;
+                offset = 0;
+            }
+        }
+
+        file->cursorBlock = block;
+        file->cursorPosition = position;
+    }
+
+    // Overlay any unwritten data held in the write cache, which is more recent than that held in FLASH.
+    if (file->cache)
+    {
+        start = max(file->seek, file->cachePosition + file->cacheStart);
+        end = min(file->seek + size, file->cachePosition + file->cacheEnd);
+
+        if (start < end)
+            memcpy(buffer + (start - file->seek), file->cache + (start - file->cachePosition), end - start);
+    }
+
+    file->seek += size;
+
+    return size;
+}
+
+/**
+  * Map data from the file, without copying it.
+  *
+  * Files are held in FLASH memory, which is directly addressable. Rather than copying data into a buffer
+  * as read() does, map() provides a pointer to the data at the current seek position of the file, held in FLASH.
+  * The data is returned as a series of extents, each covering as many of the following bytes of the file
+  * as are stored contiguously in FLASH. On each invocation the seek position of the file handle is incremented
+  * by the length of the extent returned, so calling map() repeatedly iterates over the extents of the file.
+  *
+  * @param fd File handle, obtained with open()
+  * @param buffer Updated to point to the start of the extent.
+  * @param size maximum number of bytes to map
+  * @return length of the extent in bytes on success, zero at the end of the file, MICROBIT_NOT_SUPPORTED if the file
+  *         system is not initialised, MICROBIT_INVALID_PARAMETER if the given file handle is invalid.
+  *
+  * @note The data is only valid until the file system is next modified, as data may then be moved or erased.
+  *
+  * @code
+  * MicroBitFileSystem f;
+  * const uint8_t *data;
+  * int fd = f.open("sound.raw", MB_READ);
+  * int length;
+  *
+  * while ((length = f.map(fd, &data, 1024)) > 0)
+  *    play(data, length);
+  * @endcode
+  */
+int MicroBitFileSystem::map(int fd, const uint8_t** buffer, int size)
+{
+    FileDescriptor *file;
+    uint16_t block;
+    uint16_t next;
+    int length;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    // Ensure the file is open.
+    file = getFileDescriptor(fd);
+
+    if (file == NULL || buffer == NULL || size <= 0)
+        return MICROBIT_INVALID_PARAMETER;
+
+    // Data held in the write cache is not yet in FLASH, so write it back first.
     writeBack(file);
 
-    // Validate the read length.
+    // Validate the map length.
     size = min(size, file->length - file->seek);
+    *buffer = NULL;
+
+    if (size <= 0)
+        return 0;
 
-    // Find the read position.
-    block = file->dirent->first_block; 
+    // Find the map position. If the cursor is on the block ending at the seek position, step onto the next block.
+    block = getSeekBlock(file);
 
-    // Walk the file table until we reach the start block
-    while (file->seek - position > MBFS_BLOCK_SIZE)
+    if (file->seek - file->cursorPosition == MBFS_BLOCK_SIZE)
     {
-        block = getNextFileBlock(block);
-        position += MBFS_BLOCK_SIZE;
+        block = getRelocatedBlock(file, getNextFileBlock(block));
+        file->cursorPosition += MBFS_BLOCK_SIZE;
     }
 
-    // Once we have the correct start block, handle the byte offset.
-    offset = file->seek - position;
+    *buffer = (uint8_t *)getBlock(block) + (file->seek - file->cursorPosition);
+    length = MBFS_BLOCK_SIZE - (file->seek - file->cursorPosition);
 
-    // Now, start copying bytes into the requested buffer.
-    writePointer = buffer;
-    while (bytesCopied < size)
+    // Extend the extent over any following blocks of the file that are adjacent in FLASH.
+    while (length < size)
     {
-        // First, determine if we need to write a partial block.
-        readPointer = (uint8_t *)getBlock(block) + offset;
-        segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
+        next = getRelocatedBlock(file, getNextFileBlock(block));
 
-        if(segmentLength > 0)
-            memcpy(writePointer, readPointer, segmentLength);
+        if (next != block + 1)
+            break;
 
-        bytesCopied += segmentLength;
-        writePointer += segmentLength;
-        offset += segmentLength;
+        block = next;
+        file->cursorPosition += MBFS_BLOCK_SIZE;
+        length += MBFS_BLOCK_SIZE;
+    }
+
+    length = min(length, size);
 
-        if (offset == MBFS_BLOCK_SIZE)
+    file->seek += length;
+    file->cursorBlock = block;
+
+    return length;
+}
+
+/**
+  * Determine the block holding the current seek position of the given file, moving its cursor forward
+  * through the block chain as necessary. The file table is only walked from the first block of the file
+  * if the seek position has moved behind the cursor.
+  *
+  * @param file File descriptor to locate.
+  * @return The block number containing the seek position. The position of the start of this block is held in file->cursorPosition.
+  */
+uint16_t MicroBitFileSystem::getSeekBlock(FileDescriptor *file)
+{
+    // If we have moved backwards, start again from the beginning of the file.
+    if (file->cursorPosition > file->seek)
+    {
+        file->cursorBlock = getRelocatedBlock(file, file->dirent->first_block);
+        file->cursorPosition = 0;
+    }
+
+    // Walk the file table until we reach the block holding the seek position.
+    while (file->seek - file->cursorPosition > MBFS_BLOCK_SIZE)
+    {
+        file->cursorBlock = getRelocatedBlock(file, getNextFileBlock(file->cursorBlock));
+        file->cursorPosition += MBFS_BLOCK_SIZE;
+    }
+
+    return file->cursorBlock;
+}
+
+/**
+  * Determine the length of the given file, including any data held in its write cache.
+  *
+  * @param file File descriptor of the file.
+  * @return The length of the file, in bytes.
+  */
+uint32_t MicroBitFileSystem::getLength(FileDescriptor *file)
+{
+    if (file->cache)
+        return max(file->length, file->cachePosition + file->cacheEnd);
+
+    return file->length;
+}
+
+/**
+  * Lend a block sized buffer from the shared pool to the given file, to cache writes to the block at the given position.
+  *
+  * @param file File descriptor of the file.
+  * @param position The file position of the start of the block to be cached.
+  * @return MICROBIT_OK on success, or MICROBIT_NO_RESOURCES if no buffer is available.
+  */
+int MicroBitFileSystem::allocateCache(FileDescriptor *file, uint32_t position)
+{
+    int i;
+
+    if (MBFS_CACHE_BLOCKS == 0)
+        return MICROBIT_NO_RESOURCES;
+
+    // The pool is only allocated once a file first uses it.
+    if (cachePool == NULL)
+    {
+        cachePool = (uint8_t *) malloc(MBFS_CACHE_BLOCKS * MBFS_BLOCK_SIZE);
+        if (cachePool == NULL)
+            return MICROBIT_NO_RESOURCES;
+    }
+
+    for (i = 0; i < MBFS_CACHE_BLOCKS; i++)
+    {
+        if (!(cachePoolUsed & (1 << i)))
         {
-            block = getNextFileBlock(block);
-            offset = 0;
+            cachePoolUsed |= (1 << i);
+
+            file->cache = cachePool + i * MBFS_BLOCK_SIZE;
+            file->cachePosition = position;
+            file->cacheStart = file->seek - position;
+            file->cacheEnd = file->cacheStart;
+
+            return MICROBIT_OK;
         }
     }
 
-    file->seek += bytesCopied;
-
-    return bytesCopied;
+    return MICROBIT_NO_RESOURCES;
 }
 
 /**
-  * Flush a given file's cache back to FLASH memory.
+  * Flush a given file's cache back to FLASH memory, and return its buffer to the shared pool.
   *
   * @param file File descriptor to flush.
   * @return The number of bytes written.
@@ -1136,14 +1799,25 @@ int MicroBitFileSystem::read(int fd, uint8_t* buffer, int size)
   */
 int MicroBitFileSystem::writeBack(FileDescriptor *file)
 {
-    if (file->cacheLength)
+    uint32_t seek;
+    int r = 0;
+
+    if (file->cache)
     {
-        int r = writeBuffer(file, file->cache, file->cacheLength);
-        file->cacheLength = 0;
-        return r;
+        // Write the cached data at the position it was written to, leaving the seek position unchanged.
+        if (file->cacheEnd > file->cacheStart)
+        {
+            seek = file->seek;
+            file->seek = file->cachePosition + file->cacheStart;
+            r = writeBuffer(file, file->cache + file->cacheStart, file->cacheEnd - file->cacheStart);
+            file->seek = seek;
+        }
+
+        cachePoolUsed &= ~(1 << ((file->cache - cachePool) / MBFS_BLOCK_SIZE));
+        file->cache = NULL;
     }
 
-    return 0;
+    return r;
 }
 
 /**
@@ -1164,15 +1838,9 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
     int bytesCopied = 0;
     int segmentLength;
 
-    // Find the read position.
-    block = file->dirent->first_block;
-
-    // Walk the file table until we reach the start block
-    while (file->seek - position > MBFS_BLOCK_SIZE)
-    {
-        block = getNextFileBlock(block);
-        position += MBFS_BLOCK_SIZE;
-    }
+    // Find the write position.
+    block = getSeekBlock(file);
+    position = file->cursorPosition;
 
     // Once we have the correct start block, handle the byte offset.
     offset = file->seek - position;
@@ -1186,7 +1854,20 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
         segmentLength = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
 
         if (segmentLength != 0)
-            flash.flash_write(writePointer, readPointer, segmentLength, file->seek + bytesCopied < file->length ? getFreePage() : NULL);
+        {
+            newBlock = 0;
+
+#if MBFS_LOG_STRUCTURED > 0
+            // Rather than erasing FLASH to overwrite existing data, write an updated copy of the block elsewhere.
+            if (flash.need_erase(readPointer, writePointer, segmentLength))
+                newBlock = relocateBlock(file, block, offset, readPointer, segmentLength);
+#endif
+
+            if (newBlock)
+                block = newBlock;
+            else
+                flash.flash_write(writePointer, readPointer, segmentLength, file->seek + bytesCopied < file->length ? getFreePage() : NULL);
+        }
 
         offset += segmentLength;
         bytesCopied += segmentLength;
@@ -1194,14 +1875,22 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
 
         if (offset == MBFS_BLOCK_SIZE && bytesCopied < size)
         {
-            newBlock = getFreeBlock();
-            if (newBlock == 0)
-                break;
+            // If we are overwriting existing data, continue into the next block of the file.
+            // Otherwise, extend the file with a new block.
+            newBlock = getRelocatedBlock(file, getNextFileBlock(block));
 
-            fileTableWrite(newBlock, MBFS_EOF);
-            fileTableWrite(block, newBlock);
+            if (newBlock == MBFS_EOF)
+            {
+                newBlock = getFreeBlock();
+                if (newBlock == 0)
+                    break;
+
+                fileTableWrite(newBlock, MBFS_EOF);
+                fileTableWrite(block, newBlock);
+            }
 
             block = newBlock;
+            position += MBFS_BLOCK_SIZE;
 
             writePointer = (uint8_t *)getBlock(block);
             offset = 0;
@@ -1211,10 +1900,212 @@ int MicroBitFileSystem::writeBuffer(FileDescriptor *file, uint8_t *buffer, int s
     // update the filelength metadata and seek position such that multiple writes are sequential.
     file->length = max(file->length, file->seek + bytesCopied);
     file->seek += bytesCopied;
+    file->cursorBlock = block;
+    file->cursorPosition = position;
 
     return bytesCopied;
 }
 
+#if MBFS_LOG_STRUCTURED > 0
+/**
+  * Write data over part of an existing block of a file, without erasing FLASH memory.
+  * A copy of the block with the given data applied is written to a free block, which replaces
+  * the original in the file when the file is next flushed.
+  *
+  * @param file FileDescriptor of the file to write
+  * @param block The block of the file being written to.
+  * @param offset The offset into the block to write to.
+  * @param buffer The start of the buffer to write
+  * @param length The number of bytes to write. Must not extend beyond the end of the block.
+  * @return The block now holding the data, or zero if the block could not be relocated.
+  */
+uint16_t MicroBitFileSystem::relocateBlock(FileDescriptor *file, uint16_t block, uint32_t offset, uint8_t *buffer, int length)
+{
+    uint16_t newBlock;
+    uint32_t data[4];
+    int i;
+
+    // Determine if this block is itself a copy of a block relocated earlier.
+    for (i = 0; i < file->relocatedCount; i++)
+        if (file->relocatedTo[i] == block)
+            break;
+
+    // If we have no space to record another relocation, update the file table now.
+    if (i == MBFS_LOG_STRUCTURED)
+    {
+        commitRelocations(file);
+        i = 0;
+    }
+
+    // Ideally, choose a block that can later be linked in place of the original by only clearing bits.
+    newBlock = getFreeBlockWithin(i < file->relocatedCount ? file->relocatedFrom[i] : block);
+
+    // Otherwise, take the next free block. Skip over any pages that have been used as scratch memory.
+    for (int attempts = 0; newBlock == 0 && attempts <= (int)(MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE); attempts++)
+    {
+        newBlock = getFreeBlock();
+
+        if (newBlock == 0)
+            return 0;
+
+        if (!isErased(newBlock))
+            newBlock = 0;
+    }
+
+    if (newBlock == 0)
+        return 0;
+
+    // Write the updated contents of the block to its replacement, a few words at a time.
+    uint8_t *source = (uint8_t *)getBlock(block);
+    uint8_t *destination = (uint8_t *)getBlock(newBlock);
+
+    for (int position = 0; position < MBFS_BLOCK_SIZE; position += sizeof(data))
+    {
+        memcpy(data, source + position, sizeof(data));
+
+        for (int j = max(position, offset); j < min(position + sizeof(data), offset + length); j++)
+            ((uint8_t *)data)[j - position] = buffer[j - offset];
+
+        flash.flash_burn((uint32_t *)(destination + position), data, sizeof(data) / 4);
+    }
+
+    // Give the new block the same successor as the original. This also protects it from being recycled.
+    fileTableWrite(newBlock, getNextFileBlock(block));
+
+    // If we replaced an earlier copy, that copy is no longer needed.
+    if (i < file->relocatedCount)
+    {
+        fileTableWrite(block, MBFS_DELETED);
+    }
+    else
+    {
+        file->relocatedFrom[i] = block;
+        file->relocatedCount++;
+    }
+
+    file->relocatedTo[i] = newBlock;
+
+    return newBlock;
+}
+
+/**
+  * Relink the file table and directory entry of a file to any blocks that have been relocated,
+  * and mark the blocks they replace for deletion.
+  *
+  * @param file FileDescriptor of the file to update.
+  * @return MICROBIT_OK on success.
+  */
+int MicroBitFileSystem::commitRelocations(FileDescriptor *file)
+{
+    uint16_t block, next, head;
+    uint16_t link[MBFS_LOG_STRUCTURED];
+    uint16_t value[MBFS_LOG_STRUCTURED];
+    uint16_t data[8];
+    int links = 0;
+
+    if (file->relocatedCount == 0)
+        return MICROBIT_OK;
+
+    // If the start of the file has moved, update its directory entry.
+    // Where this can't be done by only clearing bits, replace the directory entry with a fresh one.
+    head = getRelocatedBlock(file, file->dirent->first_block);
+
+    if (head != file->dirent->first_block)
+    {
+        DirectoryEntry *newDirent = NULL;
+
+        if (flash.need_erase((uint8_t *)&head, (uint8_t *)&file->dirent->first_block, 2))
+            newDirent = createDirectoryEntry(file->directory);
+
+        if (newDirent)
+        {
+            DirectoryEntry d = *file->dirent;
+            uint16_t deleted = MBFS_DELETED;
+
+            d.first_block = head;
+            flash.flash_write(newDirent, &d, sizeof(DirectoryEntry));
+            flash.flash_write(&file->dirent->flags, &deleted, 2);
+            invalidateDirectoryIndex(file->directory);
+
+            file->dirent = newDirent;
+        }
+        else
+        {
+            flash.flash_write(&file->dirent->first_block, &head, 2);
+        }
+    }
+
+    // Walk the file, recording each file table entry that refers to a block that has since been relocated.
+    // Those that can be updated by only clearing bits are written immediately.
+    block = head;
+    while (block != MBFS_EOF)
+    {
+        next = getRelocatedBlock(file, getNextFileBlock(block));
+
+        if (next != getNextFileBlock(block))
+        {
+            if (flash.need_erase((uint8_t *)&next, (uint8_t *)&fileSystemTable[block], 2))
+            {
+                link[links] = block;
+                value[links] = next;
+                links++;
+            }
+            else
+            {
+                fileTableWrite(block, next);
+            }
+        }
+
+        block = next;
+    }
+
+    // Apply all remaining updates to each affected page of the file table with a single erase, via a scratch page.
+    for (int i = 0; i < links; i++)
+    {
+        if (link[i] == MBFS_EOF)
+            continue;
+
+        uint32_t *page = getPage(getBlockNumber(&fileSystemTable[link[i]]));
+        uint32_t *scratch = getFreePage();
+        uint16_t *entries = (uint16_t *)page;
+
+        cleanPage(scratch);
+
+        for (int position = 0; position < (int)(MICROBIT_CODEPAGESIZE / 2); position += 8)
+        {
+            for (int j = 0; j < 8; j++)
+                data[j] = getTableEntry(entries - fileSystemTable + position + j);
+
+            for (int j = i; j < links; j++)
+            {
+                int entry = &fileSystemTable[link[j]] - entries;
+
+                if (link[j] != MBFS_EOF && entry >= position && entry < position + 8)
+                {
+                    data[entry - position] = value[j];
+                    updateAllocationMap(link[j], fileSystemTable[link[j]], value[j]);
+                    link[j] = MBFS_EOF;
+                }
+            }
+
+            flash.flash_burn(scratch + position / 2, (uint32_t *)data, sizeof(data) / 4);
+        }
+
+        flash.erase_page(page);
+        flash.flash_burn(page, scratch, MICROBIT_CODEPAGESIZE / 4);
+        flash.erase_page(scratch);
+    }
+
+    // The original blocks are no longer referenced, and are reclaimed when the file table is next recycled.
+    for (int i = 0; i < file->relocatedCount; i++)
+        fileTableWrite(file->relocatedFrom[i], MBFS_DELETED);
+
+    file->relocatedCount = 0;
+
+    return MICROBIT_OK;
+}
+#endif
+
 /**
   * Determines if the given filename is a valid filename for use in MicroBitFileSystem. 
   * valid filenames must be >0 characters in lenght, NULL temrinated and contain
@@ -1265,6 +2156,8 @@ bool MicroBitFileSystem::isValidFilename(const char *name)
 int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
 {
     FileDescriptor *file;
+    uint32_t position;
+    uint32_t offset;
     int bytesCopied = 0;
     int segmentSize;
 
@@ -1278,32 +2171,46 @@ int MicroBitFileSystem::write(int fd, uint8_t* buffer, int size)
     if (file == NULL || buffer == NULL || size == 0)
         return MICROBIT_INVALID_PARAMETER;
 
-    // Determine how to handle the write. If the buffer size is less than our cache size, 
-    // write the data via the cache. Otherwise, a direct write through is likely more efficient.
-    // This may take a few iterations if the cache is already quite full.
-    if (size < MBFS_CACHE_SIZE)
+    // Determine how to handle the write. If the file was opened with MB_CACHE and the buffer is smaller than a block,
+    // gather the data in the write cache, so that each block is written to FLASH once it is complete rather than once per write.
+    // Otherwise, a direct write through is likely more efficient.
+    if ((file->flags & MB_CACHE) && size < MBFS_BLOCK_SIZE)
     {
         while (bytesCopied < size)
         {
-            segmentSize = min(size, MBFS_CACHE_SIZE - file->cacheLength);
-            memcpy(&file->cache[file->cacheLength], buffer, segmentSize);
+            position = file->seek - (file->seek % MBFS_BLOCK_SIZE);
+            offset = file->seek - position;
 
-            file->cacheLength += segmentSize;
-            bytesCopied += segmentSize;
-            
-            if (file->cacheLength == MBFS_CACHE_SIZE)
+            // The cache holds a single contiguous range of a single block, so write back the cache if we have moved elsewhere.
+            if (file->cache && (file->cachePosition != position || offset < file->cacheStart || offset > file->cacheEnd))
                 writeBack(file);
 
+            // If the shared pool is exhausted, write the remaining data directly.
+            if (file->cache == NULL && allocateCache(file, position) != MICROBIT_OK)
+                break;
+
+            segmentSize = min(size - bytesCopied, MBFS_BLOCK_SIZE - offset);
+            memcpy(file->cache + offset, buffer + bytesCopied, segmentSize);
 
+            file->cacheEnd = max(file->cacheEnd, offset + segmentSize);
+            file->seek += segmentSize;
+            bytesCopied += segmentSize;
         }
 
-        return bytesCopied;
+        if (bytesCopied == size)
+        {
+            bytesWritten += bytesCopied;
+            return bytesCopied;
+        }
     }
 
-    // If we have a relatively large block, then write it directly (
+    // If we have a relatively large block, then write it directly.
     writeBack(file);
 
-    return writeBuffer(file, buffer, size);
+    bytesCopied += writeBuffer(file, buffer + bytesCopied, size - bytesCopied);
+    bytesWritten += bytesCopied;
+
+    return bytesCopied;
 }
 
 /**
@@ -1345,6 +2252,7 @@ int MicroBitFileSystem::remove(char const * filename)
     // Mark the directory entry of this file as invalid.
     value = MBFS_DIRECTORY_ENTRY_DELETED;
     flash.flash_write(&file->dirent->flags, &value, 2);
+    invalidateDirectoryIndex(file->directory);
 
     // release file metadata
     delete file;
@@ -1352,3 +2260,48 @@ int MicroBitFileSystem::remove(char const * filename)
     return MICROBIT_OK;
 }
 
+/**
+  * Report the wear on the physical pages of the file system.
+  *
+  * @param stats The statistics to populate.
+  * @return MICROBIT_OK on success, MICROBIT_NOT_SUPPORTED if the file system has not been initialised,
+  *         or MICROBIT_INVALID_PARAMETER if stats is NULL.
+  *
+  * @code
+  * MicroBitFileSystem f;
+  * FileSystemStatistics stats;
+  * f.getStatistics(&stats);
+  * @endcode
+  */
+int MicroBitFileSystem::getStatistics(FileSystemStatistics *stats)
+{
+    int pages = fileSystemSize / (MICROBIT_CODEPAGESIZE / MBFS_BLOCK_SIZE);
+    uint32_t total = 0;
+
+    // Protect against accidental re-initialisation
+    if ((status & MBFS_STATUS_INITIALISED) == 0)
+        return MICROBIT_NOT_SUPPORTED;
+
+    if (stats == NULL)
+        return MICROBIT_INVALID_PARAMETER;
+
+    stats->minimumEraseCount = 0xFFFF;
+    stats->maximumEraseCount = 0;
+
+    for (int i = 0; i < pages; i++)
+    {
+        stats->minimumEraseCount = min(stats->minimumEraseCount, pageErases[i]);
+        stats->maximumEraseCount = max(stats->maximumEraseCount, pageErases[i]);
+        total += pageErases[i];
+    }
+
+    if (pages == 0)
+        stats->minimumEraseCount = 0;
+
+    stats->meanEraseCount = pages ? total / pages : 0;
+    stats->bytesWritten = bytesWritten;
+    stats->bytesProgrammed = flash.getWordsWritten() * 4;
+    stats->writeAmplification = bytesWritten ? (uint32_t)(((uint64_t)stats->bytesProgrammed * 100) / bytesWritten) : 0;
+
+    return MICROBIT_OK;
+}
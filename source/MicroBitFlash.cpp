@@ -22,6 +22,8 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitConfig.h"
 #include "MicroBitFlash.h"
 #include "MicroBitDevice.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
 #include "ErrorNo.h"                
 
 #ifdef SOFTDEVICE_PRESENT
@@ -58,7 +60,126 @@ extern "C" void btle_set_user_evt_handler(void (*func)(uint32_t));
 //#pragma GCC diagnostic pop
 //#endif
 
-static volatile bool flash_op_complete = false;
+//
+// A queued FLASH operation. Erase operations have no buffer.
+//
+struct MicroBitFlashOperation
+{
+    uint32_t *address;
+    uint32_t *buffer;
+    int length;
+    bool notify;
+};
+
+static MicroBitFlashOperation flash_queue[MICROBIT_FLASH_QUEUE_SIZE];
+
+// Handles of the last operation queued and the last operation completed. Operations complete in the order they are queued.
+static volatile uint16_t flash_op_queued = 0;
+static volatile uint16_t flash_op_completed = 0;
+
+// Set while the SoftDevice is performing the operation at the head of the queue on our behalf.
+static volatile bool flash_op_in_progress = false;
+
+/**
+  * Perform the given operation directly on the NVMC. The CPU is stalled by the NVMC whilst this takes place.
+  */
+static void flash_nvmc_operation(MicroBitFlashOperation *op)
+{
+    if (op->buffer == NULL)
+    {
+        // Turn on flash erase enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
+
+        // Erase page:
+        NRF_NVMC->ERASEPAGE = (uint32_t)op->address;
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
+    }
+    else
+    {
+        // Turn on flash write enable and wait until the NVMC is ready:
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+
+        for(int i=0;i<op->length;i++)
+        {
+            *(op->address+i) = *(op->buffer+i);
+            while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+        }
+    }
+
+    // Turn off flash write enable and wait until the NVMC is ready:
+    NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+    while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+}
+
+/**
+  * Mark the operation at the head of the queue as complete, and notify anyone waiting for it.
+  */
+static void flash_operation_complete()
+{
+    MicroBitFlashOperation *op = &flash_queue[(uint16_t)(flash_op_completed + 1) % MICROBIT_FLASH_QUEUE_SIZE];
+
+    flash_op_in_progress = false;
+    flash_op_completed = flash_op_completed + 1;
+
+    if (op->notify)
+        Event(MICROBIT_ID_FLASH, flash_op_completed);
+}
+
+/**
+  * Start processing the queue of FLASH operations, if it is not already in progress.
+  *
+  * When the SoftDevice is running, the operation at the head of the queue is scheduled with it and
+  * completes asynchronously, via the SoC event handler. Otherwise, operations are performed immediately.
+  */
+static void flash_start_next()
+{
+    while (1)
+    {
+        target_disable_irq();
+
+        if (flash_op_completed == flash_op_queued || flash_op_in_progress)
+        {
+            target_enable_irq();
+            return;
+        }
+
+        MicroBitFlashOperation *op = &flash_queue[(uint16_t)(flash_op_completed + 1) % MICROBIT_FLASH_QUEUE_SIZE];
+        flash_op_in_progress = true;
+
+        target_enable_irq();
+
+#ifdef SOFTDEVICE_PRESENT
+        if (ble_running())
+        {
+            uint32_t result;
+
+            if (op->buffer == NULL)
+                result = sd_flash_page_erase(((uint32_t)op->address)/MICROBIT_CODEPAGESIZE);
+            else
+                result = sd_flash_write(op->address, op->buffer, op->length);
+
+            // The operation will complete via the SoC event handler.
+            if (result == NRF_SUCCESS)
+                return;
+
+            // If the SoftDevice is busy with another FLASH operation, try again when that operation completes.
+            if (result == NRF_ERROR_BUSY)
+            {
+                flash_op_in_progress = false;
+                return;
+            }
+
+            // Otherwise, the operation is invalid. Discard it, so that nothing waits for it indefinitely.
+        }
+        else
+#endif
+        flash_nvmc_operation(op);
+
+        flash_operation_complete();
+    }
+}
 
 /*
  * When SoftDevice is present,
@@ -70,8 +191,15 @@ static volatile bool flash_op_complete = false;
 
 static void nvmc_event_handler(uint32_t sys_evt, void *)
 {
-    if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS)
-        flash_op_complete = true;
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS && flash_op_in_progress)
+        flash_operation_complete();
+
+    // The SoftDevice could not find time to perform the operation. Schedule it again.
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)
+        flash_op_in_progress = false;
+
+    if (sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS || sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)
+        flash_start_next();
 }
 
 NRF_SDH_SOC_OBSERVER( microbitflash_soc_observer, 0, nvmc_event_handler, NULL);
@@ -83,6 +211,10 @@ NRF_SDH_SOC_OBSERVER( microbitflash_soc_observer, 0, nvmc_event_handler, NULL);
   */
 MicroBitFlash::MicroBitFlash()
 {
+    eraseCountStart = NULL;
+    eraseCountPages = 0;
+    eraseCounts = NULL;
+    wordsWritten = 0;
 }
 
 /**
@@ -102,96 +234,227 @@ int MicroBitFlash::need_erase(uint8_t* source, uint8_t* flash_addr, int len)
     // O & ~N != 0
     // Where O = original, and N = new byte.
 
+    // Check any leading bytes, until the FLASH address is word aligned.
+    for(;len>0 && ((uint32_t)flash_addr & 0x03);len--)
+    {
+        if((~*(flash_addr++) & *(source++)) != 0x00) return 1;
+    }
+
+    // Then check a word at a time. The source need not be word aligned.
+    for(;len>=4;len-=4)
+    {
+        uint32_t word;
+        memcpy(&word, source, 4);
+
+        if((~*(uint32_t *)flash_addr & word) != 0x00) return 1;
+
+        flash_addr += 4;
+        source += 4;
+    }
+
+    // Finally, check any trailing bytes.
     for(;len>0;len--)
     {
         if((~*(flash_addr++) & *(source++)) != 0x00) return 1;
     }
+
     return 0;
 }
 
 /**
-  * Erase an entire page
-  * @param page_address address of first word of page
+  * Determine if the calling context is able to wait for a FLASH operation by yielding to other fibers.
   */
-void MicroBitFlash::erase_page(uint32_t* pg_addr)
+static bool flash_can_yield()
 {
-#ifdef SOFTDEVICE_PRESENT
-    if (ble_running())
-    {
-        flash_op_complete = false;
-        while(1)
-        {
-            if (sd_flash_page_erase(((uint32_t)pg_addr)/MICROBIT_CODEPAGESIZE) == NRF_SUCCESS)
-                break;
+    return fiber_scheduler_running() && __get_IPSR() == 0;
+}
 
-            system_timer_wait_ms(10);
-        }
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else
-#endif
-    {
-        // Turn on flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Een);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
+/**
+  * Add an operation to the queue of FLASH operations, and start processing the queue.
+  * If the queue is full, this waits for space to become available.
+  *
+  * @param address The address to erase or write to.
+  * @param buffer The data to write, or NULL to erase the page at the given address.
+  * @param length The number of words to write.
+  * @param notify true to raise an event when the operation completes. Events are also raised for any operation a fiber is waiting on.
+  *               Only asynchronous operations are notified, so only their callers may yield while waiting for space.
+  * @return A handle for the operation.
+  */
+int MicroBitFlash::queue(uint32_t *address, uint32_t *buffer, int length, bool notify)
+{
+    uint16_t handle;
 
-        // Erase page:
-        NRF_NVMC->ERASEPAGE = (uint32_t)pg_addr;
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
+    // Keep track of the wear on the device.
+    if (buffer)
+        wordsWritten += length;
+    else if (eraseCounts && address >= eraseCountStart && address < eraseCountStart + eraseCountPages * (MICROBIT_CODEPAGESIZE / 4))
+        eraseCounts[(address - eraseCountStart) / (MICROBIT_CODEPAGESIZE / 4)]++;
 
-        // Turn off flash erase enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) { }
+    target_disable_irq();
+
+    while ((uint16_t)(flash_op_queued - flash_op_completed) >= MICROBIT_FLASH_QUEUE_SIZE)
+    {
+        target_enable_irq();
+        waitFor(flash_op_completed + 1, notify && flash_can_yield());
+        target_disable_irq();
     }
+
+    handle = flash_op_queued + 1;
+
+    MicroBitFlashOperation *op = &flash_queue[handle % MICROBIT_FLASH_QUEUE_SIZE];
+    op->address = address;
+    op->buffer = buffer;
+    op->length = length;
+    op->notify = notify;
+
+    flash_op_queued = handle;
+
+    target_enable_irq();
+
+    flash_start_next();
+
+    return handle;
 }
 
 /**
-  * Write to flash memory, assuming that a write is valid
-  * (using need_erase).
+  * Schedule an erase of an entire page, without waiting for it to complete.
+  * An event with an ID of MICROBIT_ID_FLASH and a value of the returned handle is raised on completion.
   *
-  * @param page_address address of memory to write to.
-  *     Must be word aligned.
+  * @param page_address address of first word of page.
+  * @return A handle for the operation, that may be passed to wait() or isComplete().
+  */
+int MicroBitFlash::erase_page_async(uint32_t* page_address)
+{
+    return queue(page_address, NULL, 0, true);
+}
+
+/**
+  * Schedule a write to flash memory, without waiting for it to complete. The region written
+  * must not require an erase (using need_erase), and the buffer must remain valid until the operation completes.
+  * An event with an ID of MICROBIT_ID_FLASH and a value of the returned handle is raised on completion.
+  *
+  * @param addr address of memory to write to. Must be word aligned.
   * @param buffer address to write from, must be word-aligned.
   * @param len number of uint32_t words to write.
+  * @return A handle for the operation, that may be passed to wait() or isComplete().
   */
-void MicroBitFlash::flash_burn(uint32_t* addr, uint32_t* buffer, int size)
+int MicroBitFlash::flash_burn_async(uint32_t* addr, uint32_t* buffer, int len)
 {
-#ifdef SOFTDEVICE_PRESENT
-    if (ble_running())
-    {
-        // Schedule SoftDevice to write this memory for us, and wait for it to complete.
-        // This happens ASYNCHRONOUSLY when SD is enabled (and synchronously if disabled!!)
-        flash_op_complete = false;
+    return queue(addr, buffer, len, true);
+}
 
-        while(1)
-        {
-            if (sd_flash_write(addr, buffer, size) == NRF_SUCCESS)
-                break;
+/**
+  * Determine if the given FLASH operation has completed.
+  *
+  * @param handle A handle returned by erase_page_async() or flash_burn_async().
+  * @return true if the operation has completed, false otherwise.
+  */
+bool MicroBitFlash::isComplete(int handle)
+{
+    return (int16_t)(flash_op_completed - (uint16_t)handle) >= 0;
+}
 
-            system_timer_wait_ms(10);
-        }
+/**
+  * Wait for the given FLASH operation to complete. When called from a fiber, other fibers are
+  * scheduled whilst the operation takes place. Otherwise, this spins until the operation completes.
+  *
+  * @param handle A handle returned by erase_page_async() or flash_burn_async().
+  * @return MICROBIT_OK.
+  */
+int MicroBitFlash::wait(int handle)
+{
+    return waitFor(handle, flash_can_yield());
+}
 
-        // Wait for SoftDevice to diable the write operation when it completes...
-        while(!flash_op_complete);
-    }
-    else
-#endif
+/**
+  * Wait for the given FLASH operation to complete.
+  *
+  * @param handle A handle returned by queue().
+  * @param yield true to schedule other fibers whilst the operation takes place, false to spin.
+  * @return MICROBIT_OK.
+  */
+int MicroBitFlash::waitFor(int handle, bool yield)
+{
+    while (!isComplete(handle))
     {
-        // Turn on flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+        // If the operation could not be started (e.g. the SoftDevice was busy), try again.
+        if (!flash_op_in_progress)
+            flash_start_next();
+
+        if (!yield)
+            continue;
+
+        target_disable_irq();
 
-        for(int i=0;i<size;i++)
+        // Sleep until the operation currently in progress completes.
+        if (flash_op_in_progress && !isComplete(handle))
         {
-            *(addr+i) = *(buffer+i);
-            while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+            flash_queue[(uint16_t)(flash_op_completed + 1) % MICROBIT_FLASH_QUEUE_SIZE].notify = true;
+            fiber_wake_on_event(MICROBIT_ID_FLASH, flash_op_completed + 1);
+            target_enable_irq();
+            schedule();
         }
+        else
+        {
+            target_enable_irq();
 
-        // Turn off flash write enable and wait until the NVMC is ready:
-        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
-        while (NRF_NVMC->READY == NVMC_READY_READY_Busy) {};
+            if (!isComplete(handle))
+                fiber_sleep(MICROBIT_FLASH_RETRY_PERIOD);
+        }
     }
+
+    return MICROBIT_OK;
+}
+
+/**
+  * Maintain a count of the number of times each page in the given region of FLASH is erased by this instance.
+  *
+  * @param start address of the first page of the region.
+  * @param pages number of pages in the region.
+  * @param counts one counter per page, incremented as each page is erased, or NULL to stop counting.
+  */
+void MicroBitFlash::setEraseCounters(uint32_t *start, int pages, uint16_t *counts)
+{
+    eraseCountStart = start;
+    eraseCountPages = pages;
+    eraseCounts = counts;
+}
+
+/**
+  * Determine the number of words written to FLASH by this instance.
+  *
+  * @return The number of words written.
+  */
+uint32_t MicroBitFlash::getWordsWritten()
+{
+    return wordsWritten;
+}
+
+/**
+  * Erase an entire page
+  * This blocks without yielding, so calls made by one fiber are never interleaved with another's.
+  * @param page_address address of first word of page
+  */
+void MicroBitFlash::erase_page(uint32_t* pg_addr)
+{
+    waitFor(queue(pg_addr, NULL, 0, false), false);
+}
+
+/**
+  * Write to flash memory, assuming that a write is valid
+  * (using need_erase).
+  *
+  * @param page_address address of memory to write to.
+  *     Must be word aligned.
+  * @param buffer address to write from, must be word-aligned.
+  * @param len number of uint32_t words to write.
+  *
+  * This blocks without yielding. Fibers share one stack, so a buffer on the caller's stack could be
+  * overwritten by another fiber before the SoftDevice had written it.
+  */
+void MicroBitFlash::flash_burn(uint32_t* addr, uint32_t* buffer, int size)
+{
+    waitFor(queue(addr, buffer, size, false), false);
 }
 
 /**
@@ -251,6 +514,9 @@ int MicroBitFlash::flash_write(void* address, void* from_buffer,
     }
 
     uint32_t writeWord = 0;
+    uint32_t writeBuffer[16];
+    uint32_t *burnAddr = pgAddr + (start/4);
+    int words = 0;
 
     for(int i=start;i<end;i++)
     {
@@ -268,8 +534,16 @@ int MicroBitFlash::flash_write(void* address, void* from_buffer,
 
         if( ((i+1)%4) == 0)
         {
-            this->flash_burn(pgAddr + (i/4), &writeWord, 1);
+            writeBuffer[words++] = writeWord;
             writeWord = 0;
+
+            // Burn a run of words at a time, rather than scheduling a FLASH operation for every word.
+            if (words == 16 || i+1 == end)
+            {
+                this->flash_burn(burnAddr, writeBuffer, words);
+                burnAddr += words;
+                words = 0;
+            }
         }
     }
 
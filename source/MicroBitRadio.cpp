@@ -28,6 +28,7 @@ DEALINGS IN THE SOFTWARE.
 #include "CodalComponent.h"
 #include "ErrorNo.h"
 #include "CodalFiber.h"
+#include "Timer.h"
 #include "nrf.h"
 
 using namespace codal;
@@ -52,8 +53,9 @@ const uint8_t MICROBIT_RADIO_POWER_LEVEL[] = {0xD8, 0xEC, 0xF0, 0xF4, 0xF8, 0xFC
   * BLE to cohabit with other protocols. Future work to allow this colocation would be benefical, and would also allow for the
   * creation of wireless BLE bridges.
   *
-  * NOTE: This API does not contain any form of encryption, authentication or authorisation. Its purpose is solely for use as a
+  * NOTE: By default this API does not perform any form of encryption, authentication or authorisation. Its purpose is solely for use as a
   * teaching aid to demonstrate how simple communications operates, and to provide a sandpit through which learning can take place.
+  * Frames on a group may optionally be encrypted and authenticated with AES-CCM, see setEncryptionKey().
   * For serious applications, BLE should be considered a substantially more secure alternative.
   */
 
@@ -105,7 +107,7 @@ extern "C" void RADIO_IRQHandler(void)
   * @note This class is demand activated, as a result most resources are only
   *       committed if send/recv or event registrations calls are made.
   */
-MicroBitRadio::MicroBitRadio(uint16_t id) : datagram(*this), event (*this)
+MicroBitRadio::MicroBitRadio(uint16_t id) : datagram(*this), event (*this), stream(*this)
 {
     this->id = id;
     this->status = 0;
@@ -293,8 +295,12 @@ int MicroBitRadio::enable()
         return DEVICE_NOT_SUPPORTED;
 
     // If this is the first time we've been enable, allocate out receive buffers.
+    // Also choose the source and session IDs for encrypted frames. The random session ID ensures frame counters restart safely after a reset.
     if (rxBuf == NULL)
+    {
         rxBuf = new FrameBuffer();
+        ccm.setSource(microbit_serial_number(), ((uint32_t)microbit_random(0x10000) << 16) | (uint32_t)microbit_random(0x10000));
+    }
 
     if (rxBuf == NULL)
         return DEVICE_NO_RESOURCES;
@@ -425,6 +431,21 @@ int MicroBitRadio::setGroup(uint8_t group)
     return DEVICE_OK;
 }
 
+/**
+  * Sets or clears the AES-128 key used to encrypt and authenticate frames on the given group.
+  * Once a key is set, frames sent on that group are encrypted, and received frames that are not
+  * encrypted with the same key, or that are replays of earlier frames, are silently dropped.
+  *
+  * @param group The radio group the key applies to.
+  * @param key A pointer to a 16 byte key, or NULL to return the group to plain text operation.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if too many groups have keys or there is insufficient memory.
+  */
+int MicroBitRadio::setEncryptionKey(uint8_t group, const uint8_t *key)
+{
+    return ccm.setKey(group, key);
+}
+
 /**
   * A background, low priority callback that is triggered whenever the processor is idle.
   * Here, we empty our queue of received packets, and pass them onto higher level protocol handlers.
@@ -436,6 +457,21 @@ void MicroBitRadio::idleCallback()
     {
         FrameBuffer *p = rxQueue;
 
+        // If this group is encrypted, authenticate and decrypt the frame in place, and drop it if that fails.
+        if (ccm.hasKey(group))
+        {
+            CODAL_TIMESTAMP start = system_timer_current_time_us();
+            int result = ccm.decrypt(p, group);
+            ccm.cryptoTime += system_timer_current_time_us() - start;
+
+            if (result != DEVICE_OK)
+            {
+                recv();
+                delete p;
+                continue;
+            }
+        }
+
         switch (p->protocol)
         {
             case MICROBIT_RADIO_PROTOCOL_DATAGRAM:
@@ -446,6 +482,10 @@ void MicroBitRadio::idleCallback()
                 event.packetReceived();
                 break;
 
+            case MICROBIT_RADIO_PROTOCOL_STREAM:
+                stream.packetReceived();
+                break;
+
             default:
                 Event(DEVICE_ID_RADIO_DATA_READY, p->protocol);
         }
@@ -518,6 +558,21 @@ int MicroBitRadio::send(FrameBuffer *buffer)
     if (buffer->length > MICROBIT_RADIO_MAX_PACKET_SIZE + MICROBIT_RADIO_HEADER_SIZE - 1)
         return DEVICE_INVALID_PARAMETER;
 
+    // If this group is encrypted, send an encrypted copy of the buffer instead.
+    FrameBuffer encrypted;
+
+    if (ccm.hasKey(group))
+    {
+        CODAL_TIMESTAMP start = system_timer_current_time_us();
+        int result = ccm.encrypt(&encrypted, buffer, group);
+        ccm.cryptoTime += system_timer_current_time_us() - start;
+
+        if (result != DEVICE_OK)
+            return result;
+
+        buffer = &encrypted;
+    }
+
     // Firstly, disable the Radio interrupt. We want to wait until the trasmission completes.
     NVIC_DisableIRQ(RADIO_IRQn);
 
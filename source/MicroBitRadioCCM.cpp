@@ -0,0 +1,544 @@
+/*
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadioCCM.h"
+#include "MicroBitRadio.h"
+#include "ErrorNo.h"
+#include "nrf.h"
+
+using namespace codal;
+
+#if CONFIG_ENABLED(MICROBIT_RADIO_CCM_SOFTWARE_AES)
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint8_t aes_xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+/**
+ * Software AES-128 block encryption, used on hosts without the nRF52 ECB peripheral.
+ * The round keys are expanded on the fly, as each frame only encrypts a handful of blocks.
+ */
+void MicroBitRadioCCM::aesEncrypt(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    uint8_t state[16];
+    uint8_t roundKey[16];
+    uint8_t rcon = 0x01;
+
+    memcpy(roundKey, key, 16);
+
+    for (int i = 0; i < 16; i++)
+        state[i] = in[i] ^ roundKey[i];
+
+    for (int round = 1; round <= 10; round++)
+    {
+        // Next round key.
+        uint8_t t0 = aes_sbox[roundKey[13]] ^ rcon;
+        uint8_t t1 = aes_sbox[roundKey[14]];
+        uint8_t t2 = aes_sbox[roundKey[15]];
+        uint8_t t3 = aes_sbox[roundKey[12]];
+        rcon = aes_xtime(rcon);
+
+        roundKey[0] ^= t0; roundKey[1] ^= t1; roundKey[2] ^= t2; roundKey[3] ^= t3;
+        for (int i = 4; i < 16; i++)
+            roundKey[i] ^= roundKey[i - 4];
+
+        // SubBytes and ShiftRows.
+        uint8_t s[16];
+        for (int c = 0; c < 4; c++)
+            for (int r = 0; r < 4; r++)
+                s[c * 4 + r] = aes_sbox[state[((c + r) & 3) * 4 + r]];
+
+        // MixColumns, skipped in the final round.
+        if (round < 10)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                uint8_t *col = &s[c * 4];
+                uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+                col[0] ^= all ^ aes_xtime(a0 ^ a1);
+                col[1] ^= all ^ aes_xtime(a1 ^ a2);
+                col[2] ^= all ^ aes_xtime(a2 ^ a3);
+                col[3] ^= all ^ aes_xtime(a3 ^ a0);
+            }
+        }
+
+        // AddRoundKey.
+        for (int i = 0; i < 16; i++)
+            state[i] = s[i] ^ roundKey[i];
+    }
+
+    memcpy(out, state, 16);
+}
+
+#else
+
+/**
+ * AES-128 block encryption on the nRF52 ECB peripheral.
+ * The ECB peripheral is shared with the SoftDevice, but the radio is only available while BLE is not running.
+ */
+void MicroBitRadioCCM::aesEncrypt(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    static struct
+    {
+        uint8_t key[16];
+        uint8_t cleartext[16];
+        uint8_t ciphertext[16];
+    } ecbData;
+
+    memcpy(ecbData.key, key, 16);
+    memcpy(ecbData.cleartext, in, 16);
+
+    NRF_ECB->ECBDATAPTR = (uint32_t)&ecbData;
+    NRF_ECB->EVENTS_ENDECB = 0;
+
+    // An operation aborted by a higher priority user of the AES core leaves the ciphertext undefined, so run it again.
+    do
+    {
+        NRF_ECB->EVENTS_ERRORECB = 0;
+        NRF_ECB->TASKS_STARTECB = 1;
+
+        while (NRF_ECB->EVENTS_ENDECB == 0 && NRF_ECB->EVENTS_ERRORECB == 0);
+    } while (NRF_ECB->EVENTS_ENDECB == 0);
+
+    NRF_ECB->EVENTS_ENDECB = 0;
+    NRF_ECB->EVENTS_ERRORECB = 0;
+    memcpy(out, ecbData.ciphertext, 16);
+}
+
+#endif
+
+/**
+ * Runs AES-CCM over a buffer in place, as defined in RFC 3610 with a 2 byte length field.
+ *
+ * @param key The 16 byte AES key.
+ * @param nonce The 13 byte nonce.
+ * @param aad Additional data which is authenticated but not encrypted.
+ * @param aadLength The length of aad, less than 0xFF00 bytes.
+ * @param data The data to encrypt or decrypt, in place.
+ * @param length The length of data.
+ * @param mic Buffer of micLength bytes, receives the MIC when encrypting, holds the received MIC when decrypting.
+ * @param micLength The MIC length, an even number in the range 4..16.
+ * @param encrypt true to encrypt, false to decrypt.
+ *
+ * @return DEVICE_OK on success, or DEVICE_INVALID_PARAMETER if decrypting and the MIC does not match.
+ */
+int MicroBitRadioCCM::ccm(const uint8_t *key, const uint8_t *nonce, const uint8_t *aad, int aadLength, uint8_t *data, int length, uint8_t *mic, int micLength, bool encrypt)
+{
+    uint8_t x[MICROBIT_RADIO_CCM_BLOCK_SIZE];
+    uint8_t a[MICROBIT_RADIO_CCM_BLOCK_SIZE];
+    uint8_t s[MICROBIT_RADIO_CCM_BLOCK_SIZE];
+    uint8_t s0[MICROBIT_RADIO_CCM_BLOCK_SIZE];
+
+    // Counter block A_i: flags, nonce, 16 bit counter.
+    a[0] = 0x01;
+    memcpy(&a[1], nonce, MICROBIT_RADIO_CCM_NONCE_SIZE);
+    a[14] = 0;
+    a[15] = 0;
+    aesEncrypt(key, a, s0);
+
+    // When decrypting, recover the plain text first so the MAC can be computed over it.
+    if (!encrypt)
+    {
+        for (int i = 0; i < length; i += MICROBIT_RADIO_CCM_BLOCK_SIZE)
+        {
+            uint16_t counter = (i / MICROBIT_RADIO_CCM_BLOCK_SIZE) + 1;
+            a[14] = counter >> 8;
+            a[15] = counter & 0xFF;
+            aesEncrypt(key, a, s);
+
+            for (int j = 0; j < MICROBIT_RADIO_CCM_BLOCK_SIZE && i + j < length; j++)
+                data[i + j] ^= s[j];
+        }
+    }
+
+    // CBC-MAC. B_0: flags (Adata, M, L), nonce, message length.
+    x[0] = (aadLength ? 0x40 : 0x00) | (((micLength - 2) / 2) << 3) | 0x01;
+    memcpy(&x[1], nonce, MICROBIT_RADIO_CCM_NONCE_SIZE);
+    x[14] = length >> 8;
+    x[15] = length & 0xFF;
+    aesEncrypt(key, x, x);
+
+    // Additional data, prefixed by its 16 bit length and zero padded to the block size.
+    if (aadLength)
+    {
+        int position = 2;
+        x[0] ^= aadLength >> 8;
+        x[1] ^= aadLength & 0xFF;
+
+        for (int i = 0; i < aadLength; i++)
+        {
+            x[position++] ^= aad[i];
+
+            if (position == MICROBIT_RADIO_CCM_BLOCK_SIZE)
+            {
+                aesEncrypt(key, x, x);
+                position = 0;
+            }
+        }
+
+        if (position)
+            aesEncrypt(key, x, x);
+    }
+
+    // Message, zero padded to the block size.
+    for (int i = 0; i < length; i += MICROBIT_RADIO_CCM_BLOCK_SIZE)
+    {
+        for (int j = 0; j < MICROBIT_RADIO_CCM_BLOCK_SIZE && i + j < length; j++)
+            x[j] ^= data[i + j];
+
+        aesEncrypt(key, x, x);
+    }
+
+    // Encrypt the message once the MAC has been taken over the plain text.
+    if (encrypt)
+    {
+        for (int i = 0; i < length; i += MICROBIT_RADIO_CCM_BLOCK_SIZE)
+        {
+            uint16_t counter = (i / MICROBIT_RADIO_CCM_BLOCK_SIZE) + 1;
+            a[14] = counter >> 8;
+            a[15] = counter & 0xFF;
+            aesEncrypt(key, a, s);
+
+            for (int j = 0; j < MICROBIT_RADIO_CCM_BLOCK_SIZE && i + j < length; j++)
+                data[i + j] ^= s[j];
+        }
+
+        for (int i = 0; i < micLength; i++)
+            mic[i] = x[i] ^ s0[i];
+
+        return DEVICE_OK;
+    }
+
+    // Compare the MIC in constant time.
+    uint8_t diff = 0;
+    for (int i = 0; i < micLength; i++)
+        diff |= mic[i] ^ x[i] ^ s0[i];
+
+    return diff ? DEVICE_INVALID_PARAMETER : DEVICE_OK;
+}
+
+/**
+ * Constructor.
+ *
+ * Creates an instance of MicroBitRadioCCM with no keys set.
+ *
+ * @param source The 32 bit source ID to use for frames sent by this device.
+ * @param session The 32 bit session ID to use for frames sent by this device.
+ */
+MicroBitRadioCCM::MicroBitRadioCCM(uint32_t source, uint32_t session)
+{
+    this->keys = NULL;
+    this->replay = NULL;
+    this->source = source;
+    this->session = session;
+    this->txCounter = 0;
+    this->useCount = 0;
+
+    this->framesEncrypted = 0;
+    this->framesDecrypted = 0;
+    this->framesRejected = 0;
+    this->cryptoTime = 0;
+}
+
+/**
+ * Sets or clears the key used for the given radio group.
+ *
+ * @param group The radio group.
+ * @param key A pointer to a 16 byte AES-128 key, or NULL to clear the key and return the group to plain text.
+ *
+ * @return DEVICE_OK on success, or DEVICE_NO_RESOURCES if all key slots are in use or there is insufficient memory.
+ */
+int MicroBitRadioCCM::setKey(uint8_t group, const uint8_t *key)
+{
+    GroupKey *slot = NULL;
+
+    // The key and replay tables are only allocated once encryption is first used.
+    if (keys == NULL)
+    {
+        if (key == NULL)
+            return DEVICE_OK;
+
+        keys = (GroupKey *) malloc(MICROBIT_RADIO_CCM_MAX_KEYS * sizeof(GroupKey));
+        replay = (ReplayEntry *) malloc(MICROBIT_RADIO_CCM_REPLAY_ENTRIES * sizeof(ReplayEntry));
+
+        if (keys == NULL || replay == NULL)
+        {
+            free(keys);
+            free(replay);
+            keys = NULL;
+            replay = NULL;
+
+            return DEVICE_NO_RESOURCES;
+        }
+
+        memset(keys, 0, MICROBIT_RADIO_CCM_MAX_KEYS * sizeof(GroupKey));
+        memset(replay, 0, MICROBIT_RADIO_CCM_REPLAY_ENTRIES * sizeof(ReplayEntry));
+    }
+
+    for (int i = 0; i < MICROBIT_RADIO_CCM_MAX_KEYS; i++)
+    {
+        if (keys[i].valid && keys[i].group == group)
+        {
+            slot = &keys[i];
+            break;
+        }
+
+        if (!keys[i].valid && slot == NULL)
+            slot = &keys[i];
+    }
+
+    if (key == NULL)
+    {
+        if (slot && slot->valid && slot->group == group)
+            memset(slot, 0, sizeof(GroupKey));
+
+        return DEVICE_OK;
+    }
+
+    if (slot == NULL)
+        return DEVICE_NO_RESOURCES;
+
+    slot->group = group;
+    slot->valid = true;
+    memcpy(slot->key, key, MICROBIT_RADIO_CCM_KEY_SIZE);
+
+    return DEVICE_OK;
+}
+
+/**
+ * Sets the source and session IDs used for frames sent by this device, and restarts the frame counter.
+ *
+ * @param source The 32 bit source ID.
+ * @param session The 32 bit session ID. This must be chosen at random on each boot, as the frame counter restarts from zero.
+ */
+void MicroBitRadioCCM::setSource(uint32_t source, uint32_t session)
+{
+    this->source = source;
+    this->session = session;
+    this->txCounter = 0;
+}
+
+/**
+ * Looks up the key for the given group.
+ *
+ * @return A pointer to the key, or NULL if the group has no key.
+ */
+const uint8_t *MicroBitRadioCCM::getKey(uint8_t group)
+{
+    if (keys == NULL)
+        return NULL;
+
+    for (int i = 0; i < MICROBIT_RADIO_CCM_MAX_KEYS; i++)
+        if (keys[i].valid && keys[i].group == group)
+            return keys[i].key;
+
+    return NULL;
+}
+
+/**
+ * Determines if a key has been set for the given radio group.
+ *
+ * @param group The radio group.
+ *
+ * @return true if frames on this group are encrypted, false otherwise.
+ */
+bool MicroBitRadioCCM::hasKey(uint8_t group)
+{
+    return getKey(group) != NULL;
+}
+
+/**
+ * Checks a frame counter against the highest counter seen from its sender, and records it.
+ * Only the most recently heard MICROBIT_RADIO_CCM_REPLAY_ENTRIES senders are remembered, and only until reset,
+ * so a replay from a sender that has been forgotten is accepted.
+ *
+ * @return true if the counter is new, false if the frame is a replay.
+ */
+bool MicroBitRadioCCM::acceptCounter(uint32_t source, uint32_t session, uint32_t counter)
+{
+    ReplayEntry *oldest = &replay[0];
+
+    useCount++;
+
+    for (int i = 0; i < MICROBIT_RADIO_CCM_REPLAY_ENTRIES; i++)
+    {
+        if (replay[i].lastUsed && replay[i].source == source && replay[i].session == session)
+        {
+            if (counter <= replay[i].counter)
+                return false;
+
+            replay[i].counter = counter;
+            replay[i].lastUsed = useCount;
+            return true;
+        }
+
+        if (replay[i].lastUsed < oldest->lastUsed)
+            oldest = &replay[i];
+    }
+
+    // A sender we have not seen, or have forgotten. Replace the least recently used entry.
+    oldest->source = source;
+    oldest->session = session;
+    oldest->counter = counter;
+    oldest->lastUsed = useCount;
+
+    return true;
+}
+
+/**
+ * Builds the nonce and additional data for a frame.
+ * The nonce is the source ID, session ID, frame counter and radio group.
+ * The additional data is the version and protocol fields of the frame header.
+ */
+static void ccm_frame_params(FrameBuffer *frame, uint8_t group, const uint8_t *header, uint8_t *nonce, uint8_t *aad)
+{
+    memcpy(nonce, header, MICROBIT_RADIO_CCM_HEADER_SIZE);
+    nonce[MICROBIT_RADIO_CCM_HEADER_SIZE] = group;
+
+    aad[0] = frame->version;
+    aad[1] = frame->protocol;
+}
+
+/**
+ * Encrypts and authenticates a frame.
+ *
+ * @param out The frame to write the encrypted result into.
+ * @param in The plain text frame to encrypt.
+ * @param group The radio group the frame will be sent on.
+ *
+ * @return DEVICE_OK on success, DEVICE_INVALID_PARAMETER if the encrypted frame would exceed MICROBIT_RADIO_MAX_PACKET_SIZE,
+ *         or DEVICE_NOT_SUPPORTED if no key is set for the group.
+ */
+int MicroBitRadioCCM::encrypt(FrameBuffer *out, FrameBuffer *in, uint8_t group)
+{
+    const uint8_t *key = getKey(group);
+    int length = in->length - (MICROBIT_RADIO_HEADER_SIZE - 1);
+    uint8_t nonce[MICROBIT_RADIO_CCM_NONCE_SIZE];
+    uint8_t aad[2];
+
+    if (key == NULL)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (length < 0 || length + MICROBIT_RADIO_CCM_OVERHEAD > MICROBIT_RADIO_MAX_PACKET_SIZE)
+        return DEVICE_INVALID_PARAMETER;
+
+    txCounter++;
+
+    out->length = in->length + MICROBIT_RADIO_CCM_OVERHEAD;
+    out->version = in->version | MICROBIT_RADIO_VERSION_ENCRYPTED;
+    out->group = in->group;
+    out->protocol = in->protocol;
+
+    out->payload[0] = source >> 24;
+    out->payload[1] = source >> 16;
+    out->payload[2] = source >> 8;
+    out->payload[3] = source;
+    out->payload[4] = session >> 24;
+    out->payload[5] = session >> 16;
+    out->payload[6] = session >> 8;
+    out->payload[7] = session;
+    out->payload[8] = txCounter >> 24;
+    out->payload[9] = txCounter >> 16;
+    out->payload[10] = txCounter >> 8;
+    out->payload[11] = txCounter;
+
+    memcpy(&out->payload[MICROBIT_RADIO_CCM_HEADER_SIZE], in->payload, length);
+
+    ccm_frame_params(out, group, out->payload, nonce, aad);
+    ccm(key, nonce, aad, sizeof(aad), &out->payload[MICROBIT_RADIO_CCM_HEADER_SIZE], length,
+        &out->payload[MICROBIT_RADIO_CCM_HEADER_SIZE + length], MICROBIT_RADIO_CCM_MIC_SIZE, true);
+
+    framesEncrypted++;
+
+    return DEVICE_OK;
+}
+
+/**
+ * Authenticates and decrypts a received frame in place, removing the fields added by encrypt().
+ *
+ * @param buffer The received frame.
+ * @param group The radio group the frame was received on.
+ *
+ * @return DEVICE_OK on success, DEVICE_NOT_SUPPORTED if no key is set for the group,
+ *         or DEVICE_INVALID_PARAMETER if the frame is not encrypted, fails authentication, or is a replay.
+ */
+int MicroBitRadioCCM::decrypt(FrameBuffer *buffer, uint8_t group)
+{
+    const uint8_t *key = getKey(group);
+    int length = buffer->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_CCM_OVERHEAD;
+    uint8_t nonce[MICROBIT_RADIO_CCM_NONCE_SIZE];
+    uint8_t aad[2];
+
+    if (key == NULL)
+        return DEVICE_NOT_SUPPORTED;
+
+    if (!(buffer->version & MICROBIT_RADIO_VERSION_ENCRYPTED) || length < 0)
+    {
+        framesRejected++;
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    uint32_t frameSource = ((uint32_t)buffer->payload[0] << 24) | ((uint32_t)buffer->payload[1] << 16) | ((uint32_t)buffer->payload[2] << 8) | buffer->payload[3];
+    uint32_t frameSession = ((uint32_t)buffer->payload[4] << 24) | ((uint32_t)buffer->payload[5] << 16) | ((uint32_t)buffer->payload[6] << 8) | buffer->payload[7];
+    uint32_t frameCounter = ((uint32_t)buffer->payload[8] << 24) | ((uint32_t)buffer->payload[9] << 16) | ((uint32_t)buffer->payload[10] << 8) | buffer->payload[11];
+
+    ccm_frame_params(buffer, group, buffer->payload, nonce, aad);
+
+    if (ccm(key, nonce, aad, sizeof(aad), &buffer->payload[MICROBIT_RADIO_CCM_HEADER_SIZE], length,
+            &buffer->payload[MICROBIT_RADIO_CCM_HEADER_SIZE + length], MICROBIT_RADIO_CCM_MIC_SIZE, false) != DEVICE_OK
+        || !acceptCounter(frameSource, frameSession, frameCounter))
+    {
+        framesRejected++;
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    // Strip the CCM fields, leaving a plain text frame for the higher layer protocols.
+    memmove(buffer->payload, &buffer->payload[MICROBIT_RADIO_CCM_HEADER_SIZE], length);
+    buffer->length -= MICROBIT_RADIO_CCM_OVERHEAD;
+    buffer->version &= ~MICROBIT_RADIO_VERSION_ENCRYPTED;
+
+    framesDecrypted++;
+
+    return DEVICE_OK;
+}
@@ -24,9 +24,14 @@ DEALINGS IN THE SOFTWARE.
 */
 
 #include "MicroBitRadio.h"
+#include "Timer.h"
 
 using namespace codal;
 
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0 && (MICROBIT_RADIO_EVENT_BATCH_SIZE * 4 > MICROBIT_RADIO_MAX_PACKET_SIZE - MICROBIT_RADIO_CCM_OVERHEAD || MICROBIT_RADIO_EVENT_BATCH_SIZE > 255)
+    #error "MICROBIT_RADIO_EVENT_BATCH_SIZE is too large to fit in a single radio frame"
+#endif
+
 /**
  * Provides a simple broadcast radio abstraction, built upon the raw nrf51822 RADIO module.
  *
@@ -52,6 +57,15 @@ using namespace codal;
 MicroBitRadioEvent::MicroBitRadioEvent(MicroBitRadio &r) : radio(r)
 {
     this->suppressForwarding = false;
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+    this->flushRegistered = false;
+    this->batchLength = 0;
+#endif
+
+    this->eventsSent = 0;
+    this->eventsCoalesced = 0;
+    this->eventsReceived = 0;
+    this->framesSent = 0;
 }
 
 /**
@@ -96,6 +110,15 @@ int MicroBitRadioEvent::listen(uint16_t id, uint16_t value)
   */
 int MicroBitRadioEvent::listen(uint16_t id, uint16_t value, EventModel &eventBus)
 {
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+    // Batches are flushed by a timer event, which is raised on the default EventModel.
+    if (!flushRegistered && EventModel::defaultEventBus)
+    {
+        EventModel::defaultEventBus->listen(MICROBIT_ID_RADIO_EVENT_FLUSH, MICROBIT_RADIO_EVT_EVENT_FLUSH, this, &MicroBitRadioEvent::onFlush);
+        flushRegistered = true;
+    }
+#endif
+
     return eventBus.listen(id, value, this, &MicroBitRadioEvent::eventReceived, MESSAGE_BUS_LISTENER_IMMEDIATE);
 }
 
@@ -140,15 +163,35 @@ int MicroBitRadioEvent::ignore(uint16_t id, uint16_t value, EventModel &eventBus
 /**
   * Protocol handler callback. This is called when the radio receives a packet marked as using the event protocol.
   *
-  * This function process this packet, and fires the event contained inside onto the default EventModel.
+  * This function process this packet, and fires the events contained inside onto the default EventModel, in the order they were sent.
   */
 void MicroBitRadioEvent::packetReceived()
 {
     FrameBuffer *p = radio.recv();
-    Event *e = (Event *) p->payload;
 
     suppressForwarding = true;
-    e->fire();
+
+    if (p->version == MICROBIT_RADIO_EVENT_VERSION_BATCH)
+    {
+        int count = (p->length - (MICROBIT_RADIO_HEADER_SIZE - 1)) / sizeof(RadioEventRecord);
+
+        for (int i = 0; i < count; i++)
+        {
+            RadioEventRecord r;
+            memcpy(&r, &p->payload[i * sizeof(RadioEventRecord)], sizeof(RadioEventRecord));
+
+            Event(r.source, r.value);
+            eventsReceived++;
+        }
+    }
+    else
+    {
+        Event *e = (Event *) p->payload;
+
+        e->fire();
+        eventsReceived++;
+    }
+
     suppressForwarding = false;
 
     delete p;
@@ -156,21 +199,111 @@ void MicroBitRadioEvent::packetReceived()
 
 /**
   * Event handler callback. This is called whenever an event is received matching one of those registered through
-  * the registerEvent() method described above. Upon receiving such an event, it is wrapped into
-  * a radio packet and transmitted to any other micro:bits in the same group.
+  * the registerEvent() method described above. Upon receiving such an event, it is added to the current batch,
+  * which is transmitted to any other micro:bits in the same group once MICROBIT_RADIO_EVENT_BATCH_PERIOD has elapsed
+  * or the batch is full. Events identical to one already in the batch are dropped.
   */
 void MicroBitRadioEvent::eventReceived(Event e)
 {
     if(suppressForwarding)
         return;
 
+    // Never forward our own flush timer, which a wildcard registration would otherwise match.
+    if (e.source == MICROBIT_ID_RADIO_EVENT_FLUSH)
+        return;
+
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+    if (flushRegistered)
+    {
+        // This may be called from interrupt context, so protect the batch while it is updated.
+        target_disable_irq();
+
+        for (int i = 0; i < batchLength; i++)
+        {
+            if (batch[i].source == e.source && batch[i].value == e.value)
+            {
+                eventsCoalesced++;
+                target_enable_irq();
+                return;
+            }
+        }
+
+        batch[batchLength].source = e.source;
+        batch[batchLength].value = e.value;
+        batchLength++;
+
+        bool first = batchLength == 1;
+        bool full = batchLength == MICROBIT_RADIO_EVENT_BATCH_SIZE;
+
+        target_enable_irq();
+
+        if (full)
+            flush();
+        else if (first)
+            system_timer_event_after(MICROBIT_RADIO_EVENT_BATCH_PERIOD, MICROBIT_ID_RADIO_EVENT_FLUSH, MICROBIT_RADIO_EVT_EVENT_FLUSH);
+
+        return;
+    }
+#endif
+
+    // If batching is disabled, send each event in its own frame.
     FrameBuffer buf;
 
     buf.length = sizeof(Event) + MICROBIT_RADIO_HEADER_SIZE - 1;
-    buf.version = 1;
+    buf.version = MICROBIT_RADIO_EVENT_VERSION_SINGLE;
     buf.group = 0;
     buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS;
     memcpy(buf.payload, (const uint8_t *)&e, sizeof(Event));
 
+    eventsSent++;
+    framesSent++;
+
     radio.send(&buf);
 }
+
+/**
+  * Transmits any events waiting in the current batch as a single radio frame.
+  * Does nothing if batching is disabled, as events are then sent as they occur.
+  *
+  * @return DEVICE_OK on success, or DEVICE_NOT_SUPPORTED if the BLE stack is running.
+  */
+int MicroBitRadioEvent::flush()
+{
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+    FrameBuffer buf;
+    int count;
+
+    target_disable_irq();
+
+    count = batchLength;
+    memcpy(buf.payload, batch, count * sizeof(RadioEventRecord));
+    batchLength = 0;
+
+    target_enable_irq();
+
+    if (count == 0)
+        return DEVICE_OK;
+
+    buf.length = count * sizeof(RadioEventRecord) + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = MICROBIT_RADIO_EVENT_VERSION_BATCH;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_EVENTBUS;
+
+    eventsSent += count;
+    framesSent++;
+
+    return radio.send(&buf);
+#else
+    return DEVICE_OK;
+#endif
+}
+
+#if MICROBIT_RADIO_EVENT_BATCH_PERIOD > 0
+/**
+  * Event handler for MICROBIT_RADIO_EVT_EVENT_FLUSH, raised when the coalescing period of a batch ends.
+  */
+void MicroBitRadioEvent::onFlush(Event)
+{
+    flush();
+}
+#endif
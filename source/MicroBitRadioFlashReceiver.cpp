@@ -29,40 +29,54 @@ DEALINGS IN THE SOFTWARE.
 #include <map>
 
 /**
- * Write one buffered page to the given address in flash
- * @param flash_addr the address in flash to write to
- * @param pageBuffer the page buffer to write
+ * Calculates the address in FLASH_USER of a packet
+ * @param page the page number
+ * @param seq the sequence number within the page
+ * @return pointer to the first word of the packet in flash
  */
-void MicroBitRadioFlashReceiver::flashUserPage(uint32_t flash_addr, uint8_t *pageBuffer)
+uint32_t *MicroBitRadioFlashReceiver::packetAddress(uint16_t page, uint16_t seq)
 {
-    uint32_t *flash_ptr = (uint32_t *)flash_addr;
-    uint32_t *data = (uint32_t *)pageBuffer;
+    return (uint32_t *)(USER_BASE_ADDRESS + ((page-1) * R_FLASH_PAGE_SIZE) + ((seq-1) * R_PAYLOAD_SIZE));
+}
 
-    while (sd_flash_write(flash_ptr, data, 1024) == NRF_ERROR_BUSY)
-        __WFE();
+/**
+ * Erase a page of FLASH_USER the first time it is written to in this transfer
+ * @param page the page number
+ */
+void MicroBitRadioFlashReceiver::erasePage(uint16_t page)
+{
+    if(pagesErased.count(page))
+        return;
 
+    flash.erase_page(packetAddress(page, 1));
+    pagesErased.insert(page);
 }
 
 /**
- * Erases all pages in the FLASH_USER memory region
+ * Calculates a 32 bit FNV-1a hash of one packet payload worth of data, used to compare the sender's image
+ * against the current contents of FLASH_USER
+ * @param data pointer to R_PAYLOAD_SIZE bytes
+ * @return the hash
  */
-void MicroBitRadioFlashReceiver::eraseAllUserPages()
+uint32_t MicroBitRadioFlashReceiver::packetHash(const uint8_t *data)
 {
-    for(uint32_t addr = USER_BASE_ADDRESS; addr<USER_END_ADDRESS; addr+=R_FLASH_PAGE_SIZE)
+    uint32_t hash = 2166136261UL;
+    for(uint32_t i = 0; i<R_PAYLOAD_SIZE; i++)
     {
-        uint32_t page = addr/R_FLASH_PAGE_SIZE;
-        while(sd_flash_page_erase(page) == NRF_ERROR_BUSY)
-            __WFE();
+        hash ^= data[i];
+        hash *= 16777619UL;
     }
+    return hash;
 }
 
 /**
- * Check if all sequence numbers in packetMap are true (all packets written to page buffer)
+ * Check if all sequence numbers in packetMap are true for the given page (all packets written to flash)
+ * @param page the page number to check
  * @return true if all packets written, false otherwise
  */
-bool MicroBitRadioFlashReceiver::isBufferWritten()
+bool MicroBitRadioFlashReceiver::isPageWritten(uint16_t page)
 {
-    for(auto &kv : packetMap)
+    for(auto &kv : packetMap[page])
     {
         if(!kv.second)
             return false;
@@ -70,6 +84,69 @@ bool MicroBitRadioFlashReceiver::isBufferWritten()
     return true;
 }
 
+/**
+ * Check if every page in the window, up to the last page known to have been sent, has been received
+ * @return true if no packets are missing, false otherwise
+ */
+bool MicroBitRadioFlashReceiver::isWindowWritten()
+{
+    for(uint16_t page = currentPage; page <= lastPageInWindow(); page++)
+    {
+        if(pagesWritten.count(page))
+            continue;
+
+        initialisePage(page);
+        if(!isPageWritten(page))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Calculates the last page of the window which the sender is known to have started sending,
+ * either from the end of page packet or from data packets already received
+ * @return the page number
+ */
+uint16_t MicroBitRadioFlashReceiver::lastPageInWindow()
+{
+    uint16_t last = lastPageSent;
+    if(!packetMap.empty() && packetMap.rbegin()->first > last)
+        last = packetMap.rbegin()->first;
+
+    if(last > currentPage + R_WINDOW_PAGES - 1)
+        last = currentPage + R_WINDOW_PAGES - 1;
+    if(last > totalPages)
+        last = totalPages;
+
+    return last;
+}
+
+/**
+ * Calculates the number of packets in the given page, the last page may be shorter than packetsPerPage
+ * @param page the page number
+ * @return number of packets in the page
+ */
+uint16_t MicroBitRadioFlashReceiver::packetsInPage(uint16_t page)
+{
+    if(page==totalPages)
+        return totalPackets - packetsPerPage * (page - 1);
+
+    return packetsPerPage;
+}
+
+/**
+ * Populate packetMap with {sequence number, false} for every packet of the given page, if not already done
+ * @param page the page number
+ */
+void MicroBitRadioFlashReceiver::initialisePage(uint16_t page)
+{
+    if(packetMap.count(page))
+        return;
+
+    for(uint16_t i=1; i<=packetsInPage(page); i++)
+        packetMap[page][i] = false;
+}
+
 /**
  * Diagnostic for debugging which prints packetMap and receivedNAKs over serial,
  * caution, serial is relatively slow, so depending on the value of R_SLEEP_TIME
@@ -81,20 +158,26 @@ void MicroBitRadioFlashReceiver::printInfo(MicroBit &uBit)
 {
     ManagedString out = ManagedString("Missing packets: ");
 
-    for(auto &kv : packetMap)
+    for(auto &page : packetMap)
     {
-        if(!kv.second)
-            out = out + ManagedString((int)kv.first) + ManagedString(", ");
+        for(auto &kv : page.second)
+        {
+            if(!kv.second)
+                out = out + ManagedString((int)page.first) + ManagedString(":") + ManagedString((int)kv.first) + ManagedString(", ");
+        }
     }
 
     out = out + ManagedString("\n") + ManagedString("\n");
 
     out =  out + ManagedString("Received NAKs: ");
 
-    for(auto &kv : receivedNAKs)
+    for(auto &page : receivedNAKs)
     {
-        if(kv.second)
-            out = out + ManagedString((int)kv.first) + ManagedString(", ");
+        for(auto &kv : page.second)
+        {
+            if(kv.second)
+                out = out + ManagedString((int)page.first) + ManagedString(":") + ManagedString((int)kv.first) + ManagedString(", ");
+        }
     }
 
     out = out + ManagedString("\n") + ManagedString("\n");
@@ -137,6 +220,20 @@ bool MicroBitRadioFlashReceiver::isHeaderCheckSumOK(PacketBuffer p)
     return res;
 }
 
+/**
+ * Calculates the NAK backoff window, scaled by the larger of the number of receivers this device
+ * has overheard and the number advertised by the sender
+ * @return the NAK window in ms
+ */
+uint32_t MicroBitRadioFlashReceiver::nakWindow()
+{
+    uint32_t receivers = receiversHeard.size() + 1;
+    if(advertisedReceivers > receivers)
+        receivers = advertisedReceivers;
+
+    return R_NAK_WINDOW_SCALED(receivers);
+}
+
 /**
  * Updates loading animation on display
  * @param uBit reference to the microbit device
@@ -168,15 +265,13 @@ void MicroBitRadioFlashReceiver::updateLoadingScreen(MicroBit &uBit)
 MicroBitRadioFlashReceiver::MicroBitRadioFlashReceiver(MicroBit &uBit)
     : uBit(uBit)
 {   
-    //on class instantiation, clear page buffer and erase user flash region
-    memset(pageBuffer, 0, sizeof(pageBuffer));
-    eraseAllUserPages();
+    //user flash is left intact so unchanged packets can be kept, each page is erased when it is first written to
 
     //protocol
     this->totalPackets = 0;
     this->totalPages = 0;
     this->packetsPerPage = R_FLASH_PAGE_SIZE / R_PAYLOAD_SIZE;
-    this->packetsThisPage = packetsPerPage;
+    this->lastPageSent = 0;
 
     this->pageState = RECEIVING;
     this->transferComplete = false;
@@ -184,6 +279,8 @@ MicroBitRadioFlashReceiver::MicroBitRadioFlashReceiver(MicroBit &uBit)
     this->lastSeqN = 0;
     this->lastRxTime = 0;
     this->readyToNAK = false;
+    this->receiverID = (uint16_t)(microbit_serial_number() & 0xFFFF);
+    this->advertisedReceivers = 0;
 
     //stats collection variables
     this->recID = 0;
@@ -201,6 +298,10 @@ MicroBitRadioFlashReceiver::MicroBitRadioFlashReceiver(MicroBit &uBit)
 
     uBit.radio.setGroup(42);
     uBit.radio.setTransmitPower(4);
+#ifdef R_CCM_KEY
+    static const uint8_t key[MICROBIT_RADIO_CCM_KEY_SIZE] = R_CCM_KEY;
+    uBit.radio.setEncryptionKey(42, key);
+#endif
     uBit.radio.enable();
 }
 
@@ -225,35 +326,40 @@ void MicroBitRadioFlashReceiver::Rmain(MicroBit &uBit)
             }
             else if((p[0] == 121) && isHeaderCheckSumOK(p)) // handle receiver packet
                 handleReceiverPacket(p, uBit);
+            else if((p[0] == 123) && isHeaderCheckSumOK(p)) // handle manifest packet
+                handleManifestPacket(p, uBit);
             else if((p[0] == 122) && isHeaderCheckSumOK(p)) //handle end of page packet
             {
                 // uBit.serial.send("--Recover EOP--\n\n");
 
+                // number of receivers the sender has heard NAKs from, and last page of the window the sender has sent
+                advertisedReceivers = ((uint16_t)p[1]<<8) | ((uint16_t)p[2]);
+                lastPageSent = ((uint16_t)p[3]<<8) | ((uint16_t)p[4]);
+                startTransfer(p, uBit);
+
                 //Enter RECOVERY state, backoff for a random period and set NAK flag true
                 pageState = RECOVERY; 
-                uBit.sleep(rand() % (2*R_NAK_WINDOW));
+                uBit.sleep(rand() % (2*nakWindow()));
                 readyToNAK = true;
             }   
         }
-        else if(pageState==RECOVERY && !isBufferWritten() && readyToNAK) //if in RECOVERY AND packets are missing AND NAK flag is true
+        else if(pageState==RECOVERY && totalPages && !isWindowWritten() && readyToNAK) //if in RECOVERY AND packets are missing AND NAK flag is true
         {
             //send NAKs and set flag false
             sendNAKs(uBit);
             readyToNAK = false;
 
-            // clear received NAKs and reinitialise
+            // clear received NAKs, entries are reinitialised to false on next access
             receivedNAKs.clear();
-            for (uint16_t i=1; i<=packetsThisPage; i++)
-                receivedNAKs[i] = false;
         }
         else if(uBit.systemTime() - lastRxTime > 200*R_NAK_WINDOW && lastSeqN!=0) //if nothing from sender for a long time and page has started reset
             return;
-        else if(uBit.systemTime() - lastRxTime > 4*R_NAK_WINDOW && lastSeqN!=0) //if nothing from sender for 4 NAK windows and page has started enter RECOVERY state
+        else if(uBit.systemTime() - lastRxTime > 4*nakWindow() && lastSeqN!=0) //if nothing from sender for 4 NAK windows and page has started enter RECOVERY state
         {
             // uBit.serial.send("--Recover timeout--\n\n");
             //Enter RECOVERY state, backoff for a random period of time and set NAK flag true
             pageState = RECOVERY;
-            uBit.sleep(rand() % (2*R_NAK_WINDOW));
+            uBit.sleep(rand() % (2*nakWindow()));
             readyToNAK = true;
         }
         
@@ -266,7 +372,8 @@ void MicroBitRadioFlashReceiver::Rmain(MicroBit &uBit)
 
 
 /**
- * Write one data packet into the page buffer, writes page buffer into flash if page is complete
+ * Write one data packet straight into flash, erasing its page first if this is the first packet written to it.
+ * Erased flash can be programmed a word at a time in any order, so out of order packets need no buffering
  * 
  * @param packet The received data packet
  * @param uBit reference to the microbit device
@@ -289,130 +396,242 @@ void MicroBitRadioFlashReceiver::handleSenderPacket(PacketBuffer packet, MicroBi
         uint16_t seq = ((uint16_t)packet[1]<<8) | ((uint16_t)packet[2]);
         uint16_t page = ((uint16_t)packet[3]<<8) | ((uint16_t)packet[4]);
 
-        if(page==currentPage) //check packet is for the correct page
-        {
-            if(currentPage == 1) //if first page
-            {
-                recID = time; //set ID to time idle before transmission (used later for stats)
-                start_time = uBit.systemTime();
+        if(page < currentPage || page >= currentPage + R_WINDOW_PAGES) //check packet is for a page in the window
+            return;
 
-                //calculate total pages from packet field
-                totalPackets = ((uint16_t)packet[5]<<8) | ((uint16_t)packet[6]);
-                totalPages = (totalPackets + packetsPerPage - 1) / packetsPerPage;
-                fraction = totalPackets / 25; //fraction for screen loading animation
-            }
-            else if(currentPage==totalPages) //on last page adjust number of packets to be written
-                packetsThisPage = (totalPackets - packetsPerPage * (currentPage - 1));
+        startTransfer(packet, uBit);
 
-            if(lastSeqN==0) //if first packet received
-            {
-                pageState = RECEIVING; //set state
-                // populate packet map & NAK map
-                for (uint16_t i=1; i<=packetsThisPage; i++)
-                {
-                    packetMap[i] = false;
-                    receivedNAKs[i] = false;
-                }
-            }
-        }
-        else
+        if(page > totalPages || pagesWritten.count(page) || seq == 0 || seq > packetsInPage(page))
             return;
 
+        if(lastSeqN==0) //if first packet received in this window
+            pageState = RECEIVING; //set state
+
+        // populate packet map for this page
+        initialisePage(page);
+
         // check if packet has already been written in case of retransmit
-        if(packetMap[seq])
+        if(packetMap[page][seq])
             return;
         
         // record last sequence number
         lastSeqN = seq;
         lastRxTime = uBit.systemTime();
 
-        // copy packet into buffer
-        memcpy(&pageBuffer[(seq-1)*R_PAYLOAD_SIZE], &packet[R_HEADER_SIZE],R_PAYLOAD_SIZE);
-        packetMap[seq] = true;
+        // burn the packet into its place in flash, copied to a word aligned buffer first
+        uint32_t data[R_PAYLOAD_SIZE/4];
+        memcpy(data, &packet[R_HEADER_SIZE], R_PAYLOAD_SIZE);
+
+        erasePage(page);
+        flash.flash_burn(packetAddress(page, seq), data, R_PAYLOAD_SIZE/4);
+        packetMap[page][seq] = true;
         packetsWritten++;
 
-        
+        // if every packet of the page is written, the page is complete
+        if(isPageWritten(page))
+            completePage(page, uBit);
+    }
+}
+
+/**
+ * Compare the packet hashes in a manifest from the sender against the current contents of FLASH_USER,
+ * every packet which already matches is kept and marked as received, so only changed packets are NAKed.
+ * If any packet differs the page is erased, with matching packets restored through the scratch page
+ *
+ * @param packet The received manifest packet
+ * @param uBit reference to the microbit device
+ */
+void MicroBitRadioFlashReceiver::handleManifestPacket(PacketBuffer packet, MicroBit &uBit)
+{
+    // Manifest Packet Structure (packet hashes, 4 bytes each, sequence number 1 first):
+    // 0    1   2   3    4   5       6       7        8        9          10      11  .... 15
+    // +---------------------------------------------------------------------------------------+
+    // | ID | Padding | Page # | Total packets | Header Checksum | Hash Checksum | Padding |
+    // +---------------------------------------------------------------------------------------+
+    // |                                       Hashes                                          |
+    // +---------------------------------------------------------------------------------------+
+
+    if(packet.length() < R_HEADER_SIZE + R_MANIFEST_SIZE)
+        return;
+
+    uint16_t recSum = ((uint16_t)packet[9]<<8) | ((uint16_t)packet[10]);
+    uint16_t sum = 0;
+    for(uint32_t j = R_HEADER_SIZE; j<R_HEADER_SIZE+R_MANIFEST_SIZE; j++)
+        sum+= packet[j];
+    if(sum!=recSum)
+        return;
+
+    uint16_t page = ((uint16_t)packet[3]<<8) | ((uint16_t)packet[4]);
+
+    if(page < currentPage || page >= currentPage + R_WINDOW_PAGES) //check manifest is for a page in the window
+        return;
 
-        // ManagedString out = ManagedString("RECEIVEDid: ") + ManagedString((int) id) + ManagedString("\n")
-        // + ManagedString("seq: ") + ManagedString((int)seq) + ManagedString("\n")
-        // + ManagedString("tpackets: ") + ManagedString((int)totalPackets) + ManagedString("\n")
-        // + ManagedString("\n");
-        // uBit.serial.send(out);
+    startTransfer(packet, uBit);
 
-        // if buffer fully written correctly, proceed to flash
-        if(isBufferWritten())
+    // ignore a manifest once the page has been erased, its previous contents are gone
+    if(page > totalPages || pagesWritten.count(page) || pagesErased.count(page))
+        return;
+
+    if(lastSeqN==0) //if first packet received in this window
+        pageState = RECEIVING; //set state
+
+    initialisePage(page);
+
+    // the manifest covers the whole page, so the page has started
+    lastSeqN = packetsInPage(page);
+    lastRxTime = uBit.systemTime();
+
+    uint16_t matched = 0;
+    for(uint16_t seq=1; seq<=packetsInPage(page); seq++)
+    {
+        if(packetMap[page][seq])
+            continue;
+
+        uint32_t hash = ((uint32_t)packet[R_HEADER_SIZE + (seq-1)*4]<<24) | ((uint32_t)packet[R_HEADER_SIZE + (seq-1)*4 + 1]<<16)
+                        | ((uint32_t)packet[R_HEADER_SIZE + (seq-1)*4 + 2]<<8) | ((uint32_t)packet[R_HEADER_SIZE + (seq-1)*4 + 3]);
+
+        // packet already present in flash, keep it instead of receiving it over the air
+        if(packetHash((uint8_t *)packetAddress(page, seq)) == hash)
         {
-            //flash buffered page to 0x71000 + (page #) * 4096
-            flashUserPage((USER_BASE_ADDRESS + ((currentPage-1) * R_FLASH_PAGE_SIZE)),pageBuffer);
-            
-            // reset buffer and flags
-            packetMap.clear();
-            receivedNAKs.clear();
-            lastSeqN = 0;
-            lastRxTime = 0;
-            pageState = RECEIVING;
-            memset(pageBuffer, 0, sizeof(pageBuffer));
-            currentPage++;
+            packetMap[page][seq] = true;
+            packetsWritten++;
+            matched++;
+            updateLoadingScreen(uBit);
+        }
+    }
 
-            if(currentPage>totalPages) //if all pages complete
-            {
-                transferComplete = true;
-                //compute statistics for evaluation of the system
-                uint32_t end_time = uBit.systemTime();
-                uint32_t total_time = end_time - start_time;
-                uint32_t throughput = ((totalPackets*R_PAYLOAD_SIZE*8000) / total_time);
-                
-                uint8_t packet[16] = {0};
-
-                //id
-                packet[0] = (uint8_t)((recID >> 24) & 0xFF);
-                packet[1] = (uint8_t)((recID >> 16) & 0xFF);
-                packet[2] = (uint8_t)((recID >> 8) & 0xFF);
-                packet[3] = (uint8_t)(recID & 0xFF);
-
-                //nak rounds
-                packet[4] = (uint8_t)((nakRounds >> 24) & 0xFF);
-                packet[5] = (uint8_t)((nakRounds >> 16) & 0xFF);
-                packet[6] = (uint8_t)((nakRounds >> 8) & 0xFF);
-                packet[7] = (uint8_t)(nakRounds & 0xFF);
-
-                //throughput
-                packet[8] = (uint8_t)((throughput >> 24) & 0xFF);
-                packet[9] = (uint8_t)((throughput >> 16) & 0xFF);
-                packet[10] = (uint8_t)((throughput >> 8) & 0xFF);
-                packet[11] = (uint8_t)(throughput & 0xFF);
-
-                //time
-                packet[12] = (uint8_t)((total_time >> 24) & 0xFF);
-                packet[13] = (uint8_t)((total_time >> 16) & 0xFF);
-                packet[14] = (uint8_t)((total_time >> 8) & 0xFF);
-                packet[15] = (uint8_t)(total_time & 0xFF);
-
-
-                //sleep for the amount of time between reset and start of transmission,
-                //this ensures that no two receivers have the same ID as long as they are not reset at the same time
-                uBit.sleep((recID));
-                PacketBuffer b(packet,16);
-
-                for(uint8_t i=0;i<3;i++)
-                {
-                    uBit.radio.datagram.send(b);
-                    uBit.sleep(rand() % 5);
-                }
-
-                //disable radio and perform system reset
-                uBit.sleep(2000);
-                uBit.radio.disable();
-                __DSB();
-                __ISB();
-                NVIC_SystemReset();
-            }
+    if(isPageWritten(page))
+    {
+        completePage(page, uBit);
+        return;
+    }
+
+    // some packets differ, so the page must be erased before they can be written
+    // preserve the matching packets in the scratch page and burn them back after the erase
+    uint32_t *scratch = (uint32_t *)MICROBIT_DEFAULT_SCRATCH_PAGE;
+    if(matched)
+    {
+        flash.erase_page(scratch);
+        flash.flash_burn(scratch, packetAddress(page, 1), R_FLASH_PAGE_SIZE/4);
+    }
+
+    erasePage(page);
+
+    for(uint16_t seq=1; seq<=packetsInPage(page) && matched; seq++)
+    {
+        if(packetMap[page][seq])
+            flash.flash_burn(packetAddress(page, seq), scratch + ((seq-1) * R_PAYLOAD_SIZE/4), R_PAYLOAD_SIZE/4);
+    }
+}
+
+/**
+ * Record the size of the transfer from the header of the first packet received from the sender
+ *
+ * @param packet A received sender, manifest or end of page packet
+ * @param uBit reference to the microbit device
+ */
+void MicroBitRadioFlashReceiver::startTransfer(PacketBuffer packet, MicroBit &uBit)
+{
+    if(totalPackets) //transfer already started
+        return;
+
+    recID = time; //set ID to time idle before transmission (used later for stats)
+    start_time = uBit.systemTime();
+
+    //calculate total pages from packet field
+    totalPackets = ((uint16_t)packet[5]<<8) | ((uint16_t)packet[6]);
+    totalPages = (totalPackets + packetsPerPage - 1) / packetsPerPage;
+    fraction = totalPackets / 25; //fraction for screen loading animation
+}
+
+/**
+ * Record a completely written page and slide the window past it,
+ * reports statistics and resets the device once the final page is written
+ *
+ * @param page the page number
+ * @param uBit reference to the microbit device
+ */
+void MicroBitRadioFlashReceiver::completePage(uint16_t page, MicroBit &uBit)
+{
+    // reset page state and record the page as written
+    packetMap.erase(page);
+    receivedNAKs.erase(page);
+    pagesErased.erase(page);
+    pagesWritten.insert(page);
+
+    // slide the window past every page written so far
+    while(pagesWritten.count(currentPage))
+    {
+        pagesWritten.erase(currentPage);
+        currentPage++;
+    }
+
+    // reset flags once no partially received pages remain
+    if(packetMap.empty())
+    {
+        lastSeqN = 0;
+        lastRxTime = 0;
+        pageState = RECEIVING;
+    }
+
+    if(currentPage>totalPages) //if all pages complete
+    {
+        transferComplete = true;
+        //compute statistics for evaluation of the system
+        uint32_t end_time = uBit.systemTime();
+        uint32_t total_time = end_time - start_time;
+        uint32_t throughput = total_time ? ((totalPackets*R_PAYLOAD_SIZE*8000) / total_time) : 0;
+        
+        uint8_t packet[16] = {0};
+
+        //id
+        packet[0] = (uint8_t)((recID >> 24) & 0xFF);
+        packet[1] = (uint8_t)((recID >> 16) & 0xFF);
+        packet[2] = (uint8_t)((recID >> 8) & 0xFF);
+        packet[3] = (uint8_t)(recID & 0xFF);
+
+        //nak rounds
+        packet[4] = (uint8_t)((nakRounds >> 24) & 0xFF);
+        packet[5] = (uint8_t)((nakRounds >> 16) & 0xFF);
+        packet[6] = (uint8_t)((nakRounds >> 8) & 0xFF);
+        packet[7] = (uint8_t)(nakRounds & 0xFF);
+
+        //throughput
+        packet[8] = (uint8_t)((throughput >> 24) & 0xFF);
+        packet[9] = (uint8_t)((throughput >> 16) & 0xFF);
+        packet[10] = (uint8_t)((throughput >> 8) & 0xFF);
+        packet[11] = (uint8_t)(throughput & 0xFF);
+
+        //time
+        packet[12] = (uint8_t)((total_time >> 24) & 0xFF);
+        packet[13] = (uint8_t)((total_time >> 16) & 0xFF);
+        packet[14] = (uint8_t)((total_time >> 8) & 0xFF);
+        packet[15] = (uint8_t)(total_time & 0xFF);
+
+
+        //sleep for the amount of time between reset and start of transmission,
+        //this ensures that no two receivers have the same ID as long as they are not reset at the same time
+        uBit.sleep((recID));
+        PacketBuffer b(packet,16);
+
+        for(uint8_t i=0;i<3;i++)
+        {
+            uBit.radio.datagram.send(b);
+            uBit.sleep(rand() % 5);
         }
+
+        //disable radio and perform system reset
+        uBit.sleep(2000);
+        uBit.radio.disable();
+        __DSB();
+        __ISB();
+        NVIC_SystemReset();
     }
 }
 
 /**
- * Extract received NAK sequence number, set receivedNAKs to true for that seq number
+ * Extract the received NAK bitmap, set receivedNAKs to true for every sequence number it contains
+ * and record the ID of the receiver that sent it
  * If still in RECEIVING state, enter RECOVERY
  * 
  * @param packet The received NAK packet
@@ -420,75 +639,126 @@ void MicroBitRadioFlashReceiver::handleSenderPacket(PacketBuffer packet, MicroBi
  */
 void MicroBitRadioFlashReceiver::handleReceiverPacket(PacketBuffer packet, MicroBit &uBit)
 {
+    if(packet.length() < R_HEADER_SIZE + R_NAK_BITMAP_SIZE)
+        return;
+
     // uint8_t id = packet[0];
-    uint16_t seq = ((uint16_t)packet[1]<<8) | ((uint16_t)packet[2]);
     uint16_t page = ((uint16_t)packet[3]<<8) | ((uint16_t)packet[4]);
+    uint16_t sender = ((uint16_t)packet[5]<<8) | ((uint16_t)packet[6]);
 
+    // bitmap checksum
+    uint16_t recSum = ((uint16_t)packet[9]<<8) | ((uint16_t)packet[10]);
+    uint16_t sum = 0;
+    for(uint32_t j = R_HEADER_SIZE; j<R_HEADER_SIZE+R_NAK_BITMAP_SIZE; j++)
+        sum+= packet[j];
+    if(sum!=recSum)
+        return;
+
+    if(sender!=receiverID)
+        receiversHeard.insert(sender);
+
+    if(page < currentPage || page >= currentPage + R_WINDOW_PAGES || page > totalPages)
+        return;
 
     // infer that transmission of the current page has ended if a NAK has been received, but still in RECEIVING state
-    if(page == currentPage && pageState==RECEIVING)
+    if(pageState==RECEIVING)
     {
         // uBit.serial.send("--Recover heard NAK--\n\n");
         pageState = RECOVERY;
-        uBit.sleep(rand() % (3*R_NAK_WINDOW));
+        uBit.sleep(rand() % (3*nakWindow()));
         readyToNAK = true;
     }
-        
-    // ManagedString out = ManagedString("RECEIVEDid: ") + ManagedString((int) id) + ManagedString("\n")
-    // + ManagedString("seq: ") + ManagedString((int)seq) + ManagedString("\n") + ManagedString("\n");
-    // uBit.serial.send(out);
 
-    receivedNAKs[seq] = true; // add NAK to map of NAKs
+    // add every NAKed sequence number to map of NAKs, so this receiver does not repeat them
+    for(uint16_t i=1; i<=packetsInPage(page); i++)
+    {
+        if(packet[R_HEADER_SIZE + ((i-1) >> 3)] & (1 << ((i-1) & 7)))
+            receivedNAKs[page][i] = true;
+    }
 }
 
 /**
- * Send NAKs for packets which haven't been received and for which no NAK
- * has been detected from another receiver
+ * Send NAKs for every page in the window with packets which haven't been received
  * @param uBit reference to the microbit device 
  */
 void MicroBitRadioFlashReceiver::sendNAKs(MicroBit &uBit)
 {
-    nakRounds++;
     // uBit.serial.send(ManagedString("Sending NAKs\n\n"));
 
-    // NAK Packet Structure
-    // 0    1              2               3    4   5  .....  7    8     9 ....  15  
-    // +---------------------------------------------------------------------------+
-    // | ID | Seq of packet for retransmit | Page # | Padding | Checksum | Padding |
-    // +---------------------------------------------------------------------------+
+    // one NAK is sent per page in the window with missing packets
+    for(uint16_t page = currentPage; page <= lastPageInWindow(); page++)
+    {
+        if(!pagesWritten.count(page))
+            sendPageNAK(page, uBit);
+    }
+}
 
-    for(uint16_t i=1; i<=packetMap.size(); i++)
+/**
+ * Send a single bitmap NAK for the packets of one page which haven't been received and for which no NAK
+ * has been detected from another receiver, nothing is sent if every missing packet has already been NAKed
+ * @param page the page number to NAK
+ * @param uBit reference to the microbit device
+ */
+void MicroBitRadioFlashReceiver::sendPageNAK(uint16_t page, MicroBit &uBit)
+{
+    // NAK Packet Structure (bit 0 of the bitmap = sequence number 1)
+    // 0    1         2    3    4   5        6      7        8        9       10      11 .... 15   16 ......
+    // +----------------------------------------------------------------------------------------+-----------+
+    // | ID | Missing count | Page # | Receiver ID | Header Checksum | Bitmap Checksum | Padding | Bitmap    |
+    // +----------------------------------------------------------------------------------------+-----------+
+
+    uint8_t packet[R_HEADER_SIZE + R_NAK_BITMAP_SIZE] = {0};
+    uint16_t missing = 0;
+
+    initialisePage(page);
+    for(uint16_t i=1; i<=packetMap[page].size(); i++)
     {
-        if(!packetMap.at(i) && !receivedNAKs.at(i)) //if the packet has not been received and a NAK has not been heard for it, send a NAK
+        if(!packetMap[page].at(i) && !receivedNAKs[page][i]) //if the packet has not been received and a NAK has not been heard for it, add it to the bitmap
         {
-            uint8_t packet[R_HEADER_SIZE] = {0};
-            // sequence number (ID for receiver is 121)
-            packet[0] = 121;
-            packet[1] = (uint8_t)((i >> 8) & 0xFF);
-            packet[2] = (uint8_t)(i & 0xFF);
-
-            // current page
-            packet[3] = (uint8_t)((currentPage >> 8) & 0xFF);
-            packet[4] = (uint8_t)(currentPage & 0xFF);
-            
-            // header checksum
-            uint16_t hsum = 0;
-            for(uint32_t j = 0; j<7; j++)
-            {
-                hsum+= packet[j];
-            }
-            packet[7] = (uint8_t)((hsum >> 8) & 0xFF);
-            packet[8] = (uint8_t)((hsum & 0xFF));
-        
-            // ManagedString out = ManagedString("NAKid: ") + ManagedString((int)packet[0]) + ManagedString("\n")
-            // + ManagedString("seq: ") + ManagedString((int)((uint16_t)packet[1]<<8) | ((uint16_t)packet[2])) + ManagedString("\n")
-            // + ManagedString("Header checksum: ") + ManagedString((int)((uint16_t)packet[7]<<8) | ((uint16_t)packet[8])) + ManagedString("\n") + ManagedString("\n");
-            // uBit.serial.send(out);
-
-            //send the packet
-            PacketBuffer b(packet,R_HEADER_SIZE);
-            uBit.radio.datagram.send(b);
-            uBit.sleep(R_SLEEP_TIME);
+            packet[R_HEADER_SIZE + ((i-1) >> 3)] |= (1 << ((i-1) & 7));
+            missing++;
         }
     }
-}
\ No newline at end of file
+
+    // every missing packet has already been NAKed by another receiver, suppress this NAK
+    if(!missing)
+        return;
+
+    nakRounds++;
+
+    // ID for receiver is 121
+    packet[0] = 121;
+    packet[1] = (uint8_t)((missing >> 8) & 0xFF);
+    packet[2] = (uint8_t)(missing & 0xFF);
+
+    // page being NAKed
+    packet[3] = (uint8_t)((page >> 8) & 0xFF);
+    packet[4] = (uint8_t)(page & 0xFF);
+
+    // receiver ID
+    packet[5] = (uint8_t)((receiverID >> 8) & 0xFF);
+    packet[6] = (uint8_t)(receiverID & 0xFF);
+
+    // header checksum
+    uint16_t hsum = 0;
+    for(uint32_t j = 0; j<7; j++)
+    {
+        hsum+= packet[j];
+    }
+    packet[7] = (uint8_t)((hsum >> 8) & 0xFF);
+    packet[8] = (uint8_t)((hsum & 0xFF));
+
+    // bitmap checksum
+    uint16_t sum = 0;
+    for(uint32_t j = R_HEADER_SIZE; j<R_HEADER_SIZE+R_NAK_BITMAP_SIZE; j++)
+    {
+        sum+= packet[j];
+    }
+    packet[9] = (uint8_t)((sum >> 8) & 0xFF);
+    packet[10] = (uint8_t)((sum & 0xFF));
+
+    //send the packet
+    PacketBuffer b(packet,R_HEADER_SIZE + R_NAK_BITMAP_SIZE);
+    uBit.radio.datagram.send(b);
+    uBit.sleep(R_SLEEP_TIME);
+}
@@ -86,6 +86,8 @@ MicroBitRadioFlashSender::MicroBitRadioFlashSender(MicroBit &uBit)
     this->totalPages = (totalPackets + packetsPerPage - 1)/ packetsPerPage;
 
     this->NAKTimeout = 0;
+    this->windowBase = 1;
+    this->nextPage = 1;
 
     this->packetsSent = 0;
     this->xPixel = 0;
@@ -94,6 +96,10 @@ MicroBitRadioFlashSender::MicroBitRadioFlashSender(MicroBit &uBit)
 
     uBit.radio.setGroup(42);
     uBit.radio.setTransmitPower(4);
+#ifdef R_CCM_KEY
+    static const uint8_t key[MICROBIT_RADIO_CCM_KEY_SIZE] = R_CCM_KEY;
+    uBit.radio.setEncryptionKey(42, key);
+#endif
     uBit.radio.enable();
 }
 
@@ -108,22 +114,30 @@ MicroBitRadioFlashSender::MicroBitRadioFlashSender(MicroBit &uBit)
 void MicroBitRadioFlashSender::Smain(MicroBit &uBit)
 {
     srand(uBit.systemTime());
-    for(uint32_t currentPage = 1; currentPage <=totalPages; currentPage++)
+    for(windowBase = 1; windowBase <=totalPages; windowBase = nextPage)
     {
-        // uBit.serial.send("---Sending page---\n\n");
+        // uBit.serial.send("---Sending window---\n\n");
 
-        // clear NAKs at each new page
+        // clear NAKs at each new window
         receivedNAKs.clear();
 
-        // if last page, send remainder of packets instead of # packets per page
-        if(currentPage==totalPages)
+        // send every page in the window back to back, in delta mode only the manifest is sent
+        // and receivers NAK the packets which differ from their own image
+        for(nextPage = windowBase; nextPage < windowBase + R_WINDOW_PAGES && nextPage <= totalPages; nextPage++)
         {
-            uint32_t remBytes = user_size - ((currentPage - 1) * R_FLASH_PAGE_SIZE);
-            uint32_t remPackets = (remBytes + R_PAYLOAD_SIZE - 1) / R_PAYLOAD_SIZE;
-            sendPage(remPackets, currentPage, uBit);
+#if R_DELTA_TRANSFER
+            sendManifest(nextPage, uBit);
+
+            // the manifest stands for every packet in the page, so advance the loading screen by the same amount
+            for(uint16_t i = 1; i<=packetsInPage(nextPage); i++)
+            {
+                updateLoadingScreen(uBit);
+                packetsSent++;
+            }
+#else
+            sendPage(packetsInPage(nextPage), nextPage, uBit);
+#endif
         }
-        else
-            sendPage(packetsPerPage, currentPage, uBit);
 
         sendEndOfPagePacket(uBit);
 
@@ -139,29 +153,32 @@ void MicroBitRadioFlashSender::Smain(MicroBit &uBit)
                 if((p[0] == 121) && isHeaderCheckSumOK(p))
                 {
                     NAKTimeout = uBit.systemTime();
-                    handleNAK(p, currentPage, uBit);
+                    handleNAK(p, uBit);
                 }
             }
             
-            if(receivedNAKs.empty() && (uBit.systemTime()-NAKTimeout)>(2*R_NAK_WINDOW)) //if no NAKs and time since last NAK is greater than 2*window, count empty round
+            // NAK window scaled by the number of distinct receivers heard so far
+            uint32_t nakWindow = R_NAK_WINDOW_SCALED(receiversHeard.size());
+
+            if(receivedNAKs.empty() && (uBit.systemTime()-NAKTimeout)>(2*nakWindow)) //if no NAKs and time since last NAK is greater than 2*window, count empty round
             {
                 // uBit.serial.send("---Empty---\n\n");
                 emptyRound++;
                 NAKTimeout = uBit.systemTime();
             }
                 
-            if(!receivedNAKs.empty() && (uBit.systemTime()-NAKTimeout)>(R_NAK_WINDOW)) //if there are NAKs and time since last NAK received is greater than window, retransmit
+            if(!receivedNAKs.empty() && (uBit.systemTime()-NAKTimeout)>(nakWindow)) //if there are NAKs and time since last NAK received is greater than window, retransmit
             {
                 // uBit.serial.send("---Retransmit---\n\n");
                 emptyRound = 0;
                 NAKTimeout = uBit.systemTime();
-                //retransmit
-                for(auto seq : receivedNAKs)
-                    sendSinglePacket(seq, currentPage, uBit);
+                //retransmit, NAKs for every page in the window are served in one round
+                for(auto pageSeq : receivedNAKs)
+                    sendSinglePacket(pageSeq.second, pageSeq.first, uBit);
                 receivedNAKs.clear();
                 sendEndOfPagePacket(uBit);
             }
-            if(emptyRound>5) // Exit after five empty rounds
+            if(emptyRound>5) // Exit after five empty rounds, every receiver has the whole window so slide it on
             {
                 // uBit.serial.send("---Exit listening for NAKs---\n\n");
                 break;
@@ -215,6 +232,23 @@ void MicroBitRadioFlashSender::Smain(MicroBit &uBit)
     uBit.display.clear();   
 }
 
+/**
+ * Calculates the number of packets in the given page, the last page sends the remainder of the packets
+ * instead of packetsPerPage
+ * @param page the page number
+ * @return number of packets in the page
+ */
+uint16_t MicroBitRadioFlashSender::packetsInPage(uint32_t page)
+{
+    if(page==totalPages)
+    {
+        uint32_t remBytes = user_size - ((page - 1) * R_FLASH_PAGE_SIZE);
+        return (remBytes + R_PAYLOAD_SIZE - 1) / R_PAYLOAD_SIZE;
+    }
+
+    return packetsPerPage;
+}
+
 void MicroBitRadioFlashSender::sendEndOfPagePacket(MicroBit &uBit)
 {
     // uBit.serial.send("---End of page---\n\n");
@@ -223,6 +257,20 @@ void MicroBitRadioFlashSender::sendEndOfPagePacket(MicroBit &uBit)
     //packet ID (122 for end of page packet)
     packet[0] = 122;
 
+    //number of distinct receivers heard from, used by receivers to scale their NAK window
+    uint16_t receivers = receiversHeard.size();
+    packet[1] = (uint8_t)((receivers >> 8) & 0xFF);
+    packet[2] = (uint8_t)(receivers & 0xFF);
+
+    //last page of the window which has been sent
+    uint16_t lastPage = nextPage - 1;
+    packet[3] = (uint8_t)((lastPage >> 8) & 0xFF);
+    packet[4] = (uint8_t)(lastPage & 0xFF);
+
+    //total packets, so a receiver which missed every other packet can still NAK the window
+    packet[5] = (uint8_t)((totalPackets >> 8) & 0xFF);
+    packet[6] = (uint8_t)(totalPackets & 0xFF);
+
     //header checksum
     uint16_t hsum = 0;
     for(uint32_t i = 0; i<7; i++)
@@ -307,12 +355,84 @@ void MicroBitRadioFlashSender::sendSinglePacket(uint16_t seq, uint32_t currentPa
     // + ManagedString("data checksum: ") + ManagedString((int)((uint16_t)packet[9]<<8) | ((uint16_t)packet[10])) + ManagedString("\n") + ManagedString("\n");
     // uBit.serial.send(out);
     
-    sendTimes[seq] = uBit.systemTime(); //record time sent for round trip time estimate
+    sendTimes[std::make_pair(seq,(uint16_t)currentPage)] = uBit.systemTime(); //record time sent for round trip time estimate
     uBit.radio.datagram.send(b); //send packet
     
     uBit.sleep(R_SLEEP_TIME + (rand() % 2));  
 }
 
+void MicroBitRadioFlashSender::sendManifest(uint32_t currentPage, MicroBit &uBit)
+{
+    // Manifest Packet Structure (packet hashes, 4 bytes each, sequence number 1 first):
+    // 0    1   2   3    4   5       6       7        8        9          10      11  .... 15
+    // +---------------------------------------------------------------------------------------+
+    // | ID | Padding | Page # | Total packets | Header Checksum | Hash Checksum | Padding |
+    // +---------------------------------------------------------------------------------------+
+    // |                                       Hashes                                          |
+    // +---------------------------------------------------------------------------------------+
+
+    uint8_t packet[R_HEADER_SIZE + R_MANIFEST_SIZE] = {0};
+
+    // 123 for manifest packet
+    packet[0] = 123;
+
+    // page #
+    packet[3] = (uint8_t)((currentPage >> 8) & 0xFF);
+    packet[4] = (uint8_t)(currentPage & 0xFF);
+
+    // total packets
+    packet[5] = (uint8_t)((totalPackets >> 8) & 0xFF);
+    packet[6] = (uint8_t)(totalPackets & 0xFF);
+
+    // header checksum
+    uint16_t hsum = 0;
+    for(uint32_t i = 0; i<7; i++)
+    {
+        hsum+= packet[i];
+    }
+    packet[7] = (uint8_t)((hsum >> 8) & 0xFF);
+    packet[8] = (uint8_t)(hsum & 0xFF);
+
+    // hash of every packet in the page, computed over the same zero padded payload sendSinglePacket would send
+    for(uint16_t seq = 1; seq<=packetsInPage(currentPage); seq++)
+    {
+        uint32_t absolutePacket = ((currentPage - 1) * packetsPerPage) + (seq - 1);
+        uint8_t *packetAddress = &__user_start__ + (absolutePacket * R_PAYLOAD_SIZE);
+        uint32_t len = (user_end-(uint32_t)packetAddress)<R_PAYLOAD_SIZE ? (user_end-(uint32_t)packetAddress) : R_PAYLOAD_SIZE;
+        uint32_t hash = packetHash(packetAddress, len);
+
+        packet[R_HEADER_SIZE + (seq-1)*4] = (uint8_t)((hash >> 24) & 0xFF);
+        packet[R_HEADER_SIZE + (seq-1)*4 + 1] = (uint8_t)((hash >> 16) & 0xFF);
+        packet[R_HEADER_SIZE + (seq-1)*4 + 2] = (uint8_t)((hash >> 8) & 0xFF);
+        packet[R_HEADER_SIZE + (seq-1)*4 + 3] = (uint8_t)(hash & 0xFF);
+    }
+
+    // hash checksum
+    uint16_t sum = 0;
+    for(uint32_t j = R_HEADER_SIZE; j<R_HEADER_SIZE+R_MANIFEST_SIZE; j++)
+    {
+        sum+= packet[j];
+    }
+    packet[9] = (uint8_t)((sum >> 8) & 0xFF);
+    packet[10] = (uint8_t)((sum & 0xFF));
+
+    PacketBuffer b(packet,R_HEADER_SIZE+R_MANIFEST_SIZE);
+    uBit.radio.datagram.send(b);
+
+    uBit.sleep(R_SLEEP_TIME + (rand() % 2));
+}
+
+uint32_t MicroBitRadioFlashSender::packetHash(const uint8_t *data, uint32_t len)
+{
+    uint32_t hash = 2166136261UL;
+    for(uint32_t i = 0; i<R_PAYLOAD_SIZE; i++)
+    {
+        hash ^= i<len ? data[i] : 0;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
 void MicroBitRadioFlashSender::sendPage(uint16_t npackets, uint32_t currentPage, MicroBit &uBit)
 {
     //send all packets in a page and update loading screen
@@ -324,28 +444,46 @@ void MicroBitRadioFlashSender::sendPage(uint16_t npackets, uint32_t currentPage,
     }
 }
 
-void MicroBitRadioFlashSender::handleNAK(PacketBuffer p, uint32_t currentPage, MicroBit &uBit)
+void MicroBitRadioFlashSender::handleNAK(PacketBuffer p, MicroBit &uBit)
 {
-    // NAK Packet Structure
-    // 0    1              2               3    4   5  .....  7    8     9 .....  15  
-    // +---------------------------------------------------------------------------+
-    // | ID | Seq of packet for retransmit | Page # | Padding | Checksum | Padding |
-    // +---------------------------------------------------------------------------+
+    // NAK Packet Structure (bit 0 of the bitmap = sequence number 1)
+    // 0    1         2    3    4   5        6      7        8        9       10      11 .... 15   16 ......
+    // +----------------------------------------------------------------------------------------+-----------+
+    // | ID | Missing count | Page # | Receiver ID | Header Checksum | Bitmap Checksum | Padding | Bitmap    |
+    // +----------------------------------------------------------------------------------------+-----------+
+
+    if(p.length() < R_HEADER_SIZE + R_NAK_BITMAP_SIZE)
+        return;
+
+    // bitmap checksum
+    uint16_t recSum = ((uint16_t)p[9]<<8) | ((uint16_t)p[10]);
+    uint16_t sum = 0;
+    for(uint32_t j = R_HEADER_SIZE; j<R_HEADER_SIZE+R_NAK_BITMAP_SIZE; j++)
+        sum+= p[j];
+    if(sum!=recSum)
+        return;
 
     //extract NAK packet info
     // uint8_t id = p[0];
-    uint16_t seq = ((uint16_t)p[1]<<8) | ((uint16_t)p[2]);
     uint16_t page = ((uint16_t)p[3]<<8) | ((uint16_t)p[4]);
+    uint16_t receiver = ((uint16_t)p[5]<<8) | ((uint16_t)p[6]);
 
-    std::pair<uint16_t,uint16_t> seqPage = {seq,page};
-    rtts[seqPage] = uBit.systemTime() - sendTimes[seq]; //record rtt for NAKed packet
+    receiversHeard.insert(receiver);
 
-    uint16_t pageN = ((uint16_t)p[3]<<8) | ((uint16_t)p[4]);
-    // only accept NAKs for the current page
-    if(pageN!=currentPage)
+    // only accept NAKs for pages in the current window which have been sent
+    if(page<windowBase || page>=nextPage)
         return;
 
     // uBit.serial.send(ManagedString("FOO\n"));
 
-    receivedNAKs.insert(seq); //record NAK
+    for(uint16_t seq=1; seq<=packetsInPage(page); seq++)
+    {
+        if(p[R_HEADER_SIZE + ((seq-1) >> 3)] & (1 << ((seq-1) & 7)))
+        {
+            std::pair<uint16_t,uint16_t> seqPage = {seq,page};
+            rtts[seqPage] = uBit.systemTime() - sendTimes[seqPage]; //record rtt for NAKed packet
+
+            receivedNAKs.insert(std::make_pair(page,seq)); //record NAK
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,535 @@
+/*
+The MIT License (MIT)
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+#include "MicroBitRadio.h"
+#include "MicroBitDevice.h"
+#include "CodalFiber.h"
+#include "Timer.h"
+
+using namespace codal;
+
+/**
+  * Provides reliable delivery of messages of arbitrary length between two micro:bits.
+  *
+  * Messages are split into fragments which are sent under a sliding window. The receiver acknowledges with a bitmap
+  * of every fragment it holds, so only the fragments actually lost are retransmitted. The retransmission timeout follows
+  * the measured round trip time, in the manner of RFC 6298.
+  */
+
+#define STREAM_BIT_SET(bitmap, i)   ((bitmap)[(i) >> 3] & (1 << ((i) & 7)))
+#define STREAM_SET_BIT(bitmap, i)   ((bitmap)[(i) >> 3] |= (1 << ((i) & 7)))
+
+/**
+  * Constructor.
+  *
+  * Creates an instance of a MicroBitRadioStream which offers reliable delivery of
+  * messages of arbitrary length to other micro:bits in the vicinity.
+  *
+  * @param r The underlying radio module used to send and receive data.
+  */
+MicroBitRadioStream::MicroBitRadioStream(MicroBitRadio &r) : radio(r)
+{
+    this->address = 0;
+
+    this->sending = false;
+    this->txDestination = 0;
+    this->txMessageId = 0;
+    this->txSeeded = false;
+    this->txCount = 0;
+    this->txTransmissions = NULL;
+    this->txSendTime = NULL;
+    this->txProgress = false;
+
+    this->srtt = 0;
+    this->rttvar = 0;
+    this->rto = MICROBIT_RADIO_STREAM_INITIAL_RTO;
+
+    memset(slots, 0, sizeof(slots));
+    this->rxQueueLength = 0;
+    this->lastSource = 0;
+    this->lastMessageId = 0;
+    this->lastCount = 0;
+
+    this->bytesSent = 0;
+    this->fragmentsSent = 0;
+    this->retransmissions = 0;
+    this->timeSending = 0;
+}
+
+/**
+  * Retrieves the address other micro:bits use to send messages to this one.
+  *
+  * @return The 16 bit address of this micro:bit.
+  */
+uint16_t MicroBitRadioStream::getAddress()
+{
+    // Address 0 marks a free reassembly slot, so is never used.
+    if (address == 0)
+        address = (microbit_serial_number() & 0xFFFF) ? (microbit_serial_number() & 0xFFFF) : 1;
+
+    return address;
+}
+
+/**
+  * Retrieves the current retransmission timeout.
+  *
+  * @return The retransmission timeout in milliseconds.
+  */
+int MicroBitRadioStream::getRetransmissionTimeout()
+{
+    return rto;
+}
+
+/**
+  * Transmits a single stream frame.
+  */
+int MicroBitRadioStream::sendFrame(uint8_t type, uint8_t messageId, uint16_t destination, uint8_t index, uint8_t count, const uint8_t *payload, int len)
+{
+    FrameBuffer buf;
+    uint16_t source = getAddress();
+
+    buf.length = MICROBIT_RADIO_STREAM_HEADER_SIZE + len + MICROBIT_RADIO_HEADER_SIZE - 1;
+    buf.version = 1;
+    buf.group = 0;
+    buf.protocol = MICROBIT_RADIO_PROTOCOL_STREAM;
+
+    buf.payload[0] = type;
+    buf.payload[1] = messageId;
+    buf.payload[2] = source & 0xFF;
+    buf.payload[3] = source >> 8;
+    buf.payload[4] = destination & 0xFF;
+    buf.payload[5] = destination >> 8;
+    buf.payload[6] = index;
+    buf.payload[7] = count;
+    memcpy(&buf.payload[MICROBIT_RADIO_STREAM_HEADER_SIZE], payload, len);
+
+    return radio.send(&buf);
+}
+
+/**
+  * Updates the round trip estimate and retransmission timeout with a new measurement.
+  */
+void MicroBitRadioStream::rttSample(uint32_t rtt)
+{
+    if (srtt == 0)
+    {
+        // First measurement: SRTT = R, RTTVAR = R/2.
+        srtt = rtt << 3;
+        rttvar = rtt << 1;
+    }
+    else
+    {
+        // SRTT = 7/8 SRTT + 1/8 R, RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|.
+        int delta = (int)rtt - (int)(srtt >> 3);
+        srtt += delta;
+
+        if (delta < 0)
+            delta = -delta;
+
+        rttvar += delta - (int)(rttvar >> 2);
+    }
+
+    // RTO = SRTT + 4 * RTTVAR.
+    rto = (srtt >> 3) + rttvar;
+
+    if (rto < MICROBIT_RADIO_STREAM_MIN_RTO)
+        rto = MICROBIT_RADIO_STREAM_MIN_RTO;
+
+    if (rto > MICROBIT_RADIO_STREAM_MAX_RTO)
+        rto = MICROBIT_RADIO_STREAM_MAX_RTO;
+}
+
+/**
+  * Sends the given message to another micro:bit, and waits until it has been acknowledged.
+  *
+  * This is a blocking call, which must be made from a fiber.
+  *
+  * @param destination The address of the receiving micro:bit.
+  *
+  * @param buffer The message to send.
+  *
+  * @param len The length of the message, up to MICROBIT_RADIO_STREAM_MAX_FRAGMENTS * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE bytes.
+  *
+  * @return DEVICE_OK once the whole message is acknowledged, DEVICE_INVALID_PARAMETER if the parameters are invalid,
+  *         DEVICE_BUSY if another send is in progress, DEVICE_NO_RESOURCES if memory could not be allocated,
+  *         or DEVICE_CANCELLED if the receiver stopped responding.
+  */
+int MicroBitRadioStream::send(uint16_t destination, uint8_t *buffer, int len)
+{
+    int count = len ? (len + MICROBIT_RADIO_STREAM_FRAGMENT_SIZE - 1) / MICROBIT_RADIO_STREAM_FRAGMENT_SIZE : 1;
+
+    if ((buffer == NULL && len > 0) || len < 0 || count > MICROBIT_RADIO_STREAM_MAX_FRAGMENTS || destination == 0)
+        return DEVICE_INVALID_PARAMETER;
+
+    if (sending)
+        return DEVICE_BUSY;
+
+    txTransmissions = new uint8_t[count];
+    txSendTime = new CODAL_TIMESTAMP[count];
+
+    if (txTransmissions == NULL || txSendTime == NULL)
+    {
+        delete[] txTransmissions;
+        delete[] txSendTime;
+        txTransmissions = NULL;
+        txSendTime = NULL;
+
+        return DEVICE_NO_RESOURCES;
+    }
+
+    memset(txTransmissions, 0, count);
+    memset(txAcked, 0, sizeof(txAcked));
+
+    // Start from a random identifier after each reset. Otherwise our first message would share its identifier with the
+    // first message we sent before the reset, and a receiver that last heard that one would take it as a retransmission.
+    // This is done on first use rather than in the constructor, as the random number generator is seeded later.
+    if (!txSeeded)
+    {
+        txMessageId = microbit_random(256);
+        txSeeded = true;
+    }
+
+    sending = true;
+    txDestination = destination;
+    txMessageId++;
+    txCount = count;
+    txProgress = false;
+
+    CODAL_TIMESTAMP start = system_timer_current_time();
+    int retries = 0;
+    int result = DEVICE_OK;
+
+    while (result == DEVICE_OK)
+    {
+        // Any acknowledgement of a new fragment shows the receiver is still there.
+        if (txProgress)
+        {
+            retries = 0;
+            txProgress = false;
+        }
+
+        // The window starts at the first fragment not yet acknowledged.
+        int base = 0;
+        while (base < count && STREAM_BIT_SET(txAcked, base))
+            base++;
+
+        if (base == count)
+            break;
+
+        // Send any fragments in the window not yet sent, and resend those whose timer has expired.
+        bool timedOut = false;
+
+        for (int i = base; i < count && i < base + MICROBIT_RADIO_STREAM_WINDOW && result == DEVICE_OK; i++)
+        {
+            if (STREAM_BIT_SET(txAcked, i))
+                continue;
+
+            if (txTransmissions[i] && system_timer_current_time() - txSendTime[i] < rto)
+                continue;
+
+            if (txTransmissions[i])
+            {
+                timedOut = true;
+                retransmissions++;
+            }
+
+            int offset = i * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE;
+            result = sendFrame(MICROBIT_RADIO_STREAM_TYPE_DATA, txMessageId, destination, i, count, buffer + offset, min(len - offset, MICROBIT_RADIO_STREAM_FRAGMENT_SIZE));
+
+            if (txTransmissions[i] < 0xFF)
+                txTransmissions[i]++;
+
+            txSendTime[i] = system_timer_current_time();
+            fragmentsSent++;
+        }
+
+        // Back off the timer on loss, as in RFC 6298, and give up if the receiver has gone quiet.
+        if (timedOut)
+        {
+            rto = min(rto * 2, MICROBIT_RADIO_STREAM_MAX_RTO);
+
+            if (++retries > MICROBIT_RADIO_STREAM_MAX_RETRIES)
+                result = DEVICE_CANCELLED;
+        }
+
+        // Let the idle callback process any acknowledgements.
+        fiber_sleep(1);
+    }
+
+    if (result == DEVICE_OK)
+        bytesSent += len;
+
+    timeSending += system_timer_current_time() - start;
+
+    delete[] txTransmissions;
+    delete[] txSendTime;
+    txTransmissions = NULL;
+    txSendTime = NULL;
+    sending = false;
+
+    return result;
+}
+
+/**
+  * Sends the given message to another micro:bit, and waits until it has been acknowledged.
+  *
+  * @param destination The address of the receiving micro:bit.
+  *
+  * @param data The message to send.
+  *
+  * @return DEVICE_OK once the whole message is acknowledged, or an error as described for send(uint16_t, uint8_t *, int).
+  */
+int MicroBitRadioStream::send(uint16_t destination, PacketBuffer data)
+{
+    return send(destination, (uint8_t *)data.getBytes(), data.length());
+}
+
+/**
+  * Sends the given string to another micro:bit, and waits until it has been acknowledged.
+  *
+  * @param destination The address of the receiving micro:bit.
+  *
+  * @param data The message to send.
+  *
+  * @return DEVICE_OK once the whole message is acknowledged, or an error as described for send(uint16_t, uint8_t *, int).
+  */
+int MicroBitRadioStream::send(uint16_t destination, ManagedString data)
+{
+    return send(destination, (uint8_t *)data.toCharArray(), data.length());
+}
+
+/**
+  * Retrieves the next complete message received.
+  *
+  * @param source If not NULL, receives the address of the sender.
+  *
+  * @return The message, or an empty PacketBuffer if no message is available.
+  */
+PacketBuffer MicroBitRadioStream::recv(uint16_t *source)
+{
+    if (rxQueueLength == 0)
+        return PacketBuffer::EmptyPacket;
+
+    PacketBuffer packet = rxQueue[0];
+
+    if (source)
+        *source = rxSource[0];
+
+    for (int i = 1; i < rxQueueLength; i++)
+    {
+        rxQueue[i - 1] = rxQueue[i];
+        rxSource[i - 1] = rxSource[i];
+    }
+
+    rxQueueLength--;
+    rxQueue[rxQueueLength] = PacketBuffer::EmptyPacket;
+
+    return packet;
+}
+
+/**
+  * Acknowledges a message to its sender, with the bitmap of fragments received.
+  */
+void MicroBitRadioStream::sendAck(uint16_t destination, uint8_t messageId, uint8_t index, uint8_t count, const uint8_t *received)
+{
+    sendFrame(MICROBIT_RADIO_STREAM_TYPE_ACK, messageId, destination, index, count, received, (count + 7) / 8);
+}
+
+/**
+  * Processes an acknowledgement for the message being sent.
+  */
+void MicroBitRadioStream::ackReceived(FrameBuffer *p)
+{
+    uint16_t source = p->payload[2] | (p->payload[3] << 8);
+    uint8_t messageId = p->payload[1];
+    uint8_t index = p->payload[6];
+    uint8_t count = p->payload[7];
+    uint8_t *received = &p->payload[MICROBIT_RADIO_STREAM_HEADER_SIZE];
+    int len = p->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_STREAM_HEADER_SIZE;
+
+    if (!sending || source != txDestination || messageId != txMessageId || count != txCount || len < (count + 7) / 8)
+        return;
+
+    // Measure the round trip from the fragment which caused this acknowledgement, unless it was
+    // retransmitted and so cannot be matched to a single transmission (Karn's algorithm).
+    if (index < count && !STREAM_BIT_SET(txAcked, index) && STREAM_BIT_SET(received, index) && txTransmissions[index] == 1)
+        rttSample(system_timer_current_time() - txSendTime[index]);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (STREAM_BIT_SET(received, i) && !STREAM_BIT_SET(txAcked, i))
+        {
+            STREAM_SET_BIT(txAcked, i);
+            txProgress = true;
+        }
+    }
+}
+
+/**
+  * Stores a received data fragment, and acknowledges it when required.
+  */
+void MicroBitRadioStream::dataReceived(FrameBuffer *p)
+{
+    uint16_t source = p->payload[2] | (p->payload[3] << 8);
+    uint8_t messageId = p->payload[1];
+    uint8_t index = p->payload[6];
+    uint8_t count = p->payload[7];
+    int len = p->length - (MICROBIT_RADIO_HEADER_SIZE - 1) - MICROBIT_RADIO_STREAM_HEADER_SIZE;
+
+    if (count == 0 || count > MICROBIT_RADIO_STREAM_MAX_FRAGMENTS || index >= count || len > MICROBIT_RADIO_STREAM_FRAGMENT_SIZE)
+        return;
+
+    // A retransmission from a message we have already delivered: the sender missed our final acknowledgement.
+    if (source == lastSource && messageId == lastMessageId && count == lastCount)
+    {
+        uint8_t received[MICROBIT_RADIO_STREAM_BITMAP_SIZE];
+        memset(received, 0xFF, sizeof(received));
+        sendAck(source, messageId, index, count, received);
+        return;
+    }
+
+    // Find the reassembly slot for this message, or claim a free or the least recently active one.
+    RadioStreamReassembly *slot = NULL;
+    RadioStreamReassembly *oldest = &slots[0];
+
+    for (int i = 0; i < MICROBIT_RADIO_STREAM_RX_SLOTS; i++)
+    {
+        if (slots[i].source == source && slots[i].messageId == messageId)
+        {
+            slot = &slots[i];
+            break;
+        }
+
+        if (slots[i].source == 0 || (oldest->source != 0 && slots[i].lastActivity < oldest->lastActivity))
+            oldest = &slots[i];
+    }
+
+    if (slot == NULL)
+    {
+        slot = oldest;
+
+        if (slot->data)
+            free(slot->data);
+
+        memset(slot, 0, sizeof(RadioStreamReassembly));
+        slot->data = (uint8_t *) malloc(count * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE);
+
+        if (slot->data == NULL)
+            return;
+
+        slot->source = source;
+        slot->messageId = messageId;
+        slot->count = count;
+    }
+
+    if (slot->count != count)
+        return;
+
+    slot->lastActivity = system_timer_current_time();
+
+    // Work out how this fragment fits with those we already hold.
+    bool duplicate = STREAM_BIT_SET(slot->received, index);
+    bool gapBefore = false;
+    bool dataAfter = false;
+    bool complete = true;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (i == index)
+            continue;
+
+        if (!STREAM_BIT_SET(slot->received, i))
+        {
+            complete = false;
+
+            if (i < index)
+                gapBefore = true;
+        }
+        else if (i > index)
+        {
+            dataAfter = true;
+        }
+    }
+
+    // If we have nowhere to put the completed message, drop the fragment and let the sender retry later.
+    if (complete && !duplicate && rxQueueLength >= MICROBIT_RADIO_STREAM_RX_QUEUE)
+        return;
+
+    if (!duplicate)
+    {
+        memcpy(&slot->data[index * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE], &p->payload[MICROBIT_RADIO_STREAM_HEADER_SIZE], len);
+        STREAM_SET_BIT(slot->received, index);
+
+        if (index == count - 1)
+            slot->length = index * MICROBIT_RADIO_STREAM_FRAGMENT_SIZE + len;
+    }
+
+    if (complete)
+    {
+        rxQueue[rxQueueLength] = PacketBuffer(slot->data, slot->length, p->rssi);
+        rxSource[rxQueueLength] = source;
+        rxQueueLength++;
+
+        lastSource = source;
+        lastMessageId = messageId;
+        lastCount = count;
+
+        sendAck(source, messageId, index, count, slot->received);
+
+        free(slot->data);
+        memset(slot, 0, sizeof(RadioStreamReassembly));
+
+        Event(DEVICE_ID_RADIO, MICROBIT_RADIO_EVT_STREAM);
+        return;
+    }
+
+    // Acknowledge every MICROBIT_RADIO_STREAM_ACK_EVERY in order fragments, and immediately on any loss or duplicate
+    // so that the sender learns which fragments are missing as early as possible.
+    if (duplicate || gapBefore || dataAfter || (index + 1) % MICROBIT_RADIO_STREAM_ACK_EVERY == 0)
+        sendAck(source, messageId, index, count, slot->received);
+}
+
+/**
+  * Protocol handler callback. This is called when the radio receives a packet marked as a stream frame.
+  *
+  * Data fragments addressed to us are reassembled and acknowledged, and acknowledgements update the message being sent.
+  */
+void MicroBitRadioStream::packetReceived()
+{
+    FrameBuffer *p = radio.recv();
+
+    if (p->length >= MICROBIT_RADIO_HEADER_SIZE - 1 + MICROBIT_RADIO_STREAM_HEADER_SIZE)
+    {
+        uint16_t destination = p->payload[4] | (p->payload[5] << 8);
+
+        if (destination == getAddress())
+        {
+            if (p->payload[0] == MICROBIT_RADIO_STREAM_TYPE_DATA)
+                dataReceived(p);
+
+            else if (p->payload[0] == MICROBIT_RADIO_STREAM_TYPE_ACK)
+                ackReceived(p);
+        }
+    }
+
+    delete p;
+}
@@ -31,6 +31,7 @@ DEALINGS IN THE SOFTWARE.
 #include "NRF52Pin.h"
 #include "CodalDmesg.h"
 #include "ErrorNo.h"
+#include "Event.h"
 
 using namespace codal;
 
@@ -62,6 +63,31 @@ NRF52LEDMatrix::NRF52LEDMatrix(NRFLowLevelTimer &displayTimer, const MatrixMap &
     lightLevel = 0;
     this->mode = mode;
 
+    // Allocate the frame buffers. The display is initially blank.
+    // Without them, render() falls back to reading the image directly, as a single buffered display.
+    frontBuffer = (uint8_t *) malloc(width * height);
+    backBuffer = (uint8_t *) malloc(width * height);
+
+    if (frontBuffer == NULL || backBuffer == NULL)
+    {
+        free(frontBuffer);
+        free(backBuffer);
+        frontBuffer = NULL;
+        backBuffer = NULL;
+    }
+    else
+    {
+        memset(frontBuffer, 0, width * height);
+    }
+    framePending = false;
+    frameShowing = false;
+    autoPresent = true;
+
+    // Allocate the strobe table, and populate it for the initial rotation.
+    // Without it, render() calculates the index of each pixel as it is strobed.
+    strobeTable = (uint16_t *) malloc(matrixMap.rows * matrixMap.columns * sizeof(uint16_t));
+    updateStrobeTable();
+
     // Validate that we can deliver the requested display.
     if (matrixMap.columns <= NRF52_LED_MATRIX_MAXIMUM_COLUMNS)
     {
@@ -110,12 +136,12 @@ void NRF52LEDMatrix::setDisplayMode(DisplayMode mode)
         timeslots++;
 
     timerPeriod = NRF52_LED_MATRIX_CLOCK_FREQUENCY / (NRF52_LED_MATRIX_FREQUENCY * timeslots);
-    quantum = (timerPeriod * brightness) / (256 * 255);
     
     timer.setCompare(0, timerPeriod);
     timer.timer->TASKS_CLEAR = 1;
 
     this->mode = mode;
+    updateLevels();
 }
 
 /**
@@ -140,6 +166,63 @@ DisplayMode NRF52LEDMatrix::getDisplayMode()
 void NRF52LEDMatrix::rotateTo(DisplayRotation rotation)
 {
     this->rotation = rotation;
+
+    // Ensure render() never strobes a row with a mixture of old and new rotations.
+    target_disable_irq();
+    updateStrobeTable();
+    target_enable_irq();
+}
+
+/**
+ * Recalculate the strobe table for the current rotation.
+ * This records, for each column of each row strobe, the index of the pixel in the frame buffer that drives it.
+ */
+void NRF52LEDMatrix::updateStrobeTable()
+{
+    uint16_t *index = strobeTable;
+
+    if (strobeTable == NULL)
+        return;
+
+    for (int row = 0; row < matrixMap.rows; row++)
+        for (int column = 0; column < matrixMap.columns; column++)
+            *index++ = getStrobeIndex(row, column);
+}
+
+/**
+ * Determine the index of the pixel in the frame buffer driven by the given column of the given row strobe, for the current rotation.
+ */
+uint16_t NRF52LEDMatrix::getStrobeIndex(int row, int column)
+{
+    MatrixPoint *p = (MatrixPoint *)matrixMap.map + column * matrixMap.rows + row;
+
+    switch ( this->rotation)
+    {
+      case MATRIX_DISPLAY_ROTATION_0:
+        return p->y * width + p->x;
+      case MATRIX_DISPLAY_ROTATION_90:
+        return p->x * width + width - 1 - p->y;
+      case MATRIX_DISPLAY_ROTATION_180:
+        return (height - 1 - p->y) * width + width - 1 - p->x;
+      case MATRIX_DISPLAY_ROTATION_270:
+        return ( height - 1 - p->x) * width + p->y;
+      default:
+        return p->y * width + p->x;
+    }
+}
+
+/**
+ * Recalculate the timer values used for each brightness level, following a change of mode or brightness.
+ */
+void NRF52LEDMatrix::updateLevels()
+{
+    quantum = (timerPeriod * brightness) / (256 * 255);
+
+    // Pixels are clipped to full brightness in black and white modes.
+    if (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE)
+        clipLevel = 255 * quantum;
+    else
+        clipLevel = 0;
 }
 
 /**
@@ -216,7 +299,7 @@ void NRF52LEDMatrix::disable()
  */
 void NRF52LEDMatrix::render()
 {
-    uint8_t *screenBuffer = image.getBitmap();
+    uint8_t *screenBuffer;
     uint32_t value;
 
     if (strobeRow < matrixMap.rows)
@@ -242,37 +325,44 @@ void NRF52LEDMatrix::render()
     // Move on to the next row.
     strobeRow = (strobeRow + 1) % timeslots;
 
+    // At the start of a new frame, swap in any frame that has been presented since the last one.
+    // This is the only point at which the frame being displayed changes, so frames are never torn.
+    if (strobeRow == 0)
+    {
+        if (frameShowing)
+        {
+            frameShowing = false;
+            Event(id, NRF52_LEDMATRIX_EVT_FRAME_COMPLETE);
+        }
+
+        if (framePending)
+        {
+            uint8_t *b = frontBuffer;
+            frontBuffer = backBuffer;
+            backBuffer = b;
+
+            framePending = false;
+            frameShowing = true;
+        }
+        else if (autoPresent && frontBuffer)
+        {
+            memcpy(frontBuffer, image.getBitmap(), width * height);
+        }
+    }
+
+    screenBuffer = frontBuffer ? frontBuffer : image.getBitmap();
+
     if(strobeRow < matrixMap.rows)
     {
-        // Common case - configure timer values.
-        MatrixPoint *p = (MatrixPoint *)matrixMap.map + strobeRow;
+        // Common case - configure timer values from the precomputed strobe table.
+        uint16_t *index = strobeTable ? strobeTable + strobeRow * matrixMap.columns : NULL;
 
         for (int column = 0; column < matrixMap.columns; column++)
         {
-            switch ( this->rotation)
-            {
-              case MATRIX_DISPLAY_ROTATION_0:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_90:
-                value = screenBuffer[ p->x * width + width - 1 - p->y];
-                break;
-              case MATRIX_DISPLAY_ROTATION_180:
-                value = screenBuffer[ (height - 1 - p->y) * width + width - 1 - p->x];
-                break;
-              case MATRIX_DISPLAY_ROTATION_270:
-                value = screenBuffer[ ( height - 1 - p->x) * width + p->y];
-                break;
-              default:
-                value = screenBuffer[ p->y * width + p->x];
-                break;
-            }
-
-            // Clip pixels to full or zero brightness if in black and white mode.
-            if (mode == DISPLAY_MODE_BLACK_AND_WHITE || mode == DISPLAY_MODE_BLACK_AND_WHITE_LIGHT_SENSE)
-                value = value ? 255 : 0;
-
-            value = value * quantum;
+            value = screenBuffer[index ? index[column] : getStrobeIndex(strobeRow, column)];
+
+            // In black and white mode, any lit pixel is driven at full brightness.
+            value = (clipLevel && value) ? clipLevel : value * quantum;
             timer.timer->CC[column+1] = value;
 
             // Set the initial polarity of the column output to HIGH if the pixel brightness is >0. LOW otherwise.
@@ -280,8 +370,6 @@ void NRF52LEDMatrix::render()
                 NRF_GPIOTE->CONFIG[gpiote[column]] &= ~0x00100000;
             else
                 NRF_GPIOTE->CONFIG[gpiote[column]] |= 0x00100000;
-            
-            p += matrixMap.rows;
         }
 
         // Enable the drive pin, and start the timer.
@@ -331,6 +419,42 @@ void NRF52LEDMatrix::clear()
     image.clear();
 }
 
+/**
+ * Presents the current contents of the display image.
+ *
+ * The image is copied, and displayed from the start of the next frame, so it can be
+ * redrawn straight away without affecting what is shown. A NRF52_LEDMATRIX_EVT_FRAME_COMPLETE
+ * event is raised once the frame has been completely displayed.
+ * If there was insufficient memory for the frame buffers, the image is instead displayed as it is drawn.
+ *
+ * @code
+ * display.setAutoPresent(false);
+ * display.image.setPixelValue(2, 2, 255);
+ * display.present();
+ * @endcode
+ */
+void NRF52LEDMatrix::present()
+{
+    // Hold off render() while the back buffer is refreshed. If a previously presented frame
+    // has not yet been displayed, it is replaced by this one.
+    target_disable_irq();
+    if (backBuffer)
+        memcpy(backBuffer, image.getBitmap(), width * height);
+    framePending = true;
+    target_enable_irq();
+}
+
+/**
+ * Determines whether the display image is presented automatically at the start of every frame (the default).
+ * Disable this to draw into the image over time, and only show the result when present() is called.
+ *
+ * @param autoPresent true to present the image at the start of every frame, false to only update the display on present().
+ */
+void NRF52LEDMatrix::setAutoPresent(bool autoPresent)
+{
+    this->autoPresent = autoPresent;
+}
+
 /**
  * Configures the brightness of the display.
  *
@@ -346,7 +470,7 @@ int NRF52LEDMatrix::setBrightness(int b)
         return result;
 
     // Recalculate our quantum based on the new brightness setting.
-    quantum = (timerPeriod * brightness) / (256 * 255);
+    updateLevels();
 
     return DEVICE_OK;
 }
@@ -406,4 +530,8 @@ int NRF52LEDMatrix::setSleep(bool doSleep)
 NRF52LEDMatrix::~NRF52LEDMatrix()
 {
     this->status &= ~DEVICE_COMPONENT_STATUS_SYSTEM_TICK;
+
+    free(frontBuffer);
+    free(backBuffer);
+    free(strobeTable);
 }
\ No newline at end of file
@@ -36,7 +36,11 @@ DEALINGS IN THE SOFTWARE.
 using namespace codal;
 
 const uint16_t MicroBitAccelerometerService::serviceUUID               = 0x0753;
-const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24 };
+const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4b, 0xfb24
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+                                                                         , 0xa7c0, 0xa7c1
+#endif
+                                                                         };
 
 
 /**
@@ -47,6 +51,9 @@ const uint16_t MicroBitAccelerometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xca4
   */
 MicroBitAccelerometerService::MicroBitAccelerometerService( BLEDevice &_ble, codal::Accelerometer &_accelerometer) :
         accelerometer(_accelerometer)
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+        , stream(*this, mbbs_cIdxSTREAM)
+#endif
 {
     // Initialise our characteristic values.
     accelerometerDataCharacteristicBuffer[0] = 0;
@@ -69,6 +76,19 @@ MicroBitAccelerometerService::MicroBitAccelerometerService( BLEDevice &_ble, cod
                          sizeof(accelerometerPeriodCharacteristicBuffer), sizeof(accelerometerPeriodCharacteristicBuffer),
                          microbit_propREAD | microbit_propWRITE);
 
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    CreateCharacteristic( mbbs_cIdxSTREAM, charUUID[ mbbs_cIdxSTREAM],
+                         stream.packet,
+                         0, sizeof(stream.packet),
+                         microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxSTREAMCONFIG, charUUID[ mbbs_cIdxSTREAMCONFIG],
+                         (uint8_t *)&stream.config,
+                         sizeof(stream.config), sizeof(stream.config),
+                         microbit_propREAD | microbit_propWRITE);
+#endif
+
     if ( getConnected())
         listen( true);
 }
@@ -119,6 +139,21 @@ void MicroBitAccelerometerService::onConnect( const microbit_ble_evt_t *p_ble_ev
 void MicroBitAccelerometerService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
 {
     listen( false);
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    stream.reset();
+#endif
+}
+
+
+/**
+  * Invoked when notifications have been sent, and there is space to queue more.
+  */
+void MicroBitAccelerometerService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    stream.flush();
+#endif
 }
 
 
@@ -137,6 +172,14 @@ void MicroBitAccelerometerService::onDataWritten( const microbit_ble_evt_write_t
         accelerometerPeriodCharacteristicBuffer = accelerometer.getPeriod();
         setChrValue( mbbs_cIdxPERIOD, (const uint8_t *)&accelerometerPeriodCharacteristicBuffer, sizeof(accelerometerPeriodCharacteristicBuffer));
     }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    if (params->handle == valueHandle( mbbs_cIdxSTREAMCONFIG))
+    {
+        stream.configure(params->data, params->len);
+        setChrValue( mbbs_cIdxSTREAMCONFIG, (const uint8_t *)&stream.config, sizeof(stream.config));
+    }
+#endif
 }
 
 
@@ -149,6 +192,11 @@ void MicroBitAccelerometerService::accelerometerUpdate(MicroBitEvent)
     {
         readXYZ();
         notifyChrValue( mbbs_cIdxDATA, (uint8_t *)accelerometerDataCharacteristicBuffer, sizeof(accelerometerDataCharacteristicBuffer));
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+        if ( notifyChrValueEnabled( mbbs_cIdxSTREAM))
+            stream.add( (int16_t) accelerometerDataCharacteristicBuffer[0], (int16_t) accelerometerDataCharacteristicBuffer[1], (int16_t) accelerometerDataCharacteristicBuffer[2]);
+#endif
     }
 }
 
@@ -34,6 +34,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitBLEServices.h"
 #include "MicroBitBLEChar.h"
+#include "MicroBitBLEManager.h"
 
 #include "ble.h"
 #include "ble_srv_common.h"
@@ -63,13 +64,20 @@ bool MicroBitBLEChar::setChrValue( microbit_gaphandle_t connection, const uint8_
 
 
 bool MicroBitBLEChar::notifyChrValue( microbit_gaphandle_t connection, const uint8_t *data, uint16_t length)
+{
+    return notifyChrValueStatus( connection, data, length) == DEVICE_OK;
+}
+
+
+int MicroBitBLEChar::notifyChrValueStatus( microbit_gaphandle_t connection, const uint8_t *data, uint16_t length)
 {
     if ( connection == BLE_CONN_HANDLE_INVALID)
-        return false;
+        return DEVICE_INVALID_STATE;
     
     MICROBIT_DEBUG_DMESG( "MicroBitBLEChar::notifyChrValue %d", (int) handles.value);
     
     bool set = false;
+    int result = DEVICE_INVALID_STATE;
     
     if ( cccdNotify())
     {
@@ -83,9 +91,19 @@ bool MicroBitBLEChar::notifyChrValue( microbit_gaphandle_t connection, const uin
         MICROBIT_DEBUG_DMESG( "calling sd_ble_gatts_hvx( %d, %x, %d, %d)",
                (int) handles.value, (unsigned int) data, (int) *data, (int) length);
         
-        if ( MICROBIT_BLE_ECHK( sd_ble_gatts_hvx( connection, &hvx_params)) == NRF_SUCCESS)
-            return true;
+        microbit_ble_ret_code_t err = MICROBIT_BLE_ECHK( sd_ble_gatts_hvx( connection, &hvx_params));
+        if ( err == NRF_SUCCESS)
+            return DEVICE_OK;
+
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+        // The SoftDevice's transmit queue is full, so the connection isn't keeping up.
+        if ( err == NRF_ERROR_RESOURCES && MicroBitBLEManager::manager)
+            MicroBitBLEManager::manager->governor.onTransmitBlocked();
+#endif
         
+        if ( err == NRF_ERROR_RESOURCES)
+            result = DEVICE_BUSY;
+
         if ( *hvx_params.p_len == length)
             set = true;
     }
@@ -93,7 +111,7 @@ bool MicroBitBLEChar::notifyChrValue( microbit_gaphandle_t connection, const uin
     if ( !set)
         setChrValue( connection, data, length);
     
-    return false;
+    return result;
 }
        
                              
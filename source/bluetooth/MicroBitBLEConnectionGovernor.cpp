@@ -0,0 +1,215 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for MicroBitBLEConnectionGovernor.
+  * Chooses connection parameters from the traffic on a connection.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLEConnectionGovernor.h"
+#include "codal_target_hal.h"
+
+using namespace codal;
+
+// Radio timing used to estimate the duty cycle, in microseconds.
+#define MICROBIT_BLE_GOVERNOR_EVENT_OVERHEAD    300     // Radio ramp up and an empty packet exchange, for each connection event.
+#define MICROBIT_BLE_GOVERNOR_PACKET_OVERHEAD   14      // Preamble, access address, header, MIC and CRC bytes in each packet.
+#define MICROBIT_BLE_GOVERNOR_PACKET_GAP        230     // Inter frame space and empty acknowledgement for each packet.
+
+
+MicroBitBLEBurstPolicy::MicroBitBLEBurstPolicy()
+{
+    reset( 0);
+}
+
+void MicroBitBLEBurstPolicy::reset( uint32_t now)
+{
+    lastActive = now;
+    lastBurst = 0;
+}
+
+int MicroBitBLEBurstPolicy::decide( const MicroBitBLETrafficSample &sample, int mode, uint32_t now)
+{
+    uint32_t packets = sample.txPackets + sample.rxPackets;
+
+    if ( packets > 0)
+        lastActive = now;
+
+    if ( sample.txBlocked > 0 || ( sample.period > 0 && packets * 1000 / sample.period >= MICROBIT_BLE_GOVERNOR_BURST_RATE))
+    {
+        lastBurst = now;
+        return MICROBIT_BLE_CONNECTION_MODE_FAST;
+    }
+
+    if ( mode == MICROBIT_BLE_CONNECTION_MODE_FAST && now - lastBurst < MICROBIT_BLE_GOVERNOR_BURST_HOLD)
+        return MICROBIT_BLE_CONNECTION_MODE_FAST;
+
+    if ( now - lastActive >= MICROBIT_BLE_GOVERNOR_IDLE_TIMEOUT)
+        return MICROBIT_BLE_CONNECTION_MODE_IDLE;
+
+    return MICROBIT_BLE_CONNECTION_MODE_DEFAULT;
+}
+
+
+/**
+  * Constructor.
+  */
+MicroBitBLEConnectionGovernor::MicroBitBLEConnectionGovernor()
+{
+    policy = &defaultPolicy;
+    payload = 20;
+    reset( 0, 0, 0);
+}
+
+/**
+  * Replace the policy used to choose the connection mode.
+  *
+  * @param policy The policy to use, or NULL to restore the default MicroBitBLEBurstPolicy.
+  */
+void MicroBitBLEConnectionGovernor::setPolicy( MicroBitBLEConnectionPolicy *policy)
+{
+    this->policy = policy ? policy : &defaultPolicy;
+    this->policy->reset( sampleTime);
+}
+
+/**
+  * Start measuring a new connection.
+  *
+  * @param now The current system time, in milliseconds.
+  * @param interval The connection interval, in 1.25ms units.
+  * @param latency The slave latency.
+  */
+void MicroBitBLEConnectionGovernor::reset( uint32_t now, uint16_t interval, uint16_t latency)
+{
+    txPackets = 0;
+    rxPackets = 0;
+    rxBytes = 0;
+    txBlocked = 0;
+
+    sampleTime = now;
+    sample.period = 0;
+    sample.txPackets = 0;
+    sample.rxPackets = 0;
+    sample.rxBytes = 0;
+    sample.txBlocked = 0;
+
+    mode = MICROBIT_BLE_CONNECTION_MODE_DEFAULT;
+    phy = 1;
+    setConnectionParameters( interval, latency);
+
+    policy->reset( now);
+}
+
+/**
+  * Record the connection parameters negotiated with the client.
+  */
+void MicroBitBLEConnectionGovernor::setConnectionParameters( uint16_t interval, uint16_t latency)
+{
+    this->interval = interval;
+    this->latency = latency;
+}
+
+/**
+  * Close the current sample period if it has ended, and consult the policy.
+  *
+  * @param now The current system time, in milliseconds.
+  *
+  * @return true if the connection mode has changed.
+  */
+bool MicroBitBLEConnectionGovernor::update( uint32_t now)
+{
+    if ( now - sampleTime < MICROBIT_BLE_GOVERNOR_SAMPLE_PERIOD)
+        return false;
+
+    target_disable_irq();
+    sample.txPackets = txPackets;
+    sample.rxPackets = rxPackets;
+    sample.rxBytes = rxBytes;
+    sample.txBlocked = txBlocked;
+    txPackets = 0;
+    rxPackets = 0;
+    rxBytes = 0;
+    txBlocked = 0;
+    target_enable_irq();
+
+    sample.period = now - sampleTime;
+    sampleTime = now;
+
+    int next = policy->decide( sample, mode, now);
+    if ( next == mode)
+        return false;
+
+    mode = next;
+    return true;
+}
+
+/**
+  * Estimate the throughput over the most recent sample period.
+  * Notification sizes are not reported by the SoftDevice, so each is counted as a full payload.
+  *
+  * @return The bytes per second sent and received.
+  */
+uint32_t MicroBitBLEConnectionGovernor::getThroughput()
+{
+    if ( sample.period == 0)
+        return 0;
+
+    return ( (uint32_t) sample.txPackets * payload + sample.rxBytes) * 1000 / sample.period;
+}
+
+/**
+  * Estimate the fraction of time the radio was active over the most recent sample period,
+  * from the connection interval, slave latency, PHY and packet counts.
+  *
+  * @return The estimated duty cycle, in parts per thousand.
+  */
+int MicroBitBLEConnectionGovernor::getDutyCycle()
+{
+    if ( sample.period == 0 || interval == 0)
+        return 0;
+
+    uint32_t periodUs = sample.period * 1000;
+    uint32_t intervalUs = interval * 1250;
+    uint32_t packets = sample.txPackets + sample.rxPackets;
+
+    // With slave latency we only wake for every (latency + 1)th connection event, unless there is data to send.
+    uint32_t eventPeriodUs = intervalUs * ( packets > 0 ? 1 : latency + 1);
+
+    uint32_t rxAverage = sample.rxPackets ? sample.rxBytes / sample.rxPackets : 0;
+    uint32_t txAirtime = ( payload + MICROBIT_BLE_GOVERNOR_PACKET_OVERHEAD) * 8 / phy + MICROBIT_BLE_GOVERNOR_PACKET_GAP;
+    uint32_t rxAirtime = ( rxAverage + MICROBIT_BLE_GOVERNOR_PACKET_OVERHEAD) * 8 / phy + MICROBIT_BLE_GOVERNOR_PACKET_GAP;
+
+    uint32_t activeUs = (uint64_t) periodUs * MICROBIT_BLE_GOVERNOR_EVENT_OVERHEAD / eventPeriodUs + sample.txPackets * txAirtime + sample.rxPackets * rxAirtime;
+
+    if ( activeUs >= periodUs)
+        return 1000;
+
+    return (int) ( (uint64_t) activeUs * 1000 / periodUs);
+}
+
+#endif
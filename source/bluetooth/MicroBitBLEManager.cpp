@@ -148,10 +148,13 @@ static void passkeyDisplayCallback( microbit_gaphandle_t handle, ManagedString p
 
 static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context);
 static void microbit_ble_pm_evt_handler(pm_evt_t const * p_evt);
+static void microbit_ble_gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt);
 static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context);
 
 static void microbit_dfu_init(void);
 
+static void microbit_ble_conn_params( int mode, ble_gap_conn_params_t *p_params);
+
 static void microbit_ble_configureAdvertising( bool connectable, bool discoverable, bool whitelist, uint16_t interval_ms, int timeout_seconds);
 
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL) || CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_UID)
@@ -375,17 +378,18 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
     MICROBIT_BLE_ECHK( pm_register( microbit_ble_pm_evt_handler));
 
     // Set up GAP
-    // Configure for high speed mode where possible.
     ble_gap_conn_params_t   gap_conn_params;
-    memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-    gap_conn_params.min_conn_interval = 8;      // 10 ms
-    gap_conn_params.max_conn_interval = 16;     // 20 ms
-    gap_conn_params.slave_latency     = 0;
-    gap_conn_params.conn_sup_timeout  = 400;    // 4s
+    microbit_ble_conn_params( MICROBIT_BLE_CONNECTION_MODE_DEFAULT, &gap_conn_params);
     MICROBIT_BLE_ECHK( sd_ble_gap_ppcp_set( &gap_conn_params));
     
     // Set up GATT
-    MICROBIT_BLE_ECHK( nrf_ble_gatt_init( &m_gatt, NULL));
+    // Request the largest ATT MTU and link layer packets the SoftDevice is configured for, so that
+    // services can send more than 20 bytes per packet, and several packets per connection event.
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_init( &m_gatt, microbit_ble_gatt_evt_handler));
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_att_mtu_periph_set( &m_gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE));
+#if NRF_SDH_BLE_GAP_DATA_LENGTH > BLE_GAP_DATA_LENGTH_DEFAULT
+    MICROBIT_BLE_ECHK( nrf_ble_gatt_data_length_set( &m_gatt, BLE_CONN_HANDLE_INVALID, NRF_SDH_BLE_GAP_DATA_LENGTH));
+#endif
         
     if ( enableBonding)
     {
@@ -492,6 +496,11 @@ void MicroBitBLEManager::init( ManagedString deviceName, ManagedString serialNum
         advertise();
 
     this->status |= DEVICE_COMPONENT_RUNNING;
+
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+    // Use idleCallback to apply changes of connection parameters.
+    this->status |= DEVICE_COMPONENT_STATUS_IDLE_TICK;
+#endif
 }
 
 
@@ -641,9 +650,48 @@ void MicroBitBLEManager::idleCallback()
         //MICROBIT_DEBUG_DMESG( "MICROBIT_BLE_STATUS_SHUTDOWN");
         nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE);
     }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+    if ( getConnected() && governor.update( system_timer_current_time()))
+        updateConnectionParameters();
+#endif
 }
 
 
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+/**
+ * Request the connection parameters and PHY for the governor's current connection mode.
+ */
+void MicroBitBLEManager::updateConnectionParameters()
+{
+    int mode = governor.getMode();
+
+    MICROBIT_DEBUG_DMESG( "connection mode %d: %d bytes/s, duty cycle %d/1000", mode, (int) governor.getThroughput(), governor.getDutyCycle());
+
+    ble_gap_conn_params_t params;
+    microbit_ble_conn_params( mode, &params);
+
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+
+    for ( uint32_t i = 0; i < list.len; i++)
+    {
+        // Update the preferred parameters held by the connection parameters module too, so that it doesn't renegotiate them.
+        MICROBIT_BLE_ECHK( ble_conn_params_change_conn_params( list.conn_handles[i], &params));
+
+        if ( mode == MICROBIT_BLE_CONNECTION_MODE_FAST)
+        {
+            ble_gap_phys_t const phys =
+            {
+                .tx_phys = BLE_GAP_PHY_2MBPS,
+                .rx_phys = BLE_GAP_PHY_2MBPS,
+            };
+            MICROBIT_BLE_ECHK( sd_ble_gap_phy_update( list.conn_handles[i], &phys));
+        }
+    }
+}
+#endif
+
+
 /**
  * When called, the micro:bit will begin advertising for a predefined period,
  * MICROBIT_BLE_ADVERTISING_TIMEOUT seconds to bonded devices.
@@ -689,6 +737,21 @@ bool MicroBitBLEManager::getConnected()
     return ble_conn_state_peripheral_conn_count() > 0;
 }
 
+/**
+ * Determine the largest attribute value that can be sent in a single notification or indication,
+ * based on the ATT MTU negotiated with the connected device.
+ * @return The number of bytes, or 20 (the BLE default) if there is no connection.
+ */
+int MicroBitBLEManager::getMaximumPayload()
+{
+    ble_conn_state_conn_handle_list_t list = ble_conn_state_periph_handles();
+
+    if ( list.len == 0)
+        return BLE_GATT_ATT_MTU_DEFAULT - 3;
+
+    return nrf_ble_gatt_eff_mtu_get( &m_gatt, list.conn_handles[0]) - 3;
+}
+
 
 #if CONFIG_ENABLED(MICROBIT_BLE_EDDYSTONE_URL)
 /**
@@ -1296,9 +1359,51 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
         case BLE_GAP_EVT_CONNECTED:
         {
             MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONNECTED %d", ble_conn_state_conn_count());
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+            if ( MicroBitBLEManager::manager)
+            {
+                ble_gap_conn_params_t const *params = &p_ble_evt->evt.gap_evt.params.connected.conn_params;
+                MicroBitBLEManager::manager->governor.reset( system_timer_current_time(), params->max_conn_interval, params->slave_latency);
+                MicroBitBLEManager::manager->governor.setPayload( BLE_GATT_ATT_MTU_DEFAULT - 3);
+            }
+#endif
             bleConnectionCallback( p_ble_evt->evt.gap_evt.conn_handle);
             break;
         }
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        {
+            ble_gap_conn_params_t const *params = &p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+            MICROBIT_DEBUG_DMESG( "BLE_GAP_EVT_CONN_PARAM_UPDATE %d %d", (int) params->max_conn_interval, (int) params->slave_latency);
+            if ( MicroBitBLEManager::manager)
+                MicroBitBLEManager::manager->governor.setConnectionParameters( params->max_conn_interval, params->slave_latency);
+            break;
+        }
+        case BLE_GAP_EVT_PHY_UPDATE:
+        {
+            if ( MicroBitBLEManager::manager && p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS)
+                MicroBitBLEManager::manager->governor.setPhy( p_ble_evt->evt.gap_evt.params.phy_update.tx_phy == BLE_GAP_PHY_2MBPS ? 2 : 1);
+            break;
+        }
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+        {
+            if ( MicroBitBLEManager::manager)
+                MicroBitBLEManager::manager->governor.onTransmit( p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count);
+            break;
+        }
+        case BLE_GATTS_EVT_HVC:
+        {
+            if ( MicroBitBLEManager::manager)
+                MicroBitBLEManager::manager->governor.onTransmit( 1);
+            break;
+        }
+        case BLE_GATTS_EVT_WRITE:
+        {
+            if ( MicroBitBLEManager::manager)
+                MicroBitBLEManager::manager->governor.onReceive( p_ble_evt->evt.gatts_evt.params.write.len);
+            break;
+        }
+#endif
         case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
         {
             ble_gap_phys_t const phys =
@@ -1338,6 +1443,34 @@ static void microbit_ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_conte
 }
 
 
+/**
+ * Callback for handling GATT module events, reporting the outcome of ATT MTU and data length negotiation.
+ *
+ * @param p_gatt GATT module instance.
+ * @param p_evt GATT module event.
+ */
+static void microbit_ble_gatt_evt_handler(nrf_ble_gatt_t * p_gatt, nrf_ble_gatt_evt_t const * p_evt)
+{
+    switch ( p_evt->evt_id)
+    {
+        case NRF_BLE_GATT_EVT_ATT_MTU_UPDATED:
+            MICROBIT_DEBUG_DMESG( "ATT MTU updated: %d", (int) p_evt->params.att_mtu_effective);
+#if CONFIG_ENABLED(MICROBIT_BLE_CONNECTION_GOVERNOR)
+            if ( MicroBitBLEManager::manager)
+                MicroBitBLEManager::manager->governor.setPayload( p_evt->params.att_mtu_effective - 3);
+#endif
+            break;
+
+        case NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED:
+            MICROBIT_DEBUG_DMESG( "Data length updated: %d", (int) p_evt->params.data_length);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
 /**
  * Callback for handling Peer Manager events.
  *
@@ -1406,6 +1539,41 @@ static void microbit_ble_pm_evt_handler(pm_evt_t const * p_evt)
 }
 
 
+/**
+ * Fill in the connection parameters to request for a connection mode.
+ *
+ * @param mode One of MICROBIT_BLE_CONNECTION_MODE_DEFAULT, _FAST or _IDLE.
+ * @param p_params The parameters to fill in.
+ */
+static void microbit_ble_conn_params( int mode, ble_gap_conn_params_t *p_params)
+{
+    memset( p_params, 0, sizeof( ble_gap_conn_params_t));
+    p_params->conn_sup_timeout = 400;   // 4s
+
+    switch ( mode)
+    {
+        case MICROBIT_BLE_CONNECTION_MODE_FAST:
+            p_params->min_conn_interval = MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MIN;
+            p_params->max_conn_interval = MICROBIT_BLE_GOVERNOR_FAST_INTERVAL_MAX;
+            p_params->slave_latency     = 0;
+            break;
+
+        case MICROBIT_BLE_CONNECTION_MODE_IDLE:
+            p_params->min_conn_interval = MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MIN;
+            p_params->max_conn_interval = MICROBIT_BLE_GOVERNOR_IDLE_INTERVAL_MAX;
+            p_params->slave_latency     = MICROBIT_BLE_GOVERNOR_IDLE_LATENCY;
+            break;
+
+        default:
+            // Configure for high speed mode where possible.
+            p_params->min_conn_interval = 8;    // 10 ms
+            p_params->max_conn_interval = 16;   // 20 ms
+            p_params->slave_latency     = 0;
+            break;
+    }
+}
+
+
 static void const_ascii_to_utf8(ble_srv_utf8_str_t * p_utf8, const char * p_ascii)
 {
     // ble_srv_ascii_to_utf8() doesn't check for p_ascii == NULL;
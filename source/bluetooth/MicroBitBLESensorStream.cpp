@@ -0,0 +1,172 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 British Broadcasting Corporation.
+This software is provided by Lancaster University by arrangement with the BBC.
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+
+/**
+  * Class definition for MicroBitBLESensorStream.
+  * Buffers timestamped x/y/z samples from a sensor, and streams them in batches over a notify characteristic.
+  */
+#include "MicroBitConfig.h"
+
+#if CONFIG_ENABLED(DEVICE_BLE)
+
+#include "MicroBitBLESensorStream.h"
+#include "MicroBitBLEManager.h"
+#include "MicroBitSystemTimer.h"
+
+using namespace codal;
+
+/**
+  * Constructor.
+  *
+  * @param service The service that owns the stream characteristic.
+  * @param characteristic The index of the stream characteristic within the service.
+  */
+MicroBitBLESensorStream::MicroBitBLESensorStream( MicroBitBLEService &service, int characteristic) :
+    service( service),
+    characteristic( characteristic)
+{
+    // One slot is left empty, to distinguish a full buffer from an empty one.
+    samples = (MicroBitBLESensorSample *) malloc( (MICROBIT_BLE_SENSOR_STREAM_SAMPLES + 1) * sizeof( MicroBitBLESensorSample));
+    sequences = (uint16_t *) malloc( (MICROBIT_BLE_SENSOR_STREAM_SAMPLES + 1) * sizeof( uint16_t));
+
+    head = 0;
+    tail = 0;
+    sequence = 0;
+    skip = 0;
+    sending = false;
+
+    memclr( packet, sizeof( packet));
+    config.decimation = 1;
+    config.dropped = 0;
+}
+
+/**
+  * Add a sample to the stream, and send any buffered samples that the connection can accept.
+  * If the buffer is full, the sample is dropped.
+  *
+  * @param x, y, z The value of the sample.
+  */
+void MicroBitBLESensorStream::add( int x, int y, int z)
+{
+    if ( skip > 0)
+    {
+        skip--;
+        return;
+    }
+
+    skip = config.decimation > 1 ? config.decimation - 1 : 0;
+
+    uint16_t next = ( head + 1) % ( MICROBIT_BLE_SENSOR_STREAM_SAMPLES + 1);
+
+    if ( next == tail)
+    {
+        // Leave a gap in the sequence numbers, so the receiver can tell where samples are missing.
+        config.dropped++;
+        sequence++;
+    }
+    else
+    {
+        MicroBitBLESensorSample *s = &samples[ head];
+        s->time = (uint16_t) system_timer_current_time();
+        s->x = x;
+        s->y = y;
+        s->z = z;
+        sequences[ head] = sequence++;
+
+        head = next;
+    }
+
+    flush();
+}
+
+/**
+  * Send as many buffered samples as the connection can accept.
+  * Should be called when queued notifications have been sent.
+  */
+void MicroBitBLESensorStream::flush()
+{
+    target_disable_irq();
+    if ( sending)
+    {
+        target_enable_irq();
+        return;
+    }
+    sending = true;
+    target_enable_irq();
+
+    int payload = min( MICROBIT_BLE_SENSOR_STREAM_PACKET_SIZE, MicroBitBLEManager::getMaximumPayload());
+    int capacity = ( payload - sizeof( uint16_t)) / sizeof( MicroBitBLESensorSample);
+
+    while ( tail != head && service.notifyChrValueEnabled( characteristic))
+    {
+        // Pack a run of consecutive samples into the packet.
+        uint16_t first = sequences[ tail];
+        uint16_t index = tail;
+        int count = 0;
+
+        memcpy( packet, &first, sizeof( uint16_t));
+
+        while ( index != head && count < capacity && sequences[ index] == (uint16_t)( first + count))
+        {
+            memcpy( packet + sizeof( uint16_t) + count * sizeof( MicroBitBLESensorSample), &samples[ index], sizeof( MicroBitBLESensorSample));
+            index = ( index + 1) % ( MICROBIT_BLE_SENSOR_STREAM_SAMPLES + 1);
+            count++;
+        }
+
+        // Stop if the SoftDevice's queue is full. We'll be called again once there's space.
+        if ( !service.notifyChrValue( characteristic, packet, sizeof( uint16_t) + count * sizeof( MicroBitBLESensorSample)))
+            break;
+
+        tail = index;
+    }
+
+    sending = false;
+}
+
+/**
+  * Update the configuration of the stream, following a write to its control characteristic.
+  *
+  * @param data The data written.
+  * @param len The number of bytes written.
+  */
+void MicroBitBLESensorStream::configure( const uint8_t *data, int len)
+{
+    if ( len >= (int) sizeof( config.decimation))
+    {
+        memcpy( &config.decimation, data, sizeof( config.decimation));
+        skip = 0;
+    }
+}
+
+/**
+  * Discard all buffered samples, for example when the connection is lost.
+  */
+void MicroBitBLESensorStream::reset()
+{
+    tail = head;
+    config.dropped = 0;
+}
+
+#endif
@@ -201,6 +201,10 @@ bool MicroBitBLEService::onBleEvent( microbit_ble_evt_t const * p_ble_evt)
           onHVC( p_ble_evt);
           break;
 
+      case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+          onHVNTxComplete( p_ble_evt);
+          break;
+
       case BLE_GATTS_EVT_WRITE:
           onWrite( p_ble_evt);
           break;
@@ -355,4 +359,14 @@ void MicroBitBLEService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 {
 }
 
+void MicroBitBLEService::onHVNTxComplete( const microbit_ble_evt_t *p_ble_evt)
+{
+    //MICROBIT_DEBUG_DMESG( "MicroBitBLEService::onHVNTxComplete");
+    onNotificationsSent( &p_ble_evt->evt.gatts_evt.params.hvn_tx_complete);
+}
+
+void MicroBitBLEService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+}
+
 #endif
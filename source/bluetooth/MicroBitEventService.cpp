@@ -54,17 +54,23 @@ MicroBitEventService::MicroBitEventService(BLEDevice &_ble, EventModel &_message
     // Initialise our characteristic values.
     clientEventBuffer.type = 0x00;
     clientEventBuffer.reason = 0x00;
-    microBitEventBuffer = microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
+    microBitRequirementsBuffer = clientRequirementsBuffer = clientEventBuffer;
+    memclr( microBitEventBuffer, sizeof(microBitEventBuffer));
     
     messageBusListenerOffset = 0;
 
+    eventQueueHead = 0;
+    eventQueueTail = 0;
+    sending = false;
+    sendRequested = false;
+
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
     CreateService( serviceUUID);
 
     CreateCharacteristic( mbbs_cIdxMEVENT, charUUID[ mbbs_cIdxMEVENT],
-                        (uint8_t *)&microBitEventBuffer,
-                         sizeof(EventServiceEvent), sizeof(EventServiceEvent),
+                        (uint8_t *)microBitEventBuffer,
+                         sizeof(EventServiceEvent), sizeof(microBitEventBuffer),
                          microbit_propREAD | microbit_propNOTIFY);
 
     CreateCharacteristic( mbbs_cIdxCEVENT, charUUID[ mbbs_cIdxCEVENT],
@@ -127,14 +133,97 @@ void MicroBitEventService::onDataWritten( const microbit_ble_evt_write_t *params
   */
 void MicroBitEventService::onMicroBitEvent(MicroBitEvent evt)
 {
-    EventServiceEvent *e = &microBitEventBuffer;
+    if ( !getConnected())
+        return;
+
+    uint16_t head = eventQueueHead;
+    uint16_t next = (head + 1) % (MICROBIT_BLE_EVENT_QUEUE_SIZE + 1);
+
+#if CONFIG_ENABLED(MICROBIT_BLE_EVENT_COALESCE)
+    // Drop the event if an identical one is still waiting to be sent.
+    for (uint16_t i = eventQueueTail; i != head; i = (i + 1) % (MICROBIT_BLE_EVENT_QUEUE_SIZE + 1))
+    {
+        if (eventQueue[i].type == evt.source && eventQueue[i].reason == evt.value)
+            return;
+    }
+#endif
+
+    if ( next != eventQueueTail)
+    {
+        eventQueue[head].type = evt.source;
+        eventQueue[head].reason = evt.value;
+        eventQueueHead = next;
+    }
+    else
+    {
+        MICROBIT_DEBUG_DMESG( "MicroBitEventService: queue full, event dropped");
+    }
+
+    sendEvents();
+}
+
+/**
+  * Invoked when notifications have been sent, and there is space to queue more.
+  */
+void MicroBitEventService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    sendEvents();
+}
 
-    if ( getConnected())
+/**
+  * Send as many queued events as the connection can accept.
+  * Events are packed into each notification, up to MICROBIT_EVENT_SERVICE_PACKET_EVENTS at a time.
+  */
+void MicroBitEventService::sendEvents()
+{
+    // Only send from one context at a time. If we're interrupted part way through,
+    // note that the attempt should be repeated, as space may have been freed.
+    target_disable_irq();
+    if ( sending)
     {
-        e->type = evt.source;
-        e->reason = evt.value;
-        notifyChrValue( mbbs_cIdxMEVENT, (const uint8_t *)e, sizeof(EventServiceEvent));
+        sendRequested = true;
+        target_enable_irq();
+        return;
     }
+    sending = true;
+    target_enable_irq();
+
+    do
+    {
+        sendRequested = false;
+
+        int capacity = min( MICROBIT_EVENT_SERVICE_PACKET_EVENTS, MicroBitBLEManager::getMaximumPayload() / (int) sizeof(EventServiceEvent));
+        uint16_t head = eventQueueHead;
+
+        while ( eventQueueTail != head)
+        {
+            uint16_t index = eventQueueTail;
+            int count = 0;
+
+            // If the client isn't subscribed, just keep the characteristic value up to date with the most recent event.
+            if ( !notifyChrValueEnabled( mbbs_cIdxMEVENT))
+            {
+                microBitEventBuffer[0] = eventQueue[(head + MICROBIT_BLE_EVENT_QUEUE_SIZE) % (MICROBIT_BLE_EVENT_QUEUE_SIZE + 1)];
+                setChrValue( mbbs_cIdxMEVENT, (const uint8_t *)microBitEventBuffer, sizeof(EventServiceEvent));
+                eventQueueTail = head;
+                break;
+            }
+
+            while ( index != head && count < capacity)
+            {
+                microBitEventBuffer[count++] = eventQueue[index];
+                index = (index + 1) % (MICROBIT_BLE_EVENT_QUEUE_SIZE + 1);
+            }
+
+            // Stop if the SoftDevice's queue is full. We'll be called again once there's space.
+            if ( !notifyChrValue( mbbs_cIdxMEVENT, (const uint8_t *)microBitEventBuffer, count * sizeof(EventServiceEvent)))
+                break;
+
+            eventQueueTail = index;
+        }
+    } while ( sendRequested);
+
+    sending = false;
 }
 
 /**
@@ -143,6 +232,9 @@ void MicroBitEventService::onMicroBitEvent(MicroBitEvent evt)
   */
 void MicroBitEventService::idleCallback()
 {
+    if ( !getConnected())
+        eventQueueTail = eventQueueHead;
+
     if ( !getConnected() && messageBusListenerOffset > 0)
     {
         messageBusListenerOffset = 0;
@@ -33,6 +33,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include "MicroBitIOPinService.h"
 #include "MicroBitFiber.h"
+#include "MicroBitSystemTimer.h"
 
 using namespace codal;
 
@@ -55,6 +56,13 @@ MicroBitIOPinService::MicroBitIOPinService(BLEDevice &_ble, MicroBitIO &_io) :
     ioPinServiceIOCharacteristicBuffer = 0;
     memset(ioPinServiceIOData, 0, sizeof(ioPinServiceIOData));
     memset(ioPinServicePWMCharacteristicBuffer, 0, sizeof(ioPinServicePWMCharacteristicBuffer));    // Create the AD characteristic, that defines whether each pin is treated as analogue or digital
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+    ioPinServiceEventPins = 0;
+    ioPinServiceChangedPins = 0;
+    ioPinServiceAnalogTime = 0;
+    ioPinServiceSending = false;
+#endif
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -132,7 +140,7 @@ int MicroBitIOPinService::isActiveInput(int i)
  * Scans through all pins that our BLE client have registered an interest in. 
  * For each pin that has changed value, update the BLE characteristic, and NOTIFY our client.
  */
-int MicroBitIOPinService::updateBLEInputs(bool updateAll)
+int MicroBitIOPinService::updateBLEInputs(bool updateAll, bool readAnalog)
 {
     int pairs = 0;
 
@@ -141,6 +149,24 @@ int MicroBitIOPinService::updateBLEInputs(bool updateAll)
         if (isActiveInput(i))
         {
             uint8_t value;
+            bool changed = false;
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+            uint32_t mask = 1 << i;
+
+            // Digital inputs with edge events only need reading once they have changed.
+            if (!updateAll && (ioPinServiceEventPins & mask) && !(ioPinServiceChangedPins & mask))
+                continue;
+
+            if (!updateAll && isAnalog(i) && !readAnalog)
+                continue;
+
+            // Clear the flag before reading the pin, so a change after the read is picked up next time.
+            target_disable_irq();
+            changed = (ioPinServiceChangedPins & mask) != 0;
+            ioPinServiceChangedPins &= ~mask;
+            target_enable_irq();
+#endif
 
             if (isDigital(i))
                	value = edgePin(i).getDigitalValue();
@@ -148,7 +174,7 @@ int MicroBitIOPinService::updateBLEInputs(bool updateAll)
                	value = edgePin(i).getAnalogValue() >> 2;
 
             // If the data has changed, send an update.
-            if (updateAll || value != ioPinServiceIOData[i])
+            if (updateAll || changed || value != ioPinServiceIOData[i])
             {
                 ioPinServiceIOData[i] = value;
 
@@ -189,6 +215,10 @@ void MicroBitIOPinService::onDataWritten( const microbit_ble_evt_write_t *params
             if(isAnalog(i) && isActiveInput(i))
                 edgePin(i).getAnalogValue();
         }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+        configureEvents();
+#endif
     }
 
     // Check for writes to the IO configuration characteristic
@@ -209,6 +239,10 @@ void MicroBitIOPinService::onDataWritten( const microbit_ble_evt_write_t *params
             if(isAnalog(i) && isActiveInput(i))
                edgePin(i).getAnalogValue();
         }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+        configureEvents();
+#endif
     }
 
     // Check for writes to the PWM Control characteristic
@@ -289,6 +323,34 @@ void MicroBitIOPinService::onDataRead( microbit_onDataRead_t *params)
  */
 void MicroBitIOPinService::idleCallback()
 {
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+    // Send at most one notification per connection event. Changes made meanwhile are packed into the next one.
+    if ( getConnected() && !ioPinServiceSending && notifyChrValueEnabled( mbbs_cIdxDATA))
+    {
+        CODAL_TIMESTAMP now = system_timer_current_time();
+        bool readAnalog = now - ioPinServiceAnalogTime >= MICROBIT_BLE_IO_PIN_ANALOG_PERIOD;
+
+        if ( readAnalog)
+            ioPinServiceAnalogTime = now;
+
+        int pairs = updateBLEInputs( false, readAnalog);
+        if ( pairs)
+        {
+            ioPinServiceSending = true;
+
+            if ( !notifyChrValue( mbbs_cIdxDATA, (uint8_t *)ioPinServiceDataCharacteristicBuffer, pairs * sizeof(IOData)))
+            {
+                // Report these pins again next time.
+                ioPinServiceSending = false;
+
+                target_disable_irq();
+                for ( int i = 0; i < pairs; i++)
+                    ioPinServiceChangedPins |= 1 << ioPinServiceDataCharacteristicBuffer[i].pin;
+                target_enable_irq();
+            }
+        }
+    }
+#else
     if ( getConnected())
     {
         int pairs = updateBLEInputs( false);
@@ -298,7 +360,77 @@ void MicroBitIOPinService::idleCallback()
             notifyChrValue( mbbs_cIdxDATA, (uint8_t *)ioPinServiceDataCharacteristicBuffer, pairs * sizeof(IOData));
         }
     }
+#endif
+}
+
+#if CONFIG_ENABLED(MICROBIT_BLE_IO_PIN_EVENTS)
+/**
+  * Invoked when BLE disconnects.
+  */
+void MicroBitIOPinService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
+{
+    ioPinServiceSending = false;
+}
+
+/**
+  * Invoked when notifications have been sent, and there is space to queue more.
+  */
+void MicroBitIOPinService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    ioPinServiceSending = false;
+}
+
+/**
+  * Enable edge events on the pins configured as digital inputs, and disable them on any other pins.
+  * Pins that don't support edge events are read on each idle tick, as before.
+  */
+void MicroBitIOPinService::configureEvents()
+{
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
+    {
+        uint32_t mask = 1 << i;
+        bool wanted = isActiveInput(i) && isDigital(i);
+
+        if (wanted && !(ioPinServiceEventPins & mask))
+        {
+            if (EventModel::defaultEventBus && edgePin(i).eventOn(MICROBIT_PIN_EVENT_ON_EDGE) == MICROBIT_OK)
+            {
+                EventModel::defaultEventBus->listen(edgePin(i).id, MICROBIT_EVT_ANY, this, &MicroBitIOPinService::pinEvent, MESSAGE_BUS_LISTENER_IMMEDIATE);
+                ioPinServiceEventPins |= mask;
+
+                // Report the current value.
+                target_disable_irq();
+                ioPinServiceChangedPins |= mask;
+                target_enable_irq();
+            }
+        }
+
+        if (!wanted && (ioPinServiceEventPins & mask))
+        {
+            EventModel::defaultEventBus->ignore(edgePin(i).id, MICROBIT_EVT_ANY, this, &MicroBitIOPinService::pinEvent);
+            ioPinServiceEventPins &= ~mask;
+
+            if (isDigital(i) && !isActiveInput(i))
+                edgePin(i).eventOn(MICROBIT_PIN_EVENT_NONE);
+        }
+    }
 }
 
+/**
+  * Callback. Invoked when a digital input changes.
+  */
+void MicroBitIOPinService::pinEvent( MicroBitEvent e)
+{
+    for (int i=0; i < MICROBIT_IO_PIN_SERVICE_PINCOUNT; i++)
+    {
+        if (edgePin(i).id == e.source)
+        {
+            ioPinServiceChangedPins |= 1 << i;
+            break;
+        }
+    }
+}
+#endif
+
 
 #endif
@@ -37,7 +37,11 @@ DEALINGS IN THE SOFTWARE.
 using namespace codal;
 
 const uint16_t MicroBitMagnetometerService::serviceUUID               = 0xf2d8;
-const uint16_t MicroBitMagnetometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xfb11, 0x9715, 0x386c, 0xB358 };
+const uint16_t MicroBitMagnetometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xfb11, 0x9715, 0x386c, 0xB358
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+                                                                         , 0x3dc0, 0x3dc1
+#endif
+                                                                         };
 
 
 /**
@@ -48,6 +52,9 @@ const uint16_t MicroBitMagnetometerService::charUUID[ mbbs_cIdxCOUNT] = { 0xfb11
   */
 MicroBitMagnetometerService::MicroBitMagnetometerService(BLEDevice &_ble, codal::Compass &_compass) :
         compass(_compass)
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+        , stream(*this, mbbs_cIdxSTREAM)
+#endif
 {
     // Initialise our characteristic values.
     magnetometerDataCharacteristicBuffer[0] = 0;
@@ -82,6 +89,19 @@ MicroBitMagnetometerService::MicroBitMagnetometerService(BLEDevice &_ble, codal:
                          sizeof(magnetometerCalibrationCharacteristicBuffer), sizeof(magnetometerCalibrationCharacteristicBuffer),
                          microbit_propWRITE | microbit_propNOTIFY);
 
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    CreateCharacteristic( mbbs_cIdxSTREAM, charUUID[ mbbs_cIdxSTREAM],
+                         stream.packet,
+                         0, sizeof(stream.packet),
+                         microbit_propNOTIFY);
+
+    CreateCharacteristic( mbbs_cIdxSTREAMCONFIG, charUUID[ mbbs_cIdxSTREAMCONFIG],
+                         (uint8_t *)&stream.config,
+                         sizeof(stream.config), sizeof(stream.config),
+                         microbit_propREAD | microbit_propWRITE);
+#endif
+
     if ( getConnected())
         listen( true);
 }
@@ -144,6 +164,21 @@ void MicroBitMagnetometerService::onDisconnect( const microbit_ble_evt_t *p_ble_
 {
     //MICROBIT_DEBUG_DMESG( "MicroBitMagnetometerService::onDisconnect");
     listen( false);
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    stream.reset();
+#endif
+}
+
+
+/**
+  * Invoked when notifications have been sent, and there is space to queue more.
+  */
+void MicroBitMagnetometerService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    stream.flush();
+#endif
 }
 
 
@@ -196,6 +231,15 @@ void MicroBitMagnetometerService::onDataWritten(const microbit_ble_evt_write_t *
         }
         return;
     }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+    if (params->handle == valueHandle( mbbs_cIdxSTREAMCONFIG))
+    {
+        stream.configure(params->data, params->len);
+        setChrValue( mbbs_cIdxSTREAMCONFIG, (const uint8_t *)&stream.config, sizeof(stream.config));
+        return;
+    }
+#endif
 }
 
 
@@ -216,6 +260,11 @@ void MicroBitMagnetometerService::magnetometerUpdate()
         {
             notifyChrValue( mbbs_cIdxBEARING,(uint8_t *)&magnetometerBearingCharacteristicBuffer, sizeof(magnetometerBearingCharacteristicBuffer));
         }
+
+#if CONFIG_ENABLED(MICROBIT_BLE_SENSOR_STREAM)
+        if ( notifyChrValueEnabled( mbbs_cIdxSTREAM))
+            stream.add( magnetometerDataCharacteristicBuffer[0], magnetometerDataCharacteristicBuffer[1], magnetometerDataCharacteristicBuffer[2]);
+#endif
     }
 }
 
@@ -61,6 +61,12 @@ MicroBitPartialFlashingService::MicroBitPartialFlashingService( BLEDevice &_ble,
 {
     // Set up partial flashing characteristic
     memclr( characteristicValue, sizeof( characteristicValue));
+
+    for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+    {
+        pages[i].data = NULL;
+        pages[i].state = PARTIAL_FLASHING_PAGE_FREE;
+    }
     
     // Register the base UUID and create the service.
     RegisterBaseUUID( base_uuid);
@@ -68,11 +74,12 @@ MicroBitPartialFlashingService::MicroBitPartialFlashingService( BLEDevice &_ble,
 
     CreateCharacteristic( mbbs_cIdxCTRL, charUUID[ mbbs_cIdxCTRL],
                          characteristicValue,
-                         sizeof(characteristicValue), sizeof(characteristicValue),
+                         20, sizeof(characteristicValue),
                          microbit_propWRITE_WITHOUT | microbit_propNOTIFY);
 
     // Set up listener for SD writing
     messageBus.listen( MICROBIT_ID_PARTIAL_FLASHING, MICROBIT_EVT_ANY, this, &MicroBitPartialFlashingService::partialFlashingEvent);
+    messageBus.listen( MICROBIT_ID_FLASH, MICROBIT_EVT_ANY, this, &MicroBitPartialFlashingService::flashCompleteEvent);
 }
 
 
@@ -137,6 +144,16 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           blockNum = 0;
           offset = 0;
 
+          // Reset FLASH_STREAM state. Pages already being written are left to complete.
+          streaming = false;
+          ackBase = 0;
+          ackBitmap = 0;
+          ackSent = 0;
+          streamEnd = 0;
+          for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+            if (pages[i].state == PARTIAL_FLASHING_PAGE_FILLING)
+              pages[i].state = PARTIAL_FLASHING_PAGE_FREE;
+
           break;
         }
         case FLASH_DATA:
@@ -145,6 +162,12 @@ void MicroBitPartialFlashingService::onDataWritten(const microbit_ble_evt_write_
           flashData(data);
           break;
         }
+        case FLASH_STREAM:
+        {
+          // Process FLASH_STREAM data packet
+          flashStream(data, params->len);
+          break;
+        }
         case END_OF_TRANSMISSION:
         {
           /* Start of embedded source isn't always on a page border so client must
@@ -281,6 +304,294 @@ void MicroBitPartialFlashingService::flashData(uint8_t *data)
 
 }
 
+/**
+  * Process a FLASH_STREAM data packet
+  *
+  * @param data - A pointer to the packet
+  * @param len - The length of the packet
+  */
+void MicroBitPartialFlashingService::flashStream(uint8_t *data, int len)
+{
+    // Each packet carries as much data as fits in the negotiated ATT MTU, and is written without response.
+    // The client may send up to PARTIAL_FLASHING_STREAM_WINDOW packets beyond the last one acknowledged.
+    // Addresses must increase with the sequence number. Data is word aligned, and may cross a page boundary.
+    // +-----------+---------+-----------------------+-----------------+
+    // | 1 Byte    | 1 Byte  | 4 Bytes               | 4n Bytes        |
+    // +-----------+---------+-----------------------+-----------------+
+    // | COMMAND   | SEQ#    | ADDRESS (little end.) | DATA            |
+    // +-----------+---------+-----------------------+-----------------+
+    //
+    // Acknowledgements are notified as a sliding window bitmap. Every packet before SEQ# has been received,
+    // and bit n of BITMAP is set if packet SEQ# + 1 + n has been received. The client should resend any
+    // packets missing from the window. A packet holding only the COMMAND byte requests an acknowledgement;
+    // the client should do this, and wait until every packet has been acknowledged, before END_OF_TRANSMISSION.
+    // +-----------+---------+-----------------------+
+    // | 1 Byte    | 1 Byte  | 4 Bytes               |
+    // +-----------+---------+-----------------------+
+    // | COMMAND   | SEQ#    | BITMAP (little end.)  |
+    // +-----------+---------+-----------------------+
+    if (len < 6)
+    {
+        sendStreamAck();
+        return;
+    }
+
+    uint8_t seq = data[1];
+    uint32_t address;
+    memcpy(&address, data + 2, sizeof(address));
+    int n = len - 6;
+
+    uint8_t delta = seq - ackBase;
+
+    // Ignore repeats of packets received out of order.
+    if (delta > 0 && delta < PARTIAL_FLASHING_STREAM_WINDOW && (ackBitmap & (1UL << (delta - 1))))
+        return;
+
+    // Ignore packets outside the window, and misaligned data. Let the client know where we are.
+    if (delta >= PARTIAL_FLASHING_STREAM_WINDOW || (address & 3) || (n & 3))
+    {
+        sendStreamAck();
+        return;
+    }
+
+    streaming = true;
+
+    // Copy the data into the buffers of the pages it covers.
+    uint32_t pageSize = MICROBIT_CODEPAGESIZE;
+    uint32_t a = address;
+    uint8_t *src = data + 6;
+
+    while (a < address + n)
+    {
+        uint32_t offset = a % pageSize;
+        uint32_t length = pageSize - offset;
+        if (length > address + n - a)
+            length = address + n - a;
+        MicroBitPartialFlashingPage *p = streamPage((uint32_t *)(a - offset), delta != 0);
+
+        // If no buffer is available, drop the packet. We'll acknowledge once a page has been written.
+        if (p == NULL)
+        {
+            MICROBIT_DEBUG_DMESG( "FLASH_STREAM no buffer for %x", (unsigned int) a);
+            return;
+        }
+
+        memcpy((uint8_t *)p->data + offset, src, length);
+        if (offset < p->low)
+            p->low = offset;
+        if (offset + length > p->high)
+            p->high = offset + length;
+
+        a += length;
+        src += length;
+    }
+
+    packetEnd[seq % PARTIAL_FLASHING_STREAM_WINDOW] = address + n;
+
+    bool ack = false;
+
+    if (delta == 0)
+    {
+        // Slide the window past this packet, and any that follow it that have already been received.
+        bool next = true;
+
+        while (next)
+        {
+            if (packetEnd[ackBase % PARTIAL_FLASHING_STREAM_WINDOW] > streamEnd)
+                streamEnd = packetEnd[ackBase % PARTIAL_FLASHING_STREAM_WINDOW];
+
+            next = ackBitmap & 1;
+            ackBitmap >>= 1;
+            ackBase++;
+        }
+    }
+    else
+    {
+        // Let the client know of the first gap straight away, so it can resend the missing packet.
+        ack = ackBitmap == 0;
+        ackBitmap |= 1UL << (delta - 1);
+    }
+
+    // Any page wholly before the end of the data received in order is complete, and can be written.
+    bool ready = false;
+    for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+    {
+        if (pages[i].state == PARTIAL_FLASHING_PAGE_FILLING && (uint32_t)pages[i].address + pageSize <= streamEnd)
+        {
+            pages[i].state = PARTIAL_FLASHING_PAGE_READY;
+            ready = true;
+        }
+    }
+
+    if (ready)
+        MicroBitEvent evt(MICROBIT_ID_PARTIAL_FLASHING, FLASH_STREAM);
+
+    if (ack || ready || (uint8_t)(ackBase - ackSent) >= PARTIAL_FLASHING_STREAM_ACK)
+        sendStreamAck();
+}
+
+/**
+  * Find the FLASH_STREAM page buffer for the given page, claiming a free one if necessary.
+  *
+  * @param address - The address of the page
+  * @param reserve - Leave at least one buffer free for data received in order.
+  * @return The page buffer, or NULL if none are free.
+  */
+MicroBitPartialFlashingPage *MicroBitPartialFlashingService::streamPage(uint32_t *address, bool reserve)
+{
+    MicroBitPartialFlashingPage *free = NULL;
+    int freeCount = 0;
+
+    for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+    {
+        MicroBitPartialFlashingPage *p = &pages[i];
+
+        if (p->state == PARTIAL_FLASHING_PAGE_WRITING && flash.isComplete(p->handle))
+            p->state = PARTIAL_FLASHING_PAGE_FREE;
+
+        if (p->state == PARTIAL_FLASHING_PAGE_FILLING && p->address == address)
+            return p;
+
+        if (p->state == PARTIAL_FLASHING_PAGE_FREE)
+        {
+            if (free == NULL)
+                free = p;
+            freeCount++;
+        }
+    }
+
+    // Data received out of order can't take the last buffer, or the missing data might never find one.
+    if (free == NULL || (reserve && freeCount < 2))
+        return NULL;
+
+    if (free->data == NULL)
+    {
+        free->data = (uint32_t *) malloc(MICROBIT_CODEPAGESIZE);
+        if (free->data == NULL)
+            return NULL;
+    }
+
+    memset(free->data, 0xFF, MICROBIT_CODEPAGESIZE);
+    free->address = address;
+    free->low = MICROBIT_CODEPAGESIZE;
+    free->high = 0;
+    free->state = PARTIAL_FLASHING_PAGE_FILLING;
+
+    return free;
+}
+
+/**
+  * Start asynchronous writes of any FLASH_STREAM pages that have been completely received.
+  */
+void MicroBitPartialFlashingService::writeStreamPages()
+{
+    uint32_t pageSize = MICROBIT_CODEPAGESIZE;
+
+    for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+    {
+        MicroBitPartialFlashingPage *p = &pages[i];
+
+        if (p->state != PARTIAL_FLASHING_PAGE_READY)
+            continue;
+
+        setFlashIncomplete();
+
+        // Keep any data in the page before the first byte received. Anything after the last byte is erased.
+        uint8_t *d = (uint8_t *)p->data;
+        if (p->low > 0)
+            memcpy(d, p->address, p->low);
+        if (p->high < pageSize)
+            memset(d + p->high, 0xFF, pageSize - p->high);
+
+        // Skip pages that are unchanged.
+        if (memcmp(d, p->address, pageSize) == 0)
+        {
+            p->state = PARTIAL_FLASHING_PAGE_FREE;
+            continue;
+        }
+
+        if (flash.need_erase(d, (uint8_t *)p->address, pageSize))
+            p->handle = flash.erase_page_async(p->address);
+
+        // Don't write the erased words at the end of the page.
+        int words = pageSize / sizeof(uint32_t);
+        while (words > 0 && p->data[words - 1] == 0xFFFFFFFF)
+            words--;
+
+        if (words > 0)
+            p->handle = flash.flash_burn_async(p->address, p->data, words);
+
+        MICROBIT_DEBUG_DMESG( "FLASH_STREAM write %x", (unsigned int) p->address);
+        p->state = PARTIAL_FLASHING_PAGE_WRITING;
+    }
+}
+
+/**
+  * Notify the client of the FLASH_STREAM packets received.
+  */
+void MicroBitPartialFlashingService::sendStreamAck()
+{
+    uint8_t flashNotificationBuffer[6];
+    flashNotificationBuffer[0] = FLASH_STREAM;
+    flashNotificationBuffer[1] = ackBase;
+    memcpy(&flashNotificationBuffer[2], &ackBitmap, sizeof(uint32_t));
+
+    ackSent = ackBase;
+    notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *)flashNotificationBuffer, sizeof(flashNotificationBuffer));
+}
+
+/**
+  * Invoked when a queued flash operation completes.
+  * Releases the buffers of FLASH_STREAM pages that have been written.
+  */
+void MicroBitPartialFlashingService::flashCompleteEvent(MicroBitEvent)
+{
+    bool freed = false;
+
+    for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+    {
+        if (pages[i].state == PARTIAL_FLASHING_PAGE_WRITING && flash.isComplete(pages[i].handle))
+        {
+            pages[i].state = PARTIAL_FLASHING_PAGE_FREE;
+            freed = true;
+        }
+    }
+
+    // Let the client resend anything dropped while both buffers were busy.
+    if (freed && streaming)
+        sendStreamAck();
+}
+
+/**
+  * Record that flashing is under way, so that we boot into BLE mode if it fails,
+  * and erase the MicroPython file system.
+  */
+void MicroBitPartialFlashingService::setFlashIncomplete()
+{
+    KeyValuePair* flashIncomplete = storage.get("flashIncomplete");
+    if(flashIncomplete == NULL){
+
+      uint8_t flashIncompleteVal = 0x01;
+      storage.put("flashIncomplete", &flashIncompleteVal, sizeof(flashIncompleteVal));
+
+      // Check if FS exists
+      if(micropython_fs_end != 0x00) {
+         for(uint32_t *page = (uint32_t *)micropython_fs_start; page < (uint32_t *)(micropython_fs_end); page += (MICROBIT_CODEPAGESIZE / sizeof(uint32_t))) {
+             // Check if page needs erasing
+             for(uint32_t i = 0; i < 1024; i++) {
+                 if(*(page + i) != 0xFFFFFFFF) {
+                     DMESG( "Erase page at %x", page);
+                     flash.erase_page(page);
+                     break; // If page has been erased we can skip the remaining bytes
+                 }
+             }
+         }
+      }
+
+    }
+    delete flashIncomplete;
+}
+
 /**
  * Ensure CRC validation settings are correct.
  */
@@ -347,7 +658,6 @@ void MicroBitPartialFlashingService::setDefaultBootloaderSettings()
 void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
 {
   MICROBIT_DEBUG_DMESG( "partialFlashingEvent");
-  MicroBitFlash flash;
 
   switch(e.value){
     case FLASH_DATA:
@@ -357,29 +667,7 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
        * Set flashIncomplete flag if not already set to boot into BLE mode
        * upon a failed flash.
        */
-       
-       KeyValuePair* flashIncomplete = storage.get("flashIncomplete");
-       if(flashIncomplete == NULL){
-
-         uint8_t flashIncompleteVal = 0x01;
-         storage.put("flashIncomplete", &flashIncompleteVal, sizeof(flashIncompleteVal));
-            
-         // Check if FS exists
-         if(micropython_fs_end != 0x00) {
-            for(uint32_t *page = (uint32_t *)micropython_fs_start; page < (uint32_t *)(micropython_fs_end); page += (MICROBIT_CODEPAGESIZE / sizeof(uint32_t))) {
-                // Check if page needs erasing
-                for(uint32_t i = 0; i < 1024; i++) {
-                    if(*(page + i) != 0xFFFFFFFF) {
-                        DMESG( "Erase page at %x", page);
-                        flash.erase_page(page);
-                        break; // If page has been erased we can skip the remaining bytes
-                    }
-                }
-            }
-         }
-
-       }
-       delete flashIncomplete;
+      setFlashIncomplete();
 
       uint32_t *flashPointer   = (uint32_t *)(offset);
 
@@ -410,12 +698,28 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
     case END_OF_TRANSMISSION:
     {
       MICROBIT_DEBUG_DMESG( "END_OF_TRANSMISSION offset %x", (unsigned int) offset);
-      // Write final packet
-      uint32_t *blockPointer;
-      uint32_t *flashPointer   = (uint32_t *) offset;
-
-      blockPointer = block;
-      flash.flash_burn(flashPointer, blockPointer, 16);
+      if (streaming)
+      {
+        // Write any partly filled pages, and wait for every page to be written
+        for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+          if (pages[i].state == PARTIAL_FLASHING_PAGE_FILLING)
+            pages[i].state = PARTIAL_FLASHING_PAGE_READY;
+
+        writeStreamPages();
+
+        for (int i = 0; i < PARTIAL_FLASHING_STREAM_PAGES; i++)
+          if (pages[i].state == PARTIAL_FLASHING_PAGE_WRITING)
+            flash.wait(pages[i].handle);
+      }
+      else
+      {
+        // Write final packet
+        uint32_t *blockPointer;
+        uint32_t *flashPointer   = (uint32_t *) offset;
+
+        blockPointer = block;
+        flash.flash_burn(flashPointer, blockPointer, 16);
+      }
 
       // Set no validation
       setDefaultBootloaderSettings();
@@ -433,6 +737,11 @@ void MicroBitPartialFlashingService::partialFlashingEvent(MicroBitEvent e)
       microbit_reset();
       break;
     }
+    case FLASH_STREAM:
+    {
+      writeStreamPages();
+      break;
+    }
     case MICROBIT_RESET:
     {
       MICROBIT_DEBUG_DMESG( "Calling restartInBLEMode");
@@ -38,6 +38,7 @@ DEALINGS IN THE SOFTWARE.
 #include "MicroBitFiber.h"
 #include "ErrorNo.h"
 #include "NotifyEvents.h"
+#include "nrf_sdh_ble.h"
 
 using namespace codal;
 
@@ -62,7 +63,9 @@ const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0003, 0x0002
 const uint16_t MicroBitUARTService::charUUID[ mbbs_cIdxCOUNT] = { 0x0002, 0x0003 };
 #endif 
 
-#define MICROBIT_UART_S_ATTRSIZE            20
+// Attribute values are sized to fill the largest ATT MTU the SoftDevice supports.
+// The ATT MTU negotiated for each connection determines how much of this is used.
+#define MICROBIT_UART_S_ATTRSIZE            (NRF_SDH_BLE_GATT_MAX_MTU_SIZE - 3)
 
 /**
  * Constructor for the UARTService.
@@ -100,6 +103,9 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
 
     waitingForEmpty = false;
 
+    memclr( delimeters, sizeof( delimeters));
+    rxBuffHeadMatch = -1;
+
     // Register the base UUID and create the service.
     RegisterBaseUUID( base_uuid);
     CreateService( serviceUUID);
@@ -113,7 +119,11 @@ MicroBitUARTService::MicroBitUARTService(BLEDevice &_ble, uint8_t rxBufferSize,
     CreateCharacteristic( mbbs_cIdxTX, charUUID[ mbbs_cIdxTX],
                           txBuffer + txBufferSize,
                           0, MICROBIT_UART_S_ATTRSIZE,
+#if CONFIG_ENABLED(MICROBIT_BLE_UART_NOTIFY)
+                          microbit_propINDICATE | microbit_propNOTIFY);
+#else
                           microbit_propINDICATE);
+#endif
 }
 
 
@@ -146,6 +156,18 @@ void MicroBitUARTService::onConfirmation( const microbit_ble_evt_hvc_t *params)
 }
 
 
+/**
+  * A callback function for whenever queued notifications have been transmitted
+  */
+void MicroBitUARTService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    bool async = !waitingForEmpty;
+    MicroBitEvent(MICROBIT_ID_NOTIFY, MICROBIT_UART_S_EVT_TX_EMPTY);
+    if ( async)
+        sendNext();
+}
+
+
 /**
   * A callback function for whenever a Bluetooth device writes to our RX characteristic.
   */
@@ -153,42 +175,43 @@ void MicroBitUARTService::onDataWritten(const microbit_ble_evt_write_t *params)
 {
     if (params->handle == valueHandle( mbbs_cIdxRX))
     {
-        uint16_t bytesWritten = params->len;
+        int oldHead = rxBufferHead;
+        int space = rxBufferSize - 1 - rxBufferedSize();
+        int bytesWritten = min(params->len, space);
 
-        for(int byteIterator = 0; byteIterator <  bytesWritten; byteIterator++)
+        //look for any of our delimeters (if any) in the data we are about to store
+        bool delimeterMatch = false;
+        for(int byteIterator = 0; byteIterator < bytesWritten; byteIterator++)
         {
-            int newHead = (rxBufferHead + 1) % rxBufferSize;
+            uint8_t c = params->data[byteIterator];
 
-            if(newHead != rxBufferTail)
+            if(delimeters[c >> 5] & (1UL << (c & 31)))
             {
-                char c = params->data[byteIterator];
-
-                int delimeterOffset = 0;
-                int delimLength = this->delimeters.length();
-
-                //iterate through our delimeters (if any) to see if there is a match
-                while(delimeterOffset < delimLength)
-                {
-                    //fire an event if there is to block any waiting fibers
-                    if(this->delimeters.charAt(delimeterOffset) == c)
-                        MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_DELIM_MATCH);
+                delimeterMatch = true;
+                break;
+            }
+        }
 
-                    delimeterOffset++;
-                }
+        rxBufferHead = circularWrite(rxBuffer, rxBufferSize, rxBufferHead, params->data, bytesWritten);
 
-                rxBuffer[rxBufferHead] = c;
+        //fire an event if there is to block any waiting fibers
+        if(delimeterMatch)
+            MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_DELIM_MATCH);
 
-                rxBufferHead = newHead;
+        //determine if the head passed the position requested by eventAfter()
+        if(rxBuffHeadMatch >= 0)
+        {
+            int distance = (rxBuffHeadMatch - oldHead + rxBufferSize) % rxBufferSize;
 
-                if(rxBufferHead == rxBuffHeadMatch)
-                {
-                    rxBuffHeadMatch = -1;
-                    MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_HEAD_MATCH);
-                }
+            if(distance > 0 && distance <= bytesWritten)
+            {
+                rxBuffHeadMatch = -1;
+                MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_HEAD_MATCH);
             }
-            else
-                MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_RX_FULL);
         }
+
+        if(bytesWritten < params->len)
+            MicroBitEvent(MICROBIT_ID_BLE_UART, MICROBIT_UART_S_EVT_RX_FULL);
     }
 }
 
@@ -206,16 +229,57 @@ void MicroBitUARTService::onDataWritten(const microbit_ble_evt_write_t *params)
   */
 void MicroBitUARTService::circularCopy(uint8_t *circularBuff, uint8_t circularBuffSize, uint8_t *linearBuff, uint16_t tailPosition, uint16_t headPosition)
 {
-    int toBuffIndex = 0;
-
-    while(tailPosition != headPosition)
+    if(tailPosition <= headPosition)
     {
-        linearBuff[toBuffIndex++] = circularBuff[tailPosition];
-
-        tailPosition = (tailPosition + 1) % circularBuffSize;
+        memcpy(linearBuff, circularBuff + tailPosition, headPosition - tailPosition);
+    }
+    else
+    {
+        //the data wraps around the end of the circular buffer, so copy it in two segments.
+        memcpy(linearBuff, circularBuff + tailPosition, circularBuffSize - tailPosition);
+        memcpy(linearBuff + circularBuffSize - tailPosition, circularBuff, headPosition);
     }
 }
 
+/**
+  * An internal method that copies values from a linear buffer into a circular buffer.
+  *
+  * @param circularBuff a pointer to the destination circular buffer
+  * @param circularBuffSize the size of the circular buffer
+  * @param headPosition the head position in the circular buffer you want to copy to
+  * @param linearBuff a pointer to the source linear buffer
+  * @param length the number of bytes to copy
+  *
+  * @return the new head position in the circular buffer
+  *
+  * @note this method assumes that the circular buffer has space for length bytes
+  */
+int MicroBitUARTService::circularWrite(uint8_t *circularBuff, uint8_t circularBuffSize, uint16_t headPosition, const uint8_t *linearBuff, int length)
+{
+    int firstSegment = min(length, circularBuffSize - headPosition);
+
+    memcpy(circularBuff + headPosition, linearBuff, firstSegment);
+    memcpy(circularBuff, linearBuff + firstSegment, length - firstSegment);
+
+    return (headPosition + length) % circularBuffSize;
+}
+
+/**
+  * An internal method that builds the set of characters to match against from a string of delimeters.
+  *
+  * @param delimeters the characters to match against
+  * @param set the set of 256 bits to populate, indexed by character
+  */
+void MicroBitUARTService::buildDelimeterSet(ManagedString delimeters, uint32_t *set)
+{
+    const uint8_t *d = (const uint8_t *)delimeters.toCharArray();
+
+    memclr(set, 8 * sizeof(uint32_t));
+
+    for(int i = 0; i < delimeters.length(); i++)
+        set[d[i] >> 5] |= 1UL << (d[i] & 31);
+}
+
 /**
   * Retreives a single character from our RxBuffer.
   *
@@ -305,23 +369,19 @@ int MicroBitUARTService::send(const uint8_t *buf, int length, MicroBitSerialMode
     if(length < 1 || mode == SYNC_SPINWAIT)
         return MICROBIT_INVALID_PARAMETER;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected() || !txEnabled())
         return MICROBIT_NOT_SUPPORTED;
 
     int bytesWritten = 0;
 
-    while ( getConnected() && indicateChrValueEnabled( mbbs_cIdxTX))
+    while ( getConnected() && txEnabled())
     {
         // Add new data that fits in the tx buffer
-        while ( bytesWritten < length)
-        {
-            int nextHead = (txBufferHead + 1) % txBufferSize;
-            if( nextHead == txBufferTail)
-                break;
+        int space = txBufferSize - 1 - txBufferedSize();
+        int size = min( length - bytesWritten, space);
 
-            txBuffer[ txBufferHead] = buf[ bytesWritten++];
-            txBufferHead = nextHead;
-        }
+        txBufferHead = circularWrite( txBuffer, txBufferSize, txBufferHead, buf + bytesWritten, size);
+        bytesWritten += size;
         
         if ( mode == SYNC_SLEEP)
         {
@@ -352,22 +412,52 @@ bool MicroBitUARTService::sendNext()
     if ( txValueSize != 0 || txBufferTail == txBufferHead)
         return false;
 
-    if( !getConnected() || !indicateChrValueEnabled( mbbs_cIdxTX))
+    if( !getConnected() || !txEnabled())
         return false;
 
-    // Duplicate the next tx data into the attribute buffer
+    // Fill each packet up to the ATT MTU negotiated for this connection.
+    int payload = min( MICROBIT_UART_S_ATTRSIZE, MicroBitBLEManager::getMaximumPayload());
     uint8_t *value = txBuffer + txBufferSize;
-    int txBufferNext = txBufferTail;
-    while ( txValueSize < MICROBIT_UART_S_ATTRSIZE && txBufferNext != txBufferHead)
+
+    // Notifications are copied into the SoftDevice's queue and are not acknowledged,
+    // so keep queueing packets until the tx buffer is empty or the queue is full.
+    if ( notifyChrValueEnabled( mbbs_cIdxTX))
     {
-        value[ txValueSize++] = txBuffer[ txBufferNext];
-        txBufferNext = ( txBufferNext + 1) % txBufferSize;
+        bool sent = false;
+
+        while ( txBufferTail != txBufferHead)
+        {
+            int size = min( payload, txBufferedSize());
+            int txBufferNext = ( txBufferTail + size) % txBufferSize;
+            circularCopy( txBuffer, txBufferSize, value, txBufferTail, txBufferNext);
+
+            if ( !notifyChrValue( mbbs_cIdxTX, value, size))
+                break;
+
+            txBufferTail = txBufferNext;
+            sent = true;
+        }
+
+        return sent;
     }
 
+    // Duplicate the next tx data into the attribute buffer
+    txValueSize = min( payload, txBufferedSize());
+    circularCopy( txBuffer, txBufferSize, value, txBufferTail, ( txBufferTail + txValueSize) % txBufferSize);
+
     indicateChrValue( mbbs_cIdxTX, value, txValueSize);
     return true;
 }
 
+/**
+  * Determine whether the connected device has subscribed to the TX characteristic.
+  * @return true if either notifications or indications are enabled.
+  */
+bool MicroBitUARTService::txEnabled()
+{
+    return notifyChrValueEnabled( mbbs_cIdxTX) || indicateChrValueEnabled( mbbs_cIdxTX);
+}
+
 /**
   * Copies characters into the buffer used for Transmitting to the central device.
   *
@@ -504,15 +594,17 @@ ManagedString MicroBitUARTService::readUntil(ManagedString delimeters, MicroBitS
 
     int foundIndex = -1;
 
+    uint32_t set[8];
+    buildDelimeterSet(delimeters, set);
+
     //ASYNC mode just iterates through our stored characters checking for any matches.
     while(localTail != rxBufferHead && foundIndex  == -1)
     {
         //we use localTail to prevent modification of the actual tail.
-        char c = rxBuffer[localTail];
+        uint8_t c = rxBuffer[localTail];
 
-        for(int delimeterIterator = 0; delimeterIterator < delimeters.length(); delimeterIterator++)
-            if(delimeters.charAt(delimeterIterator) == c)
-                foundIndex = localTail;
+        if(set[c >> 5] & (1UL << (c & 31)))
+            foundIndex = localTail;
 
         localTail = (localTail + 1) % rxBufferSize;
     }
@@ -525,7 +617,7 @@ ManagedString MicroBitUARTService::readUntil(ManagedString delimeters, MicroBitS
 
         foundIndex = rxBufferHead - 1;
 
-        this->delimeters = ManagedString();
+        memclr(this->delimeters, sizeof(this->delimeters));
     }
 
     if(foundIndex >= 0)
@@ -572,7 +664,7 @@ int MicroBitUARTService::eventOn(ManagedString delimeters, MicroBitSerialMode mo
         return MICROBIT_INVALID_PARAMETER;
 
     //configure our head match...
-    this->delimeters = delimeters;
+    buildDelimeterSet(delimeters, this->delimeters);
 
     //block!
     if(mode == SYNC_SLEEP)
@@ -41,6 +41,7 @@ using namespace codal::MicroBitUtility;
 
 #define MicroBitUtilityService_SLEEP 10
 #define MicroBitUtilityService_TIMEOUT 10
+#define MicroBitUtilityService_PREFETCH 512
 
 typedef enum replyState_t
 {
@@ -74,6 +75,11 @@ class codal::MicroBitUtilityWorkspace
     uint8_t   jobLow;
     bool      lock;
 
+    // Log data read ahead of the replies being sent, covering indices prefetchIndex to prefetchIndex + prefetchLength.
+    uint8_t   prefetch[ MicroBitUtilityService_PREFETCH];
+    uint32_t  prefetchIndex;
+    uint32_t  prefetchLength;
+
     /**
      * Constructor.
      */
@@ -93,6 +99,8 @@ class codal::MicroBitUtilityWorkspace
         replyState = replyStateClear;
         replyLength = 0;
         jobLow = 0;
+        prefetchIndex = 0;
+        prefetchLength = 0;
     }
 
     /**
@@ -176,6 +184,7 @@ MicroBitUtilityService::MicroBitUtilityService( BLEDevice &_ble, EventModel &_me
 {
     // Initialise data
     memclr( characteristicValue, sizeof( characteristicValue));
+    processPending = false;
 
     // Register the base UUID and create the service.
     RegisterBaseUUID( bs_base_uuid);
@@ -197,6 +206,7 @@ MicroBitUtilityService::MicroBitUtilityService( BLEDevice &_ble, EventModel &_me
  */
 void MicroBitUtilityService::onConnect( const microbit_ble_evt_t *p_ble_evt)
 {
+    reset();
     listen(true);
 }
 
@@ -208,6 +218,24 @@ void MicroBitUtilityService::onConnect( const microbit_ble_evt_t *p_ble_evt)
 void MicroBitUtilityService::onDisconnect( const microbit_ble_evt_t *p_ble_evt)
 {
     listen(false);
+    reset();
+}
+
+
+/**
+ * Discard any request from a previous connection.
+ * A processing event still queued when we stop listening is lost, so it is no longer pending.
+ * A request being processed is left to finish, as its reply can no longer be sent.
+ */
+void MicroBitUtilityService::reset()
+{
+    processPending = false;
+
+    if ( workspace && !workspace->lock)
+    {
+        delete workspace;
+        workspace = NULL;
+    }
 }
 
 
@@ -233,11 +261,37 @@ void MicroBitUtilityService::onDataWritten(const microbit_ble_evt_write_t *param
         }
         
         workspace->setRequest( params->data, params->len);
-        MicroBitEvent evt( MICROBIT_ID_UTILITY, MICROBIT_ID_UTILITY_PROCESS);
+        scheduleProcess();
     }
 }
 
 
+/**
+ * Invoked when notifications have been sent, and there is space to queue more.
+ * Resume processing a request that was waiting to send its reply.
+ */
+void MicroBitUtilityService::onNotificationsSent( const microbit_ble_evt_hvn_tx_complete_t *params)
+{
+    if ( workspace && workspace->request.type != requestTypeNone)
+        scheduleProcess();
+}
+
+
+/**
+ * Raise an event to process the current request, unless one is already pending.
+ */
+void MicroBitUtilityService::scheduleProcess()
+{
+    target_disable_irq();
+    bool pending = processPending;
+    processPending = true;
+    target_enable_irq();
+
+    if ( !pending)
+        MicroBitEvent evt( MICROBIT_ID_UTILITY, MICROBIT_ID_UTILITY_PROCESS);
+}
+
+
 /**
  * Callback. Invoked when a registered event occurs.
  */
@@ -249,6 +303,7 @@ void MicroBitUtilityService::onEvent(MicroBitEvent e)
             switch(e.value)
             {
                 case MICROBIT_ID_UTILITY_PROCESS:
+                    processPending = false;
                     processRequest();
                     break;
             }
@@ -278,9 +333,9 @@ void MicroBitUtilityService::listen( bool yes)
  */
 int MicroBitUtilityService::sendReply( const void *data, uint16_t length)
 {
-    bool ok = notifyChrValue( mbbs_cIdxCTRL, (const uint8_t *) data, length);
-    if ( !ok)
-        return DEVICE_BUSY;
+    int result = notifyChrValueStatus( mbbs_cIdxCTRL, (const uint8_t *) data, length);
+    if ( result != DEVICE_OK)
+        return result;
     workspace->onReplySent( data);
     return DEVICE_OK;
 }
@@ -311,15 +366,18 @@ int MicroBitUtilityService::processRequest()
                 break;
         }
         
-        // Check if finished processing the current request
-        if ( result == DEVICE_OK)
+        // Check if finished processing the current request.
+        // A reply that can't be sent for any reason other than a full transmit queue never will be, so drop the request.
+        if ( result != DEVICE_BUSY)
             workspace->init();
 
         workspace->lock = false;
     }
     
-    if ( workspace && workspace->request.type != requestTypeNone)
-        MicroBitEvent evt( MICROBIT_ID_UTILITY, MICROBIT_ID_UTILITY_PROCESS);
+    // If the reply couldn't be sent because the SoftDevice's queue is full,
+    // we'll be scheduled again from onNotificationsSent once there is space.
+    if ( workspace && workspace->request.type != requestTypeNone && result != DEVICE_BUSY)
+        scheduleProcess();
     return result;
 }
 
@@ -347,17 +405,35 @@ int MicroBitUtilityService::processLogLength()
 int MicroBitUtilityService::processLogRead()
 {
     requestLogRead_t *request = (requestLogRead_t *) &workspace->request;
+
+    // Fill each reply packet, up to the size of the negotiated ATT MTU.
+    int payload = min( sizeof( reply_t), MicroBitBLEManager::getMaximumPayload()) - offsetof( reply_t, data);
     
     while ( request->batchlen)
     {
         if ( workspace->replyState == replyStateClear)
         {
-            int block = min( request->batchlen, sizeof( reply_t) - offsetof( reply_t, data));
-            int result = log.readData(workspace->reply.data, request->index, block, (DataFormat) request->format, request->length);
+            int block = min( request->batchlen, payload);
+            int result = DEVICE_OK;
+
+            // Read ahead from the log, so each read fills several replies.
+            if ( request->index < workspace->prefetchIndex || request->index + block > workspace->prefetchIndex + workspace->prefetchLength)
+            {
+                uint32_t len = min( request->batchlen, sizeof( workspace->prefetch));
+                result = log.readData( workspace->prefetch, request->index, len, (DataFormat) request->format, request->length);
+                workspace->prefetchIndex  = request->index;
+                workspace->prefetchLength = result ? 0 : len;
+            }
+
             if ( result)
+            {
                 workspace->setReplyError( result);
+            }
             else
+            {
+                memcpy( workspace->reply.data, workspace->prefetch + ( request->index - workspace->prefetchIndex), block);
                 workspace->setReplyReady( block);
+            }
         }
         
         int r = sendReply( &workspace->reply, offsetof(reply_t, data) + workspace->replyLength);